@@ -0,0 +1,220 @@
+#include "autotune.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "cpuinfo.h"
+#include "integral.h"
+
+/* subintervals of one trial run, about 0.1 s for a single AVX2 worker */
+#define TUNE_SUBINTERVALS (1L << 26)
+#define TUNE_REPEATS 2
+/* a bigger setting has to win by this much to replace a smaller one */
+#define TUNE_MARGIN 0.02
+#define TUNE_MIN_CHUNK (1L << 14)
+#define TUNE_MAX_CHUNK (1L << 22)
+#define TUNE_LINE 256
+#define TUNE_MAX_COUNTS 64
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int autotune_profile_path(char *buf, size_t len) {
+    const char *path = getenv("INTEGRAL_PROFILE");
+    if (path && *path) {
+        snprintf(buf, len, "%s", path);
+        return 0;
+    }
+
+    const char *home = getenv("HOME");
+    char host[TUNE_LINE] = "localhost";
+    if (!home) {
+        return -1;
+    }
+    gethostname(host, sizeof(host) - 1);
+    snprintf(buf, len, "%s/.integral-%s.tune", home, host);
+    return 0;
+}
+
+int autotune_load(const char *path, TuneConfig *cfg) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+
+    TuneConfig c = {0, 0, PLACEMENT_SCATTER, KERNEL_AUTO};
+    int seen = 0;
+    char line[TUNE_LINE];
+    char value[TUNE_LINE];
+    while (fgets(line, sizeof(line), f)) {
+        Placement p;
+        if (sscanf(line, "threads %ld", &c.threads) == 1 && c.threads > 0) {
+            seen |= 1;
+        }
+        else if (sscanf(line, "chunk %ld", &c.chunk_size) == 1 && c.chunk_size > 0) {
+            seen |= 2;
+        }
+        else if (sscanf(line, "placement %255s", value) == 1 &&
+                 placement_parse(value, &p) == 0 && p.policy != PLACEMENT_LIST) {
+            c.policy = p.policy;
+            seen |= 4;
+        }
+        else if (sscanf(line, "kernel %255s", value) == 1 &&
+                 kernel_parse_isa(value, &c.isa) == 0) {
+            seen |= 8;
+        }
+    }
+    fclose(f);
+
+    if (seen != 15) {
+        fprintf(stderr, "%s: incomplete profile\n", path);
+        return -1;
+    }
+    *cfg = c;
+    return 0;
+}
+
+int autotune_save(const char *path, const TuneConfig *cfg) {
+    char tmp[TUNE_LINE * 4];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "w");
+    if (!f) {
+        perror(tmp);
+        return -1;
+    }
+
+    fprintf(f, "threads %ld\nchunk %ld\nplacement %s\nkernel %s\n",
+            cfg->threads, cfg->chunk_size, placement_name(cfg->policy),
+            kernel_name(cfg->isa));
+    if (fclose(f) != 0 || rename(tmp, path) != 0) {
+        perror(path);
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/* Subintervals per second of cfg, best of TUNE_REPEATS after a warm-up;
+ * 0 if the context cannot be created. */
+static double measure(const TuneConfig *cfg, int verbose) {
+    Placement p = {cfg->policy, 0, {0}, 0};
+    int *cpus = (int *)malloc(sizeof(int) * cfg->threads);
+    if (!cpus) {
+        return 0;
+    }
+    placement_plan(&p, cfg->threads, cpus, NULL);
+    IntegralCtx *ctx = integral_ctx_create_cpus(cfg->threads, cpus);
+    free(cpus);
+    if (!ctx) {
+        return 0;
+    }
+    integral_ctx_set_chunk(ctx, cfg->chunk_size);
+
+    integral_run(ctx, NULL, 0, 1, TUNE_SUBINTERVALS);
+    double best = 0;
+    for (int i = 0; i < TUNE_REPEATS; i++) {
+        double start = now_seconds();
+        integral_run(ctx, NULL, 0, 1, TUNE_SUBINTERVALS);
+        double rate = TUNE_SUBINTERVALS / (now_seconds() - start);
+        if (rate > best) {
+            best = rate;
+        }
+    }
+    integral_ctx_destroy(ctx);
+
+    if (verbose) {
+        fprintf(stderr, "autotune: %-6s %3ld workers %-8s chunk %-8ld %.3lg/s\n",
+                kernel_name(cfg->isa), cfg->threads, placement_name(cfg->policy),
+                cfg->chunk_size, best);
+    }
+    return best;
+}
+
+/* Keeps trial if it beats *rate by the margin. */
+static void consider(TuneConfig *best, double *rate, const TuneConfig *trial, int verbose) {
+    double r = measure(trial, verbose);
+    if (r > *rate * (1 + TUNE_MARGIN)) {
+        *best = *trial;
+        *rate = r;
+    }
+}
+
+int autotune_run(TuneConfig *best, int verbose) {
+    cpuinfo_parse();
+    long cpus = cpuinfo_getusablecpus();
+    if (cpus < 1) {
+        cpus = 1;
+    }
+
+    TuneConfig cfg = {cpus, 1L << 18, PLACEMENT_SCATTER, KERNEL_SCALAR};
+    double rate = 0;
+
+    /* narrowest first, so a wider kernel has to earn its place */
+    TuneConfig kbest = cfg;
+    for (int isa = KERNEL_SCALAR; isa < KERNEL_ISA_COUNT; isa++) {
+        if (!kernel_supported(isa) || kernel_init(isa) < 0) {
+            continue;
+        }
+        TuneConfig trial = cfg;
+        trial.isa = isa;
+        consider(&kbest, &rate, &trial, verbose);
+    }
+    cfg = kbest;
+    kernel_init(cfg.isa);
+
+    /* powers of two below the CPU count, the count and twice it; the
+     * fewest workers within the margin of the fastest win */
+    long counts[TUNE_MAX_COUNTS];
+    double rates[TUNE_MAX_COUNTS];
+    int ncounts = 0;
+    for (long threads = 1; threads < cpus && ncounts < TUNE_MAX_COUNTS - 2; threads *= 2) {
+        counts[ncounts++] = threads;
+    }
+    counts[ncounts++] = cpus;
+    counts[ncounts++] = 2 * cpus;
+
+    double fastest = 0;
+    for (int i = 0; i < ncounts; i++) {
+        TuneConfig trial = cfg;
+        trial.threads = counts[i];
+        rates[i] = (counts[i] == cfg.threads) ? rate : measure(&trial, verbose);
+        fastest = (rates[i] > fastest) ? rates[i] : fastest;
+    }
+    for (int i = 0; i < ncounts; i++) {
+        if (rates[i] * (1 + TUNE_MARGIN) >= fastest) {
+            cfg.threads = counts[i];
+            rate = rates[i];
+            break;
+        }
+    }
+
+    for (int policy = PLACEMENT_SCATTER; policy < PLACEMENT_LIST; policy++) {
+        if (policy == cfg.policy) {
+            continue;
+        }
+        TuneConfig trial = cfg;
+        trial.policy = policy;
+        consider(&cfg, &rate, &trial, verbose);
+    }
+
+    TuneConfig cbest = cfg;
+    for (long chunk = TUNE_MIN_CHUNK; chunk <= TUNE_MAX_CHUNK; chunk *= 4) {
+        if (chunk == cfg.chunk_size) {
+            continue;
+        }
+        TuneConfig trial = cfg;
+        trial.chunk_size = chunk;
+        consider(&cbest, &rate, &trial, verbose);
+    }
+    cfg = cbest;
+
+    if (rate == 0) {
+        return -1;
+    }
+    *best = cfg;
+    return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+#include <stddef.h>
+#include "kernel.h"
+#include "placement.h"
+
+/* Measured search for the fastest worker count, chunk size, placement and
+ * kernel on this host, and the per-host profile that keeps the result. */
+
+typedef struct TuneConfig {
+    long threads;
+    long chunk_size;
+    PlacementPolicy policy;
+    KernelIsa isa;
+} TuneConfig;
+
+/* $INTEGRAL_PROFILE, or ~/.integral-<hostname>.tune. */
+int autotune_profile_path(char *buf, size_t len);
+/* Returns -1 if the file is missing or does not hold a whole profile. */
+int autotune_load(const char *path, TuneConfig *cfg);
+int autotune_save(const char *path, const TuneConfig *cfg);
+
+/* Runs the search one parameter at a time: kernel, worker count, placement
+ * and then chunk size, each trial a short trapezoid run of the built-in
+ * integrand. Leaves the winning kernel selected. verbose reports every
+ * trial on stderr. Returns -1 if no configuration could be run. */
+int autotune_run(TuneConfig *best, int verbose);
+
+#endif /* ifndef AUTOTUNE_H */
@@ -0,0 +1,47 @@
+#include "batch.h"
+#include <time.h>
+#include "integrand.h"
+
+/* Jobs are handed out one at a time from a shared index, so a worker that
+ * drew short jobs keeps going while another is still on a long one. */
+typedef struct Batch {
+    const IntegralJob *jobs;
+    long count;
+    long max_n;
+    double *values;
+    integral_job_fn done;
+    void *arg;
+    long next;
+} Batch;
+
+static double seconds_since(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) + (now.tv_nsec - since->tv_nsec) * 1e-9;
+}
+
+static void run_jobs(void *arg, long worker) {
+    Batch *batch = (Batch *)arg;
+    long i = 0;
+    while ((i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) < batch->count) {
+        const IntegralJob *job = &batch->jobs[i];
+        if (job->n > batch->max_n) {
+            continue;
+        }
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        double step = (job->b - job->a) / job->n;
+        double value = integrand_trapezoid(job->f, job->a, step, 0, job->n);
+        batch->values[i] = value;
+        if (batch->done) {
+            batch->done(i, value, seconds_since(&start), batch->arg);
+        }
+    }
+}
+
+void batch_run(Pool *pool, const IntegralJob *jobs, long count, long max_n,
+               double *values, integral_job_fn done, void *arg) {
+    Batch batch = {jobs, count, max_n, values, done, arg, 0};
+    pool_run(pool, run_jobs, &batch);
+}
@@ -0,0 +1,11 @@
+#ifndef BATCH_H
+#define BATCH_H
+#include "integral.h"
+#include "pool.h"
+
+/* Runs every job with n <= max_n on a single worker; larger jobs are left
+ * for the caller. */
+void batch_run(Pool *pool, const IntegralJob *jobs, long count, long max_n,
+               double *values, integral_job_fn done, void *arg);
+
+#endif /* ifndef BATCH_H */
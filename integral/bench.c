@@ -0,0 +1,478 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "cpuinfo.h"
+#include "integral.h"
+#include "kernel.h"
+#include "placement.h"
+
+/* In-process benchmark of the trapezoid engine: every combination of
+ * kernel, placement and worker count is warmed up and then repeated until
+ * the 95% confidence interval of its time is tight, and the results go out
+ * as CSV or JSON with the host's topology. A baseline CSV turns the run
+ * into a regression gate. */
+
+#define DEFAULT_SUBINTERVALS (1L << 28)
+#define DEFAULT_MIN_REPS 5
+#define DEFAULT_MAX_REPS 30
+#define DEFAULT_CI 0.01
+#define DEFAULT_TOLERANCE 0.05
+#define MAX_VALUES 64
+#define MAX_LINE 1024
+#define EXIT_REGRESSION 2
+
+typedef struct Options {
+    long workers[MAX_VALUES];
+    int worker_count;
+    PlacementPolicy policies[MAX_VALUES];
+    int policy_count;
+    KernelIsa isas[MAX_VALUES];
+    int isa_count;
+    long n;
+    int min_reps;
+    int max_reps;
+    double ci;
+    int json;
+    const char *output;
+    const char *baseline;
+    double tolerance;
+} Options;
+
+typedef struct Result {
+    KernelIsa isa;
+    PlacementPolicy policy;
+    long workers;
+    int reps;
+    double mean;        /* seconds per run */
+    double stddev;
+    double ci95;        /* half-width of the interval for the mean */
+    double cpu;         /* CPU seconds per run */
+    double rate;        /* evaluations per second */
+    double speedup;     /* over one worker of the same kernel and placement */
+    double efficiency;
+    IntegralStats *stats;
+} Result;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double cpu_seconds(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 1e-6 +
+           ru.ru_stime.tv_sec + ru.ru_stime.tv_usec * 1e-6;
+}
+
+/* Two-sided 95% quantile of Student's t with dof degrees of freedom. */
+static double t95(int dof) {
+    static const double table[] = {
+        0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+    };
+    if (dof < 1) {
+        return INFINITY;
+    }
+    return (dof < sizeof(table) / sizeof(table[0])) ? table[dof] : 1.96;
+}
+
+static int run_config(const Options *o, KernelIsa isa, PlacementPolicy policy, long workers,
+                      Result *res) {
+    if (kernel_init(isa) < 0) {
+        return -1;
+    }
+
+    Placement p = {policy, 0, {0}, 0};
+    int *cpus = (int *)malloc(sizeof(int) * workers);
+    res->stats = (IntegralStats *)calloc(workers, sizeof(IntegralStats));
+    if (!cpus || !res->stats) {
+        free(cpus);
+        return -1;
+    }
+    placement_plan(&p, workers, cpus, NULL);
+    IntegralCtx *ctx = integral_ctx_create_cpus(workers, cpus);
+    free(cpus);
+    if (!ctx) {
+        return -1;
+    }
+
+    /* warm-up: thread start, page faults, clocks ramping */
+    integral_run(ctx, NULL, 0, 10, o->n);
+
+    /* Welford's running mean and variance */
+    double mean = 0;
+    double m2 = 0;
+    double cpu = 0;
+    int reps = 0;
+    while (reps < o->max_reps) {
+        double cpu_start = cpu_seconds();
+        double start = now_seconds();
+        integral_run(ctx, NULL, 0, 10, o->n);
+        double t = now_seconds() - start;
+        cpu += cpu_seconds() - cpu_start;
+
+        reps++;
+        double delta = t - mean;
+        mean += delta / reps;
+        m2 += delta * (t - mean);
+
+        if (reps >= o->min_reps &&
+            t95(reps - 1) * sqrt(m2 / (reps - 1) / reps) <= o->ci * mean) {
+            break;
+        }
+    }
+
+    for (long i = 0; i < workers; i++) {
+        integral_ctx_stats(ctx, i, &res->stats[i]);
+    }
+    integral_ctx_destroy(ctx);
+
+    res->isa = isa;
+    res->policy = policy;
+    res->workers = workers;
+    res->reps = reps;
+    res->mean = mean;
+    res->stddev = (reps > 1) ? sqrt(m2 / (reps - 1)) : 0;
+    res->ci95 = t95(reps - 1) * res->stddev / sqrt(reps);
+    res->cpu = cpu / reps;
+    res->rate = (o->n + 1) / mean;
+    return 0;
+}
+
+static void print_host(FILE *out, int json) {
+    char host[256] = "unknown";
+    gethostname(host, sizeof(host) - 1);
+    size_t l1 = cpuinfo_getcachesize(-1, 1);
+    size_t l2 = cpuinfo_getcachesize(-1, 2);
+    size_t l3 = cpuinfo_getcachesize(-1, 3);
+
+    if (json) {
+        fprintf(out, "  \"host\": {\"name\": \"%s\", \"cpus\": %zu, \"cores\": %zu, "
+                     "\"nodes\": %zu, \"llcs\": %zu, \"quota\": %g, "
+                     "\"l1d\": %zu, \"l2\": %zu, \"l3\": %zu, \"kernel\": \"%s\"},\n",
+                host, cpuinfo_getcpus(), cpuinfo_getphysicalcores(), cpuinfo_getnodes(),
+                cpuinfo_getllcs(), cpuinfo_getquota(), l1, l2, l3,
+                kernel_name(kernel_isa()));
+        return;
+    }
+    fprintf(out, "# host %s: %zu cpus, %zu cores, %zu nodes, %zu llcs, quota %g, "
+                 "l1d %zu, l2 %zu, l3 %zu\n",
+            host, cpuinfo_getcpus(), cpuinfo_getphysicalcores(), cpuinfo_getnodes(),
+            cpuinfo_getllcs(), cpuinfo_getquota(), l1, l2, l3);
+}
+
+static void print_results(FILE *out, const Options *o, const Result *res, long count) {
+    if (!o->json) {
+        print_host(out, 0);
+        fprintf(out, "kernel,placement,workers,reps,mean_s,stddev_s,ci95_s,cpu_s,"
+                     "evals_per_s,speedup,efficiency,stolen_pct\n");
+        for (long i = 0; i < count; i++) {
+            const Result *r = &res[i];
+            long executed = 0;
+            long stolen = 0;
+            for (long w = 0; w < r->workers; w++) {
+                executed += r->stats[w].executed;
+                stolen += r->stats[w].stolen;
+            }
+            fprintf(out, "%s,%s,%ld,%d,%.6f,%.6f,%.6f,%.6f,%.6e,%.4f,%.4f,%.2f\n",
+                    kernel_name(r->isa), placement_name(r->policy), r->workers, r->reps,
+                    r->mean, r->stddev, r->ci95, r->cpu, r->rate, r->speedup,
+                    r->efficiency, executed ? 100.0 * stolen / executed : 0);
+        }
+        return;
+    }
+
+    fprintf(out, "{\n  \"subintervals\": %ld,\n", o->n);
+    print_host(out, 1);
+    fprintf(out, "  \"results\": [\n");
+    for (long i = 0; i < count; i++) {
+        const Result *r = &res[i];
+        fprintf(out, "    {\"kernel\": \"%s\", \"placement\": \"%s\", \"workers\": %ld, "
+                     "\"reps\": %d, \"mean_s\": %.6f, \"stddev_s\": %.6f, \"ci95_s\": %.6f, "
+                     "\"cpu_s\": %.6f, \"evals_per_s\": %.6e, \"speedup\": %.4f, "
+                     "\"efficiency\": %.4f, \"threads\": [",
+                kernel_name(r->isa), placement_name(r->policy), r->workers, r->reps,
+                r->mean, r->stddev, r->ci95, r->cpu, r->rate, r->speedup, r->efficiency);
+        for (long w = 0; w < r->workers; w++) {
+            fprintf(out, "%s{\"executed\": %ld, \"stolen\": %ld, \"steals\": %ld, "
+                         "\"remote\": %ld}",
+                    w ? ", " : "", r->stats[w].executed, r->stats[w].stolen,
+                    r->stats[w].steals, r->stats[w].remote);
+        }
+        fprintf(out, "]}%s\n", (i < count - 1) ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+/* Compares against a CSV written by an earlier run: a configuration that
+ * lost more than the tolerance of its evaluations per second, beyond both
+ * runs' confidence intervals, is a regression. */
+static int check_baseline(const Options *o, const Result *res, long count) {
+    FILE *f = fopen(o->baseline, "r");
+    if (!f) {
+        perror(o->baseline);
+        return -1;
+    }
+
+    int regressions = 0;
+    int matched = 0;
+    char line[MAX_LINE];
+    while (fgets(line, sizeof(line), f)) {
+        char kernel[64];
+        char policy[64];
+        long workers = 0;
+        int reps = 0;
+        double mean = 0;
+        double stddev = 0;
+        double ci95 = 0;
+        if (line[0] == '#' ||
+            sscanf(line, "%63[^,],%63[^,],%ld,%d,%lf,%lf,%lf", kernel, policy,
+                   &workers, &reps, &mean, &stddev, &ci95) != 7) {
+            continue;
+        }
+
+        for (long i = 0; i < count; i++) {
+            const Result *r = &res[i];
+            if (strcmp(kernel, kernel_name(r->isa)) != 0 ||
+                strcmp(policy, placement_name(r->policy)) != 0 || workers != r->workers) {
+                continue;
+            }
+            matched++;
+            /* slower by more than the tolerance even at the favourable ends
+             * of both intervals */
+            double best_now = r->mean - r->ci95;
+            double worst_then = mean + ci95;
+            if (best_now > worst_then * (1 + o->tolerance)) {
+                fprintf(stderr, "regression: %s %s %ld workers: %.4f s, baseline %.4f s "
+                                "(%+.1f%%)\n",
+                        kernel, policy, workers, r->mean, mean,
+                        100 * (r->mean / mean - 1));
+                regressions++;
+            }
+        }
+    }
+    fclose(f);
+
+    fprintf(stderr, "baseline: %d configurations compared, %d regressions\n",
+            matched, regressions);
+    return regressions;
+}
+
+static int parse_list(const char *str, long *values, int *count) {
+    *count = 0;
+    while (*str && *count < MAX_VALUES) {
+        char *end = NULL;
+        long v = strtol(str, &end, 10);
+        if (end == str || v < 1 || (*end != ',' && *end != '\0')) {
+            fprintf(stderr, "bad list: %s\n", str);
+            return -1;
+        }
+        values[(*count)++] = v;
+        str = (*end == ',') ? end + 1 : end;
+    }
+    return (*count > 0) ? 0 : -1;
+}
+
+/* comma-separated names; "all" for every kernel the CPU runs */
+static int parse_kernels(const char *str, Options *o) {
+    o->isa_count = 0;
+    if (strcmp(str, "all") == 0) {
+        for (int isa = KERNEL_SCALAR; isa < KERNEL_ISA_COUNT; isa++) {
+            if (kernel_supported(isa)) {
+                o->isas[o->isa_count++] = isa;
+            }
+        }
+        return 0;
+    }
+
+    char buf[MAX_LINE];
+    snprintf(buf, sizeof(buf), "%s", str);
+    for (char *tok = strtok(buf, ","); tok && o->isa_count < MAX_VALUES;
+         tok = strtok(NULL, ",")) {
+        if (kernel_parse_isa(tok, &o->isas[o->isa_count]) < 0) {
+            return -1;
+        }
+        o->isa_count++;
+    }
+    return (o->isa_count > 0) ? 0 : -1;
+}
+
+static int parse_policies(const char *str, Options *o) {
+    char buf[MAX_LINE];
+    snprintf(buf, sizeof(buf), "%s", str);
+    o->policy_count = 0;
+    for (char *tok = strtok(buf, ","); tok && o->policy_count < MAX_VALUES;
+         tok = strtok(NULL, ",")) {
+        Placement p;
+        if (placement_parse(tok, &p) < 0 || p.policy == PLACEMENT_LIST) {
+            return -1;
+        }
+        o->policies[o->policy_count++] = p.policy;
+    }
+    return (o->policy_count > 0) ? 0 : -1;
+}
+
+static int usage(void) {
+    fprintf(stderr, "Usage: bench [-w workers,...] [-p placement,...] [-k kernel,...|all]\n"
+                    "             [-n subintervals] [-m min reps] [-r max reps] [-e rel ci]\n"
+                    "             [-f csv|json] [-o output] [-B baseline.csv] [-x tolerance]\n"
+                    "Defaults: powers of two up to twice the usable CPUs, scatter, the\n"
+                    "widest kernel, 2^28 subintervals, 5..30 reps until the 95%% interval\n"
+                    "is within 1%% of the mean. Exits with %d on a regression against the\n"
+                    "baseline beyond the tolerance (0.05).\n", EXIT_REGRESSION);
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char *argv[]) {
+    Options o;
+    memset(&o, 0, sizeof(o));
+    o.n = DEFAULT_SUBINTERVALS;
+    o.min_reps = DEFAULT_MIN_REPS;
+    o.max_reps = DEFAULT_MAX_REPS;
+    o.ci = DEFAULT_CI;
+    o.tolerance = DEFAULT_TOLERANCE;
+
+    cpuinfo_parse();
+    if (kernel_init(KERNEL_AUTO) < 0) {
+        return EXIT_FAILURE;
+    }
+    o.isas[o.isa_count++] = kernel_isa();
+    o.policies[o.policy_count++] = PLACEMENT_SCATTER;
+
+    int opt = 0;
+    long value = 0;
+    int count = 0;
+    while ((opt = getopt(argc, argv, "w:p:k:n:m:r:e:f:o:B:x:")) != -1) {
+        switch (opt) {
+        case 'w':
+            if (parse_list(optarg, o.workers, &o.worker_count) < 0) {
+                return usage();
+            }
+            break;
+        case 'p':
+            if (parse_policies(optarg, &o) < 0) {
+                return usage();
+            }
+            break;
+        case 'k':
+            if (parse_kernels(optarg, &o) < 0) {
+                return usage();
+            }
+            break;
+        case 'n':
+        case 'm':
+        case 'r':
+            if (parse_list(optarg, &value, &count) < 0 || count != 1) {
+                return usage();
+            }
+            if (opt == 'n') {
+                o.n = value;
+            }
+            else if (opt == 'm') {
+                o.min_reps = (value < 2) ? 2 : value;
+            }
+            else {
+                o.max_reps = value;
+            }
+            break;
+        case 'e':
+            o.ci = atof(optarg);
+            break;
+        case 'x':
+            o.tolerance = atof(optarg);
+            break;
+        case 'f':
+            if (strcmp(optarg, "csv") != 0 && strcmp(optarg, "json") != 0) {
+                return usage();
+            }
+            o.json = (strcmp(optarg, "json") == 0);
+            break;
+        case 'o':
+            o.output = optarg;
+            break;
+        case 'B':
+            o.baseline = optarg;
+            break;
+        default:
+            return usage();
+        }
+    }
+    if (optind != argc) {
+        return usage();
+    }
+    if (o.max_reps < o.min_reps) {
+        o.max_reps = o.min_reps;
+    }
+
+    if (o.worker_count == 0) {
+        long cpus = cpuinfo_getusablecpus();
+        for (long w = 1; w <= 2 * cpus && o.worker_count < MAX_VALUES; w *= 2) {
+            o.workers[o.worker_count++] = w;
+        }
+        if (cpus > 1 && (cpus & (cpus - 1)) != 0) {
+            o.workers[o.worker_count++] = cpus;
+        }
+    }
+
+    long total = (long)o.isa_count * o.policy_count * o.worker_count;
+    Result *res = (Result *)calloc(total, sizeof(Result));
+    if (!res) {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+
+    long done = 0;
+    for (int k = 0; k < o.isa_count; k++) {
+        for (int p = 0; p < o.policy_count; p++) {
+            double single = 0;
+            for (int w = 0; w < o.worker_count; w++) {
+                Result *r = &res[done];
+                if (run_config(&o, o.isas[k], o.policies[p], o.workers[w], r) < 0) {
+                    fprintf(stderr, "bench: %s %s %ld workers failed\n",
+                            kernel_name(o.isas[k]), placement_name(o.policies[p]),
+                            o.workers[w]);
+                    continue;
+                }
+                if (r->workers == 1) {
+                    single = r->mean;
+                }
+                r->speedup = single ? single / r->mean : 0;
+                r->efficiency = r->speedup / r->workers;
+                fprintf(stderr, "[%ld / %ld] %s %s %ld workers: %.4f s +- %.4f (%d reps)\n",
+                        done + 1, total, kernel_name(r->isa), placement_name(r->policy),
+                        r->workers, r->mean, r->ci95, r->reps);
+                done++;
+            }
+        }
+    }
+
+    FILE *out = o.output ? fopen(o.output, "w") : stdout;
+    if (!out) {
+        perror(o.output);
+        return EXIT_FAILURE;
+    }
+    print_results(out, &o, res, done);
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    int retval = EXIT_SUCCESS;
+    if (o.baseline) {
+        int regressions = check_baseline(&o, res, done);
+        retval = (regressions < 0) ? EXIT_FAILURE :
+                 (regressions > 0) ? EXIT_REGRESSION : EXIT_SUCCESS;
+    }
+
+    for (long i = 0; i < done; i++) {
+        free(res[i].stats);
+    }
+    free(res);
+    return retval;
+}
@@ -0,0 +1,107 @@
+#include "calib.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "kernel.h"
+
+/* subintervals between clock reads */
+#define CALIB_BATCH (1L << 14)
+
+typedef struct Calib {
+    double seconds;
+    double *rates;
+} Calib;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void run_calib(void *arg, long worker) {
+    Calib *c = (Calib *)arg;
+    double start = now_seconds();
+    double elapsed = 0;
+    long evaluations = 0;
+    volatile double sink = 0;
+
+    do {
+        sink += kernel_trapezoid(0, 1e-9, evaluations, evaluations + CALIB_BATCH);
+        evaluations += CALIB_BATCH + 1;
+        elapsed = now_seconds() - start;
+    } while (elapsed < c->seconds);
+
+    (void)sink;
+    c->rates[worker] = evaluations / elapsed;
+}
+
+void calib_measure(Pool *pool, double seconds, double *rates) {
+    Calib c = {seconds, rates};
+    pool_run(pool, run_calib, &c);
+}
+
+static void format_key(char *buf, size_t len, const char *isa, const int *cpus, long n) {
+    size_t used = snprintf(buf, len, "%s ", isa);
+    for (long i = 0; i < n && used < len; i++) {
+        used += snprintf(buf + used, len - used, (i == 0) ? "%d" : ",%d", cpus[i]);
+    }
+}
+
+int calib_load(const char *path, const char *isa, const int *cpus, long n, double *rates) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+
+    char key[CALIB_MAX_LINE];
+    char line[CALIB_MAX_LINE];
+    format_key(key, sizeof(key), isa, cpus, n);
+    size_t keylen = strlen(key);
+
+    int found = -1;
+    while (found < 0 && fgets(line, sizeof(line), f)) {
+        if (strncmp(line, key, keylen) != 0 || line[keylen] != ' ') {
+            continue;
+        }
+        char *pos = line + keylen;
+        long i = 0;
+        for (; i < n; i++) {
+            char *end = NULL;
+            rates[i] = strtod(pos, &end);
+            if (end == pos || rates[i] <= 0) {
+                break;
+            }
+            pos = end;
+        }
+        if (i == n) {
+            found = 0;
+        }
+    }
+
+    fclose(f);
+    return found;
+}
+
+int calib_save(const char *path, const char *isa, const int *cpus, long n,
+               const double *rates) {
+    FILE *f = fopen(path, "a");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+
+    char key[CALIB_MAX_LINE];
+    format_key(key, sizeof(key), isa, cpus, n);
+    fputs(key, f);
+    for (long i = 0; i < n; i++) {
+        fprintf(f, " %.6e", rates[i]);
+    }
+    fputc('\n', f);
+
+    if (fclose(f) != 0) {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,21 @@
+#ifndef CALIB_H
+#define CALIB_H
+#include "pool.h"
+
+#define CALIB_SECONDS 0.2
+#define CALIB_MAX_LINE 4096
+
+/* Runs the selected trapezoid kernel on every worker at once for seconds
+ * and stores each worker's evaluations per second in rates. Measuring
+ * them together catches SMT siblings sharing a core and clocks that drop
+ * under load, not just the core type. */
+void calib_measure(Pool *pool, double seconds, double *rates);
+
+/* A profile file holds one line per configuration:
+ *     <isa> <cpu>,<cpu>,... <rate> <rate> ...
+ * keyed by the kernel and the CPU every worker is pinned to. */
+int calib_load(const char *path, const char *isa, const int *cpus, long n, double *rates);
+int calib_save(const char *path, const char *isa, const int *cpus, long n,
+               const double *rates);
+
+#endif /* ifndef CALIB_H */
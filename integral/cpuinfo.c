@@ -1,53 +1,470 @@
+#define _GNU_SOURCE
 #include "cpuinfo.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <sched.h>
 
-#define MAX_CORES 128
+#define CPU_DIR "/sys/devices/system/cpu"
+#define NODE_DIR "/sys/devices/system/node"
+#define CGROUP_DIR "/sys/fs/cgroup"
+#define PATH_SIZE 512
+#define CACHE_LEVELS 4
+
+/* Topology comes straight from sysfs: no shell pipelines, no limit on the
+ * number of CPUs, and only the CPUs the process may run on. */
 
 typedef struct PhysicalCore {
-    int logical_cores[MAX_CORES];
+    int *logical_cores;
     size_t logical_count;
     size_t cur_logical;
+    size_t cache_size[CACHE_LEVELS];    /* data or unified, by level */
+    int llc;
 } PhysicalCore;
 
-static PhysicalCore cores[MAX_CORES] = {0};
-static size_t logical_cores = 0;
+static PhysicalCore *cores = NULL;
 static size_t physical_cores = 0;
+static size_t logical_cores = 0;
+static size_t usable_cpus = 0;
+static double quota = 0;
+static int *cpu_node = NULL;
+static int *cpu_core = NULL;
+static int cpu_limit = 0;
+static size_t nodes = 1;
+static size_t next_core = 0;
+static size_t llcs = 0;
+static int parsed = 0;
+static int caches_parsed = 0;
 
-void cpuinfo_parse(void) {
-    FILE *f = popen("cat /proc/cpuinfo | egrep 'core id|physical id' | tr -d '\\n' | sed s/physical/\\\\nphysical/g | grep -v ^$ | sort | uniq | wc -l", "r");
-    if (!f) {
-        perror("popen");
+static int compare_ints(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+static void *xcalloc(size_t count, size_t size) {
+    void *ptr = calloc(count, size);
+    if (!ptr) {
+        perror("calloc");
         exit(EXIT_FAILURE);
     }
+    return ptr;
+}
 
-    if (fscanf(f, "%lu", &physical_cores) != 1) {
-        fprintf(stderr, "fscanf error\n");
-        exit(EXIT_FAILURE);
+/* The allowed CPU set, grown until the kernel's mask fits. */
+static cpu_set_t *allowed_cpus(int *setsize) {
+    for (int count = CPU_SETSIZE;; count *= 2) {
+        cpu_set_t *set = CPU_ALLOC(count);
+        if (!set) {
+            perror("CPU_ALLOC");
+            exit(EXIT_FAILURE);
+        }
+        size_t size = CPU_ALLOC_SIZE(count);
+        if (sched_getaffinity(0, size, set) == 0) {
+            *setsize = count;
+            return set;
+        }
+        CPU_FREE(set);
+        if (count > (1 << 20)) {
+            perror("sched_getaffinity");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/* cpulist format: "0-3,8,10-11"; calls visit for every CPU below limit. */
+static void parse_cpulist(FILE *f, int limit, void (*visit)(int cpu, void *arg),
+                          void *arg) {
+    int first = 0;
+    int last = 0;
+    char sep = 0;
+    while (fscanf(f, "%d", &first) == 1) {
+        last = first;
+        if (fscanf(f, "%c", &sep) == 1 && sep == '-') {
+            if (fscanf(f, "%d%c", &last, &sep) < 1) {
+                break;
+            }
+        }
+        for (int cpu = first; cpu <= last && cpu < limit; cpu++) {
+            if (cpu >= 0) {
+                visit(cpu, arg);
+            }
+        }
+        if (sep != ',') {
+            break;
+        }
     }
+}
+
+static void set_node(int cpu, void *arg) {
+    cpu_node[cpu] = *(int *)arg;
+}
+
+static void parse_nodes(void) {
+    DIR *dir = opendir(NODE_DIR);
+    if (!dir) {
+        return;
+    }
+
+    int *ids = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    struct dirent *entry = NULL;
+    while ((entry = readdir(dir)) != NULL) {
+        int id = 0;
+        char rest = 0;
+        if (sscanf(entry->d_name, "node%d%c", &id, &rest) != 1) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity ? 2 * capacity : 8;
+            ids = (int *)realloc(ids, sizeof(int) * capacity);
+            if (!ids) {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        ids[count++] = id;
+    }
+    closedir(dir);
+
+    if (count == 0) {
+        free(ids);
+        return;
+    }
+    qsort(ids, count, sizeof(int), compare_ints);
+
+    for (size_t i = 0; i < count; i++) {
+        char path[PATH_SIZE];
+        snprintf(path, sizeof(path), NODE_DIR "/node%d/cpulist", ids[i]);
+        FILE *f = fopen(path, "r");
+        if (!f) {
+            continue;
+        }
+        int node = i;
+        parse_cpulist(f, cpu_limit, set_node, &node);
+        fclose(f);
+    }
+    nodes = count;
+    free(ids);
+}
+
+typedef struct Siblings {
+    const cpu_set_t *allowed;
+    int setsize;
+    int first;      /* lowest allowed sibling, -1 if none */
+} Siblings;
+
+static void find_first(int cpu, void *arg) {
+    Siblings *s = (Siblings *)arg;
+    if (s->first < 0 && CPU_ISSET_S(cpu, CPU_ALLOC_SIZE(s->setsize), s->allowed)) {
+        s->first = cpu;
+    }
+}
+
+/* The lowest allowed CPU of cpu's physical core stands for the core. */
+static int core_leader(int cpu, const cpu_set_t *allowed, int setsize) {
+    char path[PATH_SIZE];
+    snprintf(path, sizeof(path), CPU_DIR "/cpu%d/topology/thread_siblings_list", cpu);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return cpu;
+    }
+    Siblings s = {allowed, setsize, -1};
+    parse_cpulist(f, cpu_limit, find_first, &s);
     fclose(f);
+    return (s.first < 0) ? cpu : s.first;
+}
+
+static void parse_cores(const cpu_set_t *allowed, int setsize) {
+    size_t size = CPU_ALLOC_SIZE(setsize);
+    int *leader = (int *)xcalloc(cpu_limit, sizeof(int));
+
+    for (int cpu = 0; cpu < cpu_limit; cpu++) {
+        cpu_core[cpu] = -1;
+        if (!CPU_ISSET_S(cpu, size, allowed)) {
+            continue;
+        }
+        logical_cores++;
+        leader[cpu] = core_leader(cpu, allowed, setsize);
+        if (leader[cpu] == cpu) {
+            cpu_core[cpu] = physical_cores++;
+        }
+    }
+
+    cores = (PhysicalCore *)xcalloc(physical_cores ? physical_cores : 1,
+                                    sizeof(PhysicalCore));
+    for (int cpu = 0; cpu < cpu_limit; cpu++) {
+        if (CPU_ISSET_S(cpu, size, allowed)) {
+            cpu_core[cpu] = cpu_core[leader[cpu]];
+            cores[cpu_core[cpu]].logical_count++;
+        }
+    }
+    for (size_t core = 0; core < physical_cores; core++) {
+        cores[core].logical_cores = (int *)xcalloc(cores[core].logical_count, sizeof(int));
+        cores[core].logical_count = 0;
+    }
+    for (int cpu = 0; cpu < cpu_limit; cpu++) {
+        if (CPU_ISSET_S(cpu, size, allowed)) {
+            PhysicalCore *core = &cores[cpu_core[cpu]];
+            core->logical_cores[core->logical_count++] = cpu;
+        }
+    }
+
+    free(leader);
+}
+
+/* CPU bandwidth limit of a cgroup directory, 0 if there is none: cgroup v2
+ * cpu.max ("max 100000" or "50000 100000") or v1 cpu.cfs_quota_us. */
+static double read_quota(const char *dir, int v2) {
+    char path[PATH_SIZE + 32];
+    long limit = -1;
+    long period = 0;
+
+    if (v2) {
+        snprintf(path, sizeof(path), "%s/cpu.max", dir);
+        FILE *f = fopen(path, "r");
+        if (!f) {
+            return 0;
+        }
+        if (fscanf(f, "%ld %ld", &limit, &period) != 2) {
+            limit = -1;
+        }
+        fclose(f);
+    }
+    else {
+        snprintf(path, sizeof(path), "%s/cpu.cfs_quota_us", dir);
+        FILE *f = fopen(path, "r");
+        if (!f) {
+            return 0;
+        }
+        if (fscanf(f, "%ld", &limit) != 1) {
+            limit = -1;
+        }
+        fclose(f);
+
+        snprintf(path, sizeof(path), "%s/cpu.cfs_period_us", dir);
+        f = fopen(path, "r");
+        if (!f) {
+            return 0;
+        }
+        if (fscanf(f, "%ld", &period) != 1) {
+            period = 0;
+        }
+        fclose(f);
+    }
+
+    return (limit > 0 && period > 0) ? (double)limit / period : 0;
+}
+
+/* The tightest limit on the process's cgroup and its ancestors. */
+static double tightest_quota(const char *root, const char *group, int v2) {
+    char dir[PATH_SIZE];
+    char rel[PATH_SIZE];
+    double tightest = 0;
+
+    snprintf(rel, sizeof(rel), "%s", group);
+    for (;;) {
+        snprintf(dir, sizeof(dir), "%s%s", root, rel);
+        double q = read_quota(dir, v2);
+        if (q > 0 && (tightest == 0 || q < tightest)) {
+            tightest = q;
+        }
+        char *slash = strrchr(rel, '/');
+        if (!slash || rel[0] == '\0') {
+            break;
+        }
+        *slash = '\0';
+    }
+    return tightest;
+}
 
-    f = popen("grep -c processor /proc/cpuinfo", "r");
+static void parse_quota(void) {
+    FILE *f = fopen("/proc/self/cgroup", "r");
     if (!f) {
-        perror("popen");
-        exit(EXIT_FAILURE);
+        return;
     }
 
-    if (fscanf(f, "%lu", &logical_cores) != 1) {
-        fprintf(stderr, "fscanf error\n");
-        exit(EXIT_FAILURE);
+    char line[PATH_SIZE];
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\n")] = '\0';
+        char *controllers = strchr(line, ':');
+        char *group = controllers ? strchr(controllers + 1, ':') : NULL;
+        if (!group) {
+            continue;
+        }
+        *group++ = '\0';
+        controllers++;
+        if (strcmp(group, "/") == 0) {
+            group = "";
+        }
+
+        double q = 0;
+        if (controllers[0] == '\0') {
+            q = tightest_quota(CGROUP_DIR, group, 1);
+            if (q == 0) {
+                q = tightest_quota(CGROUP_DIR "/unified", group, 1);
+            }
+        }
+        else if (strcmp(controllers, "cpu") == 0 || strstr(controllers, "cpu,") == controllers) {
+            q = tightest_quota(CGROUP_DIR "/cpu", group, 0);
+            if (q == 0) {
+                q = tightest_quota(CGROUP_DIR "/cpu,cpuacct", group, 0);
+            }
+        }
+        if (q > 0 && (quota == 0 || q < quota)) {
+            quota = q;
+        }
     }
     fclose(f);
+}
+
+typedef struct CacheGroup {
+    int first;      /* lowest allowed CPU sharing the cache, -1 if none */
+} CacheGroup;
 
-    f = popen("lscpu -p=cpu,core | grep -v ^#", "r");
-    int cpu = 0;
-    int coreid = 0;
-    while (fscanf(f, "%d,%d", &cpu, &coreid) == 2) {
-        cores[coreid].logical_cores[cores[coreid].logical_count] = cpu;
-        cores[coreid].logical_count++;
+static void find_first_allowed(int cpu, void *arg) {
+    CacheGroup *g = (CacheGroup *)arg;
+    if (g->first < 0 && cpu_core[cpu] >= 0) {
+        g->first = cpu;
     }
 }
 
+/* "48K", "2048K", "32M" */
+static size_t parse_size(FILE *f) {
+    size_t size = 0;
+    char unit = 0;
+    if (fscanf(f, "%zu%c", &size, &unit) < 1) {
+        return 0;
+    }
+    if (unit == 'K') {
+        size <<= 10;
+    }
+    else if (unit == 'M') {
+        size <<= 20;
+    }
+    return size;
+}
+
+/* Reads cpu's caches into core; returns the lowest allowed CPU sharing its
+ * last-level cache. */
+static int parse_core_caches(int cpu, PhysicalCore *core) {
+    int llc_level = 0;
+    int llc_first = cpu;
+
+    for (int index = 0;; index++) {
+        char path[PATH_SIZE];
+        char type[32] = {0};
+        int level = 0;
+
+        snprintf(path, sizeof(path), CPU_DIR "/cpu%d/cache/index%d/type", cpu, index);
+        FILE *f = fopen(path, "r");
+        if (!f) {
+            break;
+        }
+        int ok = fscanf(f, "%31s", type) == 1;
+        fclose(f);
+        if (!ok || strcmp(type, "Instruction") == 0) {
+            continue;
+        }
+
+        snprintf(path, sizeof(path), CPU_DIR "/cpu%d/cache/index%d/level", cpu, index);
+        f = fopen(path, "r");
+        if (!f) {
+            continue;
+        }
+        ok = fscanf(f, "%d", &level) == 1;
+        fclose(f);
+        if (!ok || level < 1 || level >= CACHE_LEVELS) {
+            continue;
+        }
+
+        snprintf(path, sizeof(path), CPU_DIR "/cpu%d/cache/index%d/size", cpu, index);
+        f = fopen(path, "r");
+        if (f) {
+            core->cache_size[level] = parse_size(f);
+            fclose(f);
+        }
+
+        if (level > llc_level) {
+            snprintf(path, sizeof(path),
+                     CPU_DIR "/cpu%d/cache/index%d/shared_cpu_list", cpu, index);
+            f = fopen(path, "r");
+            if (f) {
+                CacheGroup g = {-1};
+                parse_cpulist(f, cpu_limit, find_first_allowed, &g);
+                fclose(f);
+                llc_level = level;
+                llc_first = (g.first < 0) ? cpu : g.first;
+            }
+        }
+    }
+
+    return llc_first;
+}
+
+/* Cache topology is only read when asked for, one CPU per physical core. */
+static void parse_caches(void) {
+    if (caches_parsed) {
+        return;
+    }
+    caches_parsed = 1;
+    cpuinfo_parse();
+
+    int *llc_of = (int *)xcalloc(cpu_limit ? cpu_limit : 1, sizeof(int));
+    for (int cpu = 0; cpu < cpu_limit; cpu++) {
+        llc_of[cpu] = -1;
+    }
+
+    for (size_t i = 0; i < physical_cores; i++) {
+        PhysicalCore *core = &cores[i];
+        int first = parse_core_caches(core->logical_cores[0], core);
+        if (llc_of[first] < 0) {
+            llc_of[first] = llcs++;
+        }
+        core->llc = llc_of[first];
+    }
+    free(llc_of);
+}
+
+void cpuinfo_parse(void) {
+    if (parsed) {
+        return;
+    }
+    parsed = 1;
+
+    int setsize = 0;
+    cpu_set_t *allowed = allowed_cpus(&setsize);
+    cpu_limit = setsize;
+    cpu_node = (int *)xcalloc(cpu_limit, sizeof(int));
+    cpu_core = (int *)xcalloc(cpu_limit, sizeof(int));
+
+    parse_cores(allowed, setsize);
+    parse_nodes();
+    parse_quota();
+    CPU_FREE(allowed);
+
+    usable_cpus = logical_cores;
+    if (quota > 0) {
+        size_t granted = (size_t)quota + (quota > (size_t)quota);
+        if (granted < usable_cpus) {
+            usable_cpus = granted;
+        }
+    }
+}
+
+int cpuinfo_getnextcpu(int *coreid) {
+    if (physical_cores == 0) {
+        return -1;
+    }
+
+    PhysicalCore *core = &cores[next_core];
+    int cpu = core->logical_cores[core->cur_logical];
+    *coreid = next_core;
+    core->cur_logical = (core->cur_logical + 1) % core->logical_count;
+    next_core = (next_core + 1) % physical_cores;
+    return cpu;
+}
+
 size_t cpuinfo_getphysicalcores(void) {
     return physical_cores;
 }
@@ -59,3 +476,61 @@ size_t cpuinfo_getlogicalcores(int coreid) {
 size_t cpuinfo_getlogicalcoreid(int coreid, int n) {
     return cores[coreid].logical_cores[n];
 }
+
+size_t cpuinfo_getcpus(void) {
+    return logical_cores;
+}
+
+size_t cpuinfo_getusablecpus(void) {
+    return usable_cpus;
+}
+
+double cpuinfo_getquota(void) {
+    return quota;
+}
+
+size_t cpuinfo_getnodes(void) {
+    return nodes;
+}
+
+int cpuinfo_getnode(int cpu) {
+    if (cpu < 0 || cpu >= cpu_limit || !cpu_node) {
+        return 0;
+    }
+    return cpu_node[cpu];
+}
+
+int cpuinfo_getcore(int cpu) {
+    if (cpu < 0 || cpu >= cpu_limit || !cpu_core) {
+        return -1;
+    }
+    return cpu_core[cpu];
+}
+
+/* Unpinned workers (cpu -1) get the first allowed CPU's caches. */
+static PhysicalCore *core_of(int cpu) {
+    parse_caches();
+    if (physical_cores == 0) {
+        return NULL;
+    }
+    int core = cpuinfo_getcore(cpu);
+    return &cores[(core < 0) ? 0 : core];
+}
+
+size_t cpuinfo_getcachesize(int cpu, int level) {
+    PhysicalCore *core = core_of(cpu);
+    if (!core || level < 1 || level >= CACHE_LEVELS) {
+        return 0;
+    }
+    return core->cache_size[level];
+}
+
+size_t cpuinfo_getllcs(void) {
+    parse_caches();
+    return llcs ? llcs : 1;
+}
+
+int cpuinfo_getllc(int cpu) {
+    PhysicalCore *core = core_of(cpu);
+    return core ? core->llc : 0;
+}
@@ -2,10 +2,38 @@
 #define CPUINFO_H
 #include <stdlib.h>
 
+/* CPU topology from /sys/devices/system/cpu, restricted to the CPUs in the
+ * process's affinity mask (which includes cpuset cgroups). Physical cores
+ * are numbered 0 .. count - 1 by their lowest allowed logical CPU. */
 void cpuinfo_parse(void);
+/* Hands out the allowed logical CPUs one physical core at a time, taking
+ * the next sibling of a core on each pass and wrapping around; *coreid
+ * receives the core. Returns -1 if there are no CPUs. Not thread-safe. */
 int cpuinfo_getnextcpu(int *coreid);
 size_t cpuinfo_getphysicalcores(void);
 size_t cpuinfo_getlogicalcores(int coreid);
 size_t cpuinfo_getlogicalcoreid(int coreid, int n);
+/* Physical core of an allowed logical CPU, -1 otherwise. */
+int cpuinfo_getcore(int cpu);
+/* Allowed logical CPUs. */
+size_t cpuinfo_getcpus(void);
+/* CPU bandwidth the cgroup grants (cpu.max or cfs_quota_us over the
+ * period), 0 if unlimited. */
+double cpuinfo_getquota(void);
+/* Allowed logical CPUs, capped at the quota rounded up: more busy CPUs
+ * than that only get throttled. */
+size_t cpuinfo_getusablecpus(void);
+/* NUMA nodes from sysfs, numbered 0 .. count - 1 in sysfs order; a machine
+ * without the node directory is one node. */
+size_t cpuinfo_getnodes(void);
+int cpuinfo_getnode(int cpu);
+/* Caches from the cache directories in sysfs, read on first use. Size
+ * in bytes of cpu's level 1 .. 3 data or unified cache, 0 if unknown;
+ * cpu -1 stands for any allowed CPU. */
+size_t cpuinfo_getcachesize(int cpu, int level);
+/* Last-level caches, numbered 0 .. count - 1 by their lowest allowed CPU,
+ * and the one cpu shares. */
+size_t cpuinfo_getllcs(void);
+int cpuinfo_getllc(int cpu);
 
 #endif /* ifndef CPUINFO_H */
@@ -0,0 +1,927 @@
+#include "expr.h"
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "kernel.h"
+#include "vmath.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define EXPR_X86
+#endif
+
+#define EXPR_MAX_NODES 256
+#define EXPR_MAX_DEPTH 256
+#define EXPR_MAX_POWI 64
+#define REG_X 0
+#define REG_P 1
+#define DEP_X 1
+#define DEP_P 2
+
+typedef enum Op {
+    OP_CONST,   /* dst = imm */
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_ADDI,    /* dst = a + imm */
+    OP_SUBI,    /* dst = a - imm */
+    OP_RSUBI,   /* dst = imm - a */
+    OP_MULI,    /* dst = a * imm */
+    OP_DIVI,    /* dst = a / imm */
+    OP_RDIVI,   /* dst = imm / a */
+    OP_POWI,    /* dst = a ^ imm, imm integral */
+    OP_LOAD,    /* dst = coordinate imm of the point */
+    OP_NEG,
+    OP_ABS,
+    OP_SQRT,
+    OP_EXP,
+    OP_LOG,
+    OP_SIN,
+    OP_COS,
+    OP_ATAN,
+    OP_POW
+} Op;
+
+typedef struct Insn {
+    unsigned char op;
+    unsigned char dst;
+    unsigned char a;
+    unsigned char b;
+    double imm;
+} Insn;
+
+typedef struct Pass {
+    Insn code[EXPR_MAX_CODE];
+    int len;
+} Pass;
+
+/* For sweeps the program is also split by what each subexpression depends
+ * on: parts without x run once per parameter block, parts without p run
+ * across a block of grid points in a register file of their own, and only
+ * the rest runs per grid point across the parameters, reading the x-only
+ * results broadcast into the registers listed in inputs. */
+struct IntegralExpr {
+    Pass all;
+    int result;
+    int dims;
+    int uses_p;
+    double param;
+
+    Pass pre;
+    Pass xs;
+    Pass main;
+    unsigned char inputs[EXPR_MAX_REGS][2];     /* main register, xs register */
+    int input_count;
+    int sweep_result;
+
+    char *source;       /* for expr_shift() */
+};
+
+typedef enum NodeKind {
+    NODE_CONST,
+    NODE_X,
+    NODE_P,
+    NODE_VAR,   /* x2, x3, ...: value is the coordinate index */
+    NODE_UNARY,
+    NODE_BINARY
+} NodeKind;
+
+typedef struct Node {
+    NodeKind kind;
+    Op op;
+    double value;
+    int lhs;
+    int rhs;
+    int deps;
+    int offset;     /* shifted x: rhs is the constant added to lhs, the NODE_X */
+} Node;
+
+typedef struct Parser {
+    const char *src;
+    const char *pos;
+    Node nodes[EXPR_MAX_NODES];
+    int count;
+    Pass *pass;         /* where emit() appends */
+    unsigned *used;     /* registers live in that pass's register file */
+    unsigned *pinned;   /* and those reg_free() must keep */
+    unsigned regs_used;
+    unsigned regs_pinned;
+    unsigned xregs_used;
+    unsigned xregs_pinned;
+    unsigned main_written;
+    Expr *e;
+    char *err;
+    size_t errlen;
+    int failed;
+    int depth;          /* of parse_unary(), which every nesting goes through */
+    int shifted;        /* x reads u and stands for u + shift */
+    double shift;
+} Parser;
+
+static const struct {
+    const char *name;
+    Op op;
+} functions[] = {
+    {"abs", OP_ABS},
+    {"sqrt", OP_SQRT},
+    {"exp", OP_EXP},
+    {"log", OP_LOG},
+    {"sin", OP_SIN},
+    {"cos", OP_COS},
+    {"atan", OP_ATAN}
+};
+
+static double apply(Op op, double a, double b) {
+    switch (op) {
+    case OP_ADD: return a + b;
+    case OP_SUB: return a - b;
+    case OP_MUL: return a * b;
+    case OP_DIV: return a / b;
+    case OP_NEG: return -a;
+    case OP_ABS: return fabs(a);
+    case OP_SQRT: return sqrt(a);
+    case OP_EXP: return exp(a);
+    case OP_LOG: return log(a);
+    case OP_SIN: return sin(a);
+    case OP_COS: return cos(a);
+    case OP_ATAN: return atan(a);
+    case OP_POW: return pow(a, b);
+    default: return NAN;
+    }
+}
+
+/* ---------------------------------------------------------------- parser */
+
+static void fail(Parser *p, const char *msg) {
+    if (!p->failed && p->err) {
+        snprintf(p->err, p->errlen, "%s at offset %ld", msg, (long)(p->pos - p->src));
+    }
+    p->failed = 1;
+}
+
+static int node(Parser *p, NodeKind kind, Op op, double value, int lhs, int rhs) {
+    if (p->count == EXPR_MAX_NODES) {
+        fail(p, "expression too long");
+        return 0;
+    }
+    Node *n = &p->nodes[p->count];
+    n->kind = kind;
+    n->op = op;
+    n->value = value;
+    n->lhs = lhs;
+    n->rhs = rhs;
+    n->offset = 0;
+    n->deps = (kind == NODE_X || kind == NODE_VAR) ? DEP_X : (kind == NODE_P) ? DEP_P : 0;
+    if (lhs >= 0) {
+        n->deps |= p->nodes[lhs].deps;
+    }
+    if (rhs >= 0) {
+        n->deps |= p->nodes[rhs].deps;
+    }
+    return p->count++;
+}
+
+static int constant(Parser *p, double value) {
+    return node(p, NODE_CONST, OP_CONST, value, -1, -1);
+}
+
+static int unary(Parser *p, Op op, int a) {
+    if (p->failed) {
+        return 0;
+    }
+    if (p->nodes[a].kind == NODE_CONST) {
+        return constant(p, apply(op, p->nodes[a].value, 0));
+    }
+    return node(p, NODE_UNARY, op, 0, a, -1);
+}
+
+/* u + c in shifted mode, u itself when c is 0 */
+static int offset_x(Parser *p, double c) {
+    int x = node(p, NODE_X, OP_CONST, 0, -1, -1);
+    if (c == 0 || p->failed) {
+        return x;
+    }
+    int n = node(p, NODE_BINARY, OP_ADD, 0, x, constant(p, c));
+    p->nodes[n].offset = !p->failed;
+    return n;
+}
+
+/* Whether a is u + *c in shifted mode. */
+static int is_offset(const Parser *p, int a, double *c) {
+    const Node *n = &p->nodes[a];
+    if (!p->shifted || (n->kind != NODE_X && !n->offset)) {
+        return 0;
+    }
+    *c = (n->kind == NODE_X) ? 0 : p->nodes[n->rhs].value;
+    return 1;
+}
+
+static int binary(Parser *p, Op op, int a, int b) {
+    if (p->failed) {
+        return 0;
+    }
+    /* in shifted mode x + c, x - c and c - x fold the constants into the
+     * shift first, so that x + 4 at shift -4 is u exactly instead of the
+     * rounded x plus 4 */
+    double s = 0;
+    int lconst = p->nodes[a].kind == NODE_CONST;
+    int rconst = p->nodes[b].kind == NODE_CONST;
+    if (op == OP_ADD && rconst && is_offset(p, a, &s)) {
+        return offset_x(p, s + p->nodes[b].value);
+    }
+    if (op == OP_ADD && lconst && is_offset(p, b, &s)) {
+        return offset_x(p, p->nodes[a].value + s);
+    }
+    if (op == OP_SUB && rconst && is_offset(p, a, &s)) {
+        return offset_x(p, s - p->nodes[b].value);
+    }
+    if (op == OP_SUB && lconst && is_offset(p, b, &s)) {
+        double c = p->nodes[a].value - s;
+        int x = node(p, NODE_X, OP_CONST, 0, -1, -1);
+        return (c == 0) ? unary(p, OP_NEG, x) : node(p, NODE_BINARY, OP_SUB, 0, constant(p, c), x);
+    }
+    if (p->nodes[a].kind == NODE_CONST && p->nodes[b].kind == NODE_CONST) {
+        return constant(p, apply(op, p->nodes[a].value, p->nodes[b].value));
+    }
+    return node(p, NODE_BINARY, op, 0, a, b);
+}
+
+static void skip_spaces(Parser *p) {
+    while (isspace((unsigned char)*p->pos)) {
+        p->pos++;
+    }
+}
+
+static int accept(Parser *p, char c) {
+    skip_spaces(p);
+    if (*p->pos == c) {
+        p->pos++;
+        return 1;
+    }
+    return 0;
+}
+
+static int parse_sum(Parser *p);
+static int parse_unary(Parser *p);
+
+static int parse_primary(Parser *p) {
+    skip_spaces(p);
+    if (p->failed) {
+        return 0;
+    }
+
+    if (accept(p, '(')) {
+        int n = parse_sum(p);
+        if (!accept(p, ')')) {
+            fail(p, "expected ')'");
+        }
+        return n;
+    }
+
+    if (isdigit((unsigned char)*p->pos) || *p->pos == '.') {
+        char *end = NULL;
+        double value = strtod(p->pos, &end);
+        p->pos = end;
+        return constant(p, value);
+    }
+
+    if (isalpha((unsigned char)*p->pos)) {
+        const char *start = p->pos;
+        while (isalnum((unsigned char)*p->pos) || *p->pos == '_') {
+            p->pos++;
+        }
+        size_t len = p->pos - start;
+
+        if (len == 1 && *start == 'x') {
+            return p->shifted ? offset_x(p, p->shift) : node(p, NODE_X, OP_CONST, 0, -1, -1);
+        }
+        if (*start == 'x' && strspn(start + 1, "0123456789") == len - 1) {
+            int index = atoi(start + 1);
+            if (index < 1 || index > EXPR_MAX_DIMS) {
+                p->pos = start;
+                fail(p, "no such coordinate");
+                return 0;
+            }
+            if (index > p->e->dims) {
+                p->e->dims = index;
+            }
+            if (index == 1) {
+                return p->shifted ? offset_x(p, p->shift) :
+                                    node(p, NODE_X, OP_CONST, 0, -1, -1);
+            }
+            return node(p, NODE_VAR, OP_LOAD, index - 1, -1, -1);
+        }
+        if (len == 1 && *start == 'p') {
+            return node(p, NODE_P, OP_CONST, 0, -1, -1);
+        }
+        if (len == 2 && strncmp(start, "pi", 2) == 0) {
+            return constant(p, M_PI);
+        }
+        if (len == 1 && *start == 'e') {
+            return constant(p, M_E);
+        }
+        if (len == 3 && strncmp(start, "pow", 3) == 0) {
+            if (!accept(p, '(')) {
+                fail(p, "expected '('");
+                return 0;
+            }
+            int a = parse_sum(p);
+            if (!accept(p, ',')) {
+                fail(p, "expected ','");
+                return 0;
+            }
+            int b = parse_sum(p);
+            if (!accept(p, ')')) {
+                fail(p, "expected ')'");
+            }
+            return binary(p, OP_POW, a, b);
+        }
+        for (size_t i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
+            if (strlen(functions[i].name) == len &&
+                strncmp(start, functions[i].name, len) == 0) {
+                if (!accept(p, '(')) {
+                    fail(p, "expected '('");
+                    return 0;
+                }
+                int a = parse_sum(p);
+                if (!accept(p, ')')) {
+                    fail(p, "expected ')'");
+                }
+                return unary(p, functions[i].op, a);
+            }
+        }
+
+        p->pos = start;
+        fail(p, "unknown identifier");
+        return 0;
+    }
+
+    fail(p, "unexpected character");
+    return 0;
+}
+
+static int parse_power(Parser *p) {
+    int base = parse_primary(p);
+    if (accept(p, '^')) {
+        /* right associative, and binds tighter than unary minus on the left */
+        return binary(p, OP_POW, base, parse_unary(p));
+    }
+    return base;
+}
+
+static int parse_unary(Parser *p) {
+    if (p->failed) {
+        return 0;
+    }
+    if (p->depth == EXPR_MAX_DEPTH) {
+        fail(p, "expression too deeply nested");
+        return 0;
+    }
+
+    int n;
+    p->depth++;
+    if (accept(p, '-')) {
+        n = unary(p, OP_NEG, parse_unary(p));
+    }
+    else if (accept(p, '+')) {
+        n = parse_unary(p);
+    }
+    else {
+        n = parse_power(p);
+    }
+    p->depth--;
+    return n;
+}
+
+static int parse_product(Parser *p) {
+    int n = parse_unary(p);
+    while (!p->failed) {
+        if (accept(p, '*')) {
+            n = binary(p, OP_MUL, n, parse_unary(p));
+        }
+        else if (accept(p, '/')) {
+            n = binary(p, OP_DIV, n, parse_unary(p));
+        }
+        else {
+            return n;
+        }
+    }
+    return 0;
+}
+
+static int parse_sum(Parser *p) {
+    int n = parse_product(p);
+    while (!p->failed) {
+        if (accept(p, '+')) {
+            n = binary(p, OP_ADD, n, parse_product(p));
+        }
+        else if (accept(p, '-')) {
+            n = binary(p, OP_SUB, n, parse_product(p));
+        }
+        else {
+            return n;
+        }
+    }
+    return 0;
+}
+
+/* --------------------------------------------------------------- codegen */
+
+static int reg_alloc(Parser *p) {
+    for (int r = REG_P + 1; r < EXPR_MAX_REGS; r++) {
+        if (!(*p->used & (1u << r))) {
+            *p->used |= 1u << r;
+            return r;
+        }
+    }
+    fail(p, "expression needs too many registers");
+    return REG_P + 1;
+}
+
+static void reg_free(Parser *p, int r) {
+    if (r != REG_X && r != REG_P && !(*p->pinned & (1u << r))) {
+        *p->used &= ~(1u << r);
+    }
+}
+
+static int emit(Parser *p, Op op, int a, int b, double imm) {
+    Pass *pass = p->pass;
+    if (pass->len == EXPR_MAX_CODE) {
+        fail(p, "expression too long");
+        return REG_P + 1;
+    }
+
+    /* the destination is taken before the operands are released, so it never
+     * aliases them; the block loops rely on that */
+    int dst = reg_alloc(p);
+    pass->code[pass->len++] = (Insn){op, dst, a, b, imm};
+    if (pass == &p->e->main) {
+        p->main_written |= 1u << dst;
+    }
+    reg_free(p, a);
+    reg_free(p, b);
+    return dst;
+}
+
+static int is_integral(double v) {
+    return v == floor(v) && fabs(v) <= EXPR_MAX_POWI;
+}
+
+static int gen(Parser *p, int id);
+
+/* Generates node id into pass with its result register pinned there. The
+ * registers in avoid are not touched: the hoisted code runs before main
+ * code that is already generated. */
+static int gen_hoisted(Parser *p, int id, Pass *pass, unsigned *used, unsigned *pinned,
+                       unsigned avoid) {
+    Pass *saved_pass = p->pass;
+    unsigned *saved_used = p->used;
+    unsigned *saved_pinned = p->pinned;
+    unsigned mask = *used | avoid;
+    p->pass = pass;
+    p->used = &mask;
+    p->pinned = pinned;
+
+    int r = gen(p, id);
+    *used |= 1u << r;
+    *pinned |= 1u << r;
+
+    p->pass = saved_pass;
+    p->used = saved_used;
+    p->pinned = saved_pinned;
+    return r;
+}
+
+static int gen(Parser *p, int id) {
+    const Node *n = &p->nodes[id];
+    if (p->failed) {
+        return REG_X;
+    }
+
+    if (p->pass == &p->e->main && n->kind != NODE_X && n->kind != NODE_P) {
+        /* the pre pass shares the main register file and runs before it */
+        if (!(n->deps & DEP_X)) {
+            return gen_hoisted(p, id, &p->e->pre, &p->regs_used, &p->regs_pinned,
+                               p->main_written);
+        }
+        if (!(n->deps & DEP_P)) {
+            int xr = gen_hoisted(p, id, &p->e->xs, &p->xregs_used, &p->xregs_pinned, 0);
+            /* broadcast before the main pass, like the pre results */
+            unsigned used = p->regs_used;
+            p->regs_used |= p->main_written;
+            int r = reg_alloc(p);
+            p->regs_used = used | (1u << r);
+            p->regs_pinned |= 1u << r;
+            p->e->inputs[p->e->input_count][0] = r;
+            p->e->inputs[p->e->input_count][1] = xr;
+            p->e->input_count++;
+            return r;
+        }
+    }
+
+    switch (n->kind) {
+    case NODE_X:
+        return REG_X;
+    case NODE_P:
+        p->e->uses_p = 1;
+        return REG_P;
+    case NODE_CONST:
+        return emit(p, OP_CONST, REG_X, REG_X, n->value);
+    case NODE_VAR:
+        return emit(p, OP_LOAD, REG_X, REG_X, n->value);
+    case NODE_UNARY:
+        return emit(p, n->op, gen(p, n->lhs), REG_X, 0);
+    default:
+        break;
+    }
+
+    const Node *l = &p->nodes[n->lhs];
+    const Node *r = &p->nodes[n->rhs];
+    if (r->kind == NODE_CONST) {
+        switch (n->op) {
+        case OP_ADD: return emit(p, OP_ADDI, gen(p, n->lhs), REG_X, r->value);
+        case OP_SUB: return emit(p, OP_SUBI, gen(p, n->lhs), REG_X, r->value);
+        case OP_MUL: return emit(p, OP_MULI, gen(p, n->lhs), REG_X, r->value);
+        case OP_DIV: return emit(p, OP_DIVI, gen(p, n->lhs), REG_X, r->value);
+        case OP_POW:
+            if (is_integral(r->value)) {
+                return emit(p, OP_POWI, gen(p, n->lhs), REG_X, r->value);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    if (l->kind == NODE_CONST) {
+        switch (n->op) {
+        case OP_ADD: return emit(p, OP_ADDI, gen(p, n->rhs), REG_X, l->value);
+        case OP_SUB: return emit(p, OP_RSUBI, gen(p, n->rhs), REG_X, l->value);
+        case OP_MUL: return emit(p, OP_MULI, gen(p, n->rhs), REG_X, l->value);
+        case OP_DIV: return emit(p, OP_RDIVI, gen(p, n->rhs), REG_X, l->value);
+        default:
+            break;
+        }
+    }
+
+    int a = gen(p, n->lhs);
+    int b = gen(p, n->rhs);
+    return emit(p, n->op, a, b, 0);
+}
+
+static Expr *compile(const char *src, int shifted, double shift, char *err, size_t errlen) {
+    Parser *p = (Parser *)calloc(1, sizeof(Parser));
+    Expr *e = (Expr *)calloc(1, sizeof(Expr));
+    char *source = strdup(src);
+    if (!p || !e || !source) {
+        if (err) {
+            snprintf(err, errlen, "out of memory");
+        }
+        free(p);
+        free(e);
+        free(source);
+        return NULL;
+    }
+
+    e->source = source;
+    p->shifted = shifted;
+    p->shift = shift;
+    p->src = src;
+    p->pos = src;
+    p->e = e;
+    e->dims = 1;
+    p->err = err;
+    p->errlen = errlen;
+    p->pass = &e->all;
+    p->used = &p->regs_used;
+    p->pinned = &p->regs_pinned;
+
+    int root = parse_sum(p);
+    skip_spaces(p);
+    if (*p->pos != '\0') {
+        fail(p, "unexpected trailing input");
+    }
+    if (!p->failed) {
+        e->result = gen(p, root);
+    }
+
+    if (!p->failed) {
+        /* pinned results can run out of registers; the whole program per
+         * grid point is then the fallback */
+        p->pass = &e->main;
+        p->regs_used = 0;
+        p->err = NULL;
+        e->sweep_result = gen(p, root);
+        if (p->failed) {
+            p->failed = 0;
+            e->pre.len = 0;
+            e->xs.len = 0;
+            e->main = e->all;
+            e->input_count = 0;
+            e->sweep_result = e->result;
+        }
+    }
+
+    int failed = p->failed;
+    free(p);
+    if (failed) {
+        expr_free(e);
+        return NULL;
+    }
+
+    return e;
+}
+
+Expr *expr_compile(const char *src, char *err, size_t errlen) {
+    return compile(src, 0, 0, err, errlen);
+}
+
+Expr *expr_shift(const Expr *e, double shift) {
+    Expr *shifted = compile(e->source, 1, shift, NULL, 0);
+    if (shifted) {
+        shifted->param = e->param;
+    }
+    return shifted;
+}
+
+void expr_free(Expr *e) {
+    if (e) {
+        free(e->source);
+    }
+    free(e);
+}
+
+/* ------------------------------------------------------------ evaluation */
+
+#define EXPR_INLINE static inline __attribute__((always_inline))
+
+EXPR_INLINE void powi_block(double *restrict d, const double *restrict a, double imm) {
+    double base[EXPR_BLOCK];
+    double acc[EXPR_BLOCK];
+    for (int i = 0; i < EXPR_BLOCK; i++) {
+        base[i] = a[i];
+        acc[i] = 1;
+    }
+
+    for (unsigned m = (unsigned)fabs(imm); m; m >>= 1) {
+        if (m & 1) {
+            for (int i = 0; i < EXPR_BLOCK; i++) {
+                acc[i] *= base[i];
+            }
+        }
+        for (int i = 0; i < EXPR_BLOCK; i++) {
+            base[i] *= base[i];
+        }
+    }
+
+    if (imm < 0) {
+        for (int i = 0; i < EXPR_BLOCK; i++) {
+            d[i] = 1 / acc[i];
+        }
+    }
+    else {
+        for (int i = 0; i < EXPR_BLOCK; i++) {
+            d[i] = acc[i];
+        }
+    }
+}
+
+EXPR_INLINE void run_insn(const Insn *in, double *restrict d,
+                          const double *restrict a, const double *restrict b) {
+    const double imm = in->imm;
+
+#define EXPR_LOOP(stmt) \
+    for (int i = 0; i < EXPR_BLOCK; i++) { \
+        stmt; \
+    } \
+    break
+
+    switch (in->op) {
+    case OP_CONST: EXPR_LOOP(d[i] = imm);
+    case OP_ADD: EXPR_LOOP(d[i] = a[i] + b[i]);
+    case OP_SUB: EXPR_LOOP(d[i] = a[i] - b[i]);
+    case OP_MUL: EXPR_LOOP(d[i] = a[i] * b[i]);
+    case OP_DIV: EXPR_LOOP(d[i] = a[i] / b[i]);
+    case OP_ADDI: EXPR_LOOP(d[i] = a[i] + imm);
+    case OP_SUBI: EXPR_LOOP(d[i] = a[i] - imm);
+    case OP_RSUBI: EXPR_LOOP(d[i] = imm - a[i]);
+    case OP_MULI: EXPR_LOOP(d[i] = a[i] * imm);
+    case OP_DIVI: EXPR_LOOP(d[i] = a[i] / imm);
+    case OP_RDIVI: EXPR_LOOP(d[i] = imm / a[i]);
+    case OP_NEG: EXPR_LOOP(d[i] = -a[i]);
+    case OP_ABS: EXPR_LOOP(d[i] = fabs(a[i]));
+    case OP_SQRT: EXPR_LOOP(d[i] = sqrt(a[i]));
+    case OP_EXP: EXPR_LOOP(d[i] = vm_exp(a[i]));
+    case OP_LOG: EXPR_LOOP(d[i] = vm_log(a[i]));
+    case OP_SIN: EXPR_LOOP(d[i] = vm_sin(a[i]));
+    case OP_COS: EXPR_LOOP(d[i] = vm_cos(a[i]));
+    case OP_ATAN: EXPR_LOOP(d[i] = vm_atan(a[i]));
+    case OP_POW: EXPR_LOOP(d[i] = vm_pow(a[i], b[i]));
+    case OP_POWI:
+        powi_block(d, a, imm);
+        break;
+    }
+
+#undef EXPR_LOOP
+}
+
+/* coords holds a block per coordinate beyond x; without it they read as 0 */
+EXPR_INLINE void run_block(const Pass *pass, double (*regs)[EXPR_BLOCK],
+                           const double (*coords)[EXPR_BLOCK]) {
+    for (int pc = 0; pc < pass->len; pc++) {
+        const Insn *in = &pass->code[pc];
+        if (in->op == OP_LOAD) {
+            for (int i = 0; i < EXPR_BLOCK; i++) {
+                regs[in->dst][i] = coords ? coords[(int)in->imm][i] : 0;
+            }
+            continue;
+        }
+        run_insn(in, regs[in->dst], regs[in->a], regs[in->b]);
+    }
+}
+
+/* Fills the x register with start + step * (base + i), runs the program and
+ * adds the block into eight running lanes. */
+EXPR_INLINE void sum_block(const Expr *e, double (*regs)[EXPR_BLOCK],
+                           double start, double step, double base, double *acc) {
+    for (int i = 0; i < EXPR_BLOCK; i++) {
+        regs[REG_X][i] = start + step * (base + i);
+    }
+    run_block(&e->all, regs, NULL);
+
+    const double *y = regs[e->result];
+    double lanes[8] = {0};
+    for (int i = 0; i < EXPR_BLOCK; i += 8) {
+        for (int j = 0; j < 8; j++) {
+            lanes[j] += y[i + j];
+        }
+    }
+    for (int j = 0; j < 8; j++) {
+        acc[j] += lanes[j];
+    }
+}
+
+/* The p register holds a block of parameters. The x-only pass runs over
+ * EXPR_BLOCK grid points at a time in xregs; then every point is broadcast
+ * in turn and the main pass accumulates per parameter, so its vector lanes
+ * run across p. */
+EXPR_INLINE void sweep_block(const Expr *e, double (*regs)[EXPR_BLOCK],
+                             double (*xregs)[EXPR_BLOCK], double start, double step,
+                             long first, long count, double *restrict acc) {
+    run_block(&e->pre, regs, NULL);
+
+    for (long done = 0; done < count; done += EXPR_BLOCK) {
+        long len = (count - done < EXPR_BLOCK) ? count - done : EXPR_BLOCK;
+        for (int i = 0; i < EXPR_BLOCK; i++) {
+            xregs[REG_X][i] = start + step * (first + done + ((i < len) ? i : 0));
+        }
+        run_block(&e->xs, xregs, NULL);
+
+        for (long k = 0; k < len; k++) {
+            for (int in = 0; in < e->input_count; in++) {
+                double v = xregs[e->inputs[in][1]][k];
+                double *d = regs[e->inputs[in][0]];
+                for (int i = 0; i < EXPR_BLOCK; i++) {
+                    d[i] = v;
+                }
+            }
+            double x = xregs[REG_X][k];
+            for (int i = 0; i < EXPR_BLOCK; i++) {
+                regs[REG_X][i] = x;
+            }
+            run_block(&e->main, regs, NULL);
+
+            const double *y = regs[e->sweep_result];
+            for (int i = 0; i < EXPR_BLOCK; i++) {
+                acc[i] += y[i];
+            }
+        }
+    }
+}
+
+typedef struct BlockOps {
+    void (*eval)(const Expr *e, double (*regs)[EXPR_BLOCK],
+                 const double (*coords)[EXPR_BLOCK]);
+    void (*sum)(const Expr *e, double (*regs)[EXPR_BLOCK],
+                double start, double step, double base, double *acc);
+    void (*sweep)(const Expr *e, double (*regs)[EXPR_BLOCK], double (*xregs)[EXPR_BLOCK],
+                  double start, double step, long first, long count, double *acc);
+} BlockOps;
+
+#define EXPR_DEFINE_OPS(suffix, attr) \
+    attr static void eval_##suffix(const Expr *e, double (*regs)[EXPR_BLOCK], \
+                                   const double (*coords)[EXPR_BLOCK]) { \
+        run_block(&e->all, regs, coords); \
+    } \
+    attr static void sum_##suffix(const Expr *e, double (*regs)[EXPR_BLOCK], \
+                                  double start, double step, double base, \
+                                  double *acc) { \
+        sum_block(e, regs, start, step, base, acc); \
+    } \
+    attr static void sweep_##suffix(const Expr *e, double (*regs)[EXPR_BLOCK], \
+                                    double (*xregs)[EXPR_BLOCK], double start, \
+                                    double step, long first, long count, \
+                                    double *acc) { \
+        sweep_block(e, regs, xregs, start, step, first, count, acc); \
+    } \
+    static const BlockOps ops_##suffix = {eval_##suffix, sum_##suffix, sweep_##suffix}
+
+EXPR_DEFINE_OPS(default, );
+#ifdef EXPR_X86
+EXPR_DEFINE_OPS(avx2, __attribute__((target("avx2"))));
+EXPR_DEFINE_OPS(avx512, __attribute__((target("avx512f"))));
+#endif
+
+/* follows the SIMD width kernel_init() picked */
+static const BlockOps *block_ops(void) {
+#ifdef EXPR_X86
+    switch (kernel_isa()) {
+    case KERNEL_AVX2:
+        return &ops_avx2;
+    case KERNEL_AVX512:
+        return &ops_avx512;
+    default:
+        break;
+    }
+#endif
+    return &ops_default;
+}
+
+static void set_param(const Expr *e, double (*regs)[EXPR_BLOCK]) {
+    if (e->uses_p) {
+        for (int i = 0; i < EXPR_BLOCK; i++) {
+            regs[REG_P][i] = e->param;
+        }
+    }
+}
+
+void expr_set_param(Expr *e, double p) {
+    e->param = p;
+}
+
+int expr_uses_param(const Expr *e) {
+    return e->uses_p;
+}
+
+int expr_dims(const Expr *e) {
+    return e->dims;
+}
+
+void expr_eval(const Expr *e, const double *x, double *y, long n) {
+    double regs[EXPR_MAX_REGS][EXPR_BLOCK] __attribute__((aligned(64)));
+    const BlockOps *ops = block_ops();
+    set_param(e, regs);
+
+    for (long done = 0; done < n; done += EXPR_BLOCK) {
+        long len = (n - done < EXPR_BLOCK) ? n - done : EXPR_BLOCK;
+        for (long i = 0; i < EXPR_BLOCK; i++) {
+            regs[REG_X][i] = x[done + ((i < len) ? i : 0)];
+        }
+        ops->eval(e, regs, NULL);
+        memcpy(y + done, regs[e->result], sizeof(double) * len);
+    }
+}
+
+double expr_sum(const Expr *e, double start, double step, long first, long count) {
+    double regs[EXPR_MAX_REGS][EXPR_BLOCK] __attribute__((aligned(64)));
+    double acc[8] = {0};
+    const BlockOps *ops = block_ops();
+    set_param(e, regs);
+
+    long done = 0;
+    for (; done + EXPR_BLOCK <= count; done += EXPR_BLOCK) {
+        ops->sum(e, regs, start, step, first + done, acc);
+    }
+
+    double value = ((acc[0] + acc[1]) + (acc[2] + acc[3])) +
+                   ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+    if (done < count) {
+        long len = count - done;
+        for (long i = 0; i < EXPR_BLOCK; i++) {
+            regs[REG_X][i] = start + step * (first + done + ((i < len) ? i : 0));
+        }
+        ops->eval(e, regs, NULL);
+        for (long i = 0; i < len; i++) {
+            value += regs[e->result][i];
+        }
+    }
+
+    return value;
+}
+
+void expr_eval_points(const Expr *e, const double (*coords)[EXPR_BLOCK], double *y) {
+    double regs[EXPR_MAX_REGS][EXPR_BLOCK] __attribute__((aligned(64)));
+    set_param(e, regs);
+    memcpy(regs[REG_X], coords[0], sizeof(regs[REG_X]));
+    block_ops()->eval(e, regs, coords);
+    memcpy(y, regs[e->result], sizeof(regs[REG_X]));
+}
+
+void expr_sweep(const Expr *e, const double *p, double start, double step,
+                long first, long count, double *acc) {
+    double regs[EXPR_MAX_REGS][EXPR_BLOCK] __attribute__((aligned(64)));
+    double xregs[EXPR_MAX_REGS][EXPR_BLOCK] __attribute__((aligned(64)));
+    memcpy(regs[REG_P], p, sizeof(regs[REG_P]));
+    block_ops()->sweep(e, regs, xregs, start, step, first, count, acc);
+}
@@ -0,0 +1,43 @@
+#ifndef EXPR_H
+#define EXPR_H
+#include <stddef.h>
+#include "integral.h"
+
+/* Arithmetic expressions in x and a parameter p compiled to a small register
+ * bytecode. Each instruction runs over a whole block of EXPR_BLOCK values,
+ * so the per-point cost is a few vector operations and no interpretation. */
+
+#define EXPR_BLOCK 128
+#define EXPR_MAX_REGS 16
+#define EXPR_MAX_CODE 256
+#define EXPR_MAX_DIMS INTEGRAL_QMC_MAX_DIMS
+
+typedef IntegralExpr Expr;
+
+Expr *expr_compile(const char *src, char *err, size_t errlen);
+/* e recompiled to read u = x - shift in place of x, with x + c, x - c and
+ * c - x formed as u + (shift + c) and so on. Near a point x = -c the
+ * cancellation then happens in the constants, and u keeps every digit.
+ * Keeps e's parameter; NULL if out of memory. */
+Expr *expr_shift(const Expr *e, double shift);
+void expr_free(Expr *e);
+
+/* Value of p seen by expr_eval and expr_sum (0 unless set). */
+void expr_set_param(Expr *e, double p);
+int expr_uses_param(const Expr *e);
+/* Highest coordinate the expression reads: x (x1), x2, ... */
+int expr_dims(const Expr *e);
+
+/* y[i] = e(x[i]) for 0 <= i < n. */
+void expr_eval(const Expr *e, const double *x, double *y, long n);
+/* Sum of e(start + step * i) for first <= i < first + count. */
+double expr_sum(const Expr *e, double start, double step, long first, long count);
+/* y[i] = e(coords[0][i], coords[1][i], ...) for 0 <= i < EXPR_BLOCK, with
+ * one block in coords for each of the expr_dims(e) coordinates. */
+void expr_eval_points(const Expr *e, const double (*coords)[EXPR_BLOCK], double *y);
+/* acc[j] += sum of e(start + step * i; p[j]) for first <= i < first + count,
+ * for each of the EXPR_BLOCK parameters in p. */
+void expr_sweep(const Expr *e, const double *p, double start, double step,
+                long first, long count, double *acc);
+
+#endif /* ifndef EXPR_H */
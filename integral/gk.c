@@ -0,0 +1,240 @@
+#include "gk.h"
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "integrand.h"
+
+#define GK_BATCH_PER_THREAD 4
+
+/* Kronrod nodes; the odd ones are the 7-point Gauss nodes. */
+static const double xgk[8] = {
+    0.991455371120812639206854697526329,
+    0.949107912342758524526189684047851,
+    0.864864423359769072789712788640926,
+    0.741531185599394439863864773280788,
+    0.586087235467691130294144845693013,
+    0.405845151377397166906606412076961,
+    0.207784955007898467600689403773245,
+    0.000000000000000000000000000000000
+};
+
+static const double wgk[8] = {
+    0.022935322010529224963732008058970,
+    0.063092092629978553290700663189204,
+    0.104790010322250183839876322541518,
+    0.140653259715525918745189590510238,
+    0.169004726639267902826583426598550,
+    0.190350578064785409913256402421014,
+    0.204432940075298892414161999234649,
+    0.209482141084727828012999174891714
+};
+
+static const double wg[4] = {
+    0.129484966168869693270611432679082,
+    0.279705391489276667901467771423780,
+    0.381830050505118944950369775488975,
+    0.417959183673469387755102040816327
+};
+
+typedef struct Interval {
+    double a;
+    double b;
+    double value;
+    double error;
+} Interval;
+
+typedef struct Heap {
+    Interval *data;
+    size_t size;
+    size_t max_size;
+} Heap;
+
+#define HEAP_LEFT(i) (2 * (i) + 1)
+#define HEAP_RIGHT(i) (2 * (i) + 2)
+#define HEAP_PARENT(i) (((i) + 1) / 2 - 1)
+
+typedef struct Round {
+    const IntegralFunc *f;
+    const Interval *parents;
+    Interval *children;
+    long count;
+    long next;
+} Round;
+
+double gk15(const IntegralFunc *f, double a, double b, double *error) {
+    double centr = 0.5 * (a + b);
+    double hlgth = 0.5 * (b - a);
+    double fv1[7];
+    double fv2[7];
+
+    /* all 15 nodes in one batch: [centr, left nodes, right nodes] */
+    double x[15];
+    x[0] = centr;
+    for (int j = 0; j < 7; j++) {
+        x[1 + j] = centr - hlgth * xgk[j];
+        x[8 + j] = centr + hlgth * xgk[j];
+    }
+    integrand_eval(f, x, x, 15);
+
+    double fc = x[0];
+    double resg = fc * wg[3];
+    double resk = fc * wgk[7];
+    double resabs = fabs(resk);
+
+    for (int j = 0; j < 7; j++) {
+        double fval1 = x[1 + j];
+        double fval2 = x[8 + j];
+        fv1[j] = fval1;
+        fv2[j] = fval2;
+        if (j % 2 == 1) {
+            resg += wg[j / 2] * (fval1 + fval2);
+        }
+        resk += wgk[j] * (fval1 + fval2);
+        resabs += wgk[j] * (fabs(fval1) + fabs(fval2));
+    }
+
+    double reskh = resk * 0.5;
+    double resasc = wgk[7] * fabs(fc - reskh);
+    for (int j = 0; j < 7; j++) {
+        resasc += wgk[j] * (fabs(fv1[j] - reskh) + fabs(fv2[j] - reskh));
+    }
+
+    double result = resk * hlgth;
+    resabs *= fabs(hlgth);
+    resasc *= fabs(hlgth);
+    double abserr = fabs((resk - resg) * hlgth);
+    if (resasc != 0 && abserr != 0) {
+        abserr = resasc * fmin(1.0, pow(200 * abserr / resasc, 1.5));
+    }
+    if (resabs > DBL_MIN / (50 * DBL_EPSILON)) {
+        abserr = fmax(50 * DBL_EPSILON * resabs, abserr);
+    }
+
+    *error = abserr;
+    return result;
+}
+
+static void heap_push(Heap *h, const Interval *item) {
+    size_t i = h->size++;
+    while (i > 0 && h->data[HEAP_PARENT(i)].error < item->error) {
+        h->data[i] = h->data[HEAP_PARENT(i)];
+        i = HEAP_PARENT(i);
+    }
+    h->data[i] = *item;
+}
+
+static void heap_pop(Heap *h, Interval *item) {
+    *item = h->data[0];
+    Interval last = h->data[--h->size];
+
+    size_t i = 0;
+    for (;;) {
+        size_t largest = i;
+        double error = last.error;
+        size_t l = HEAP_LEFT(i);
+        size_t r = HEAP_RIGHT(i);
+        if (l < h->size && h->data[l].error > error) {
+            largest = l;
+            error = h->data[l].error;
+        }
+        if (r < h->size && h->data[r].error > error) {
+            largest = r;
+        }
+        if (largest == i) {
+            break;
+        }
+        h->data[i] = h->data[largest];
+        i = largest;
+    }
+    h->data[i] = last;
+}
+
+static void refine(void *arg, long worker) {
+    Round *round = (Round *)arg;
+    long child = 0;
+    while ((child = __atomic_fetch_add(&round->next, 1, __ATOMIC_RELAXED)) <
+           2 * round->count) {
+        const Interval *p = &round->parents[child / 2];
+        double mid = 0.5 * (p->a + p->b);
+        Interval *c = &round->children[child];
+        c->a = (child % 2 == 0) ? p->a : mid;
+        c->b = (child % 2 == 0) ? mid : p->b;
+        c->value = gk15(round->f, c->a, c->b, &c->error);
+    }
+}
+
+/* Running totals drift after many subtractions, so a converged state is
+ * confirmed against a fresh sum over the heap. */
+static void heap_totals(const Heap *h, double *value, double *error) {
+    *value = 0;
+    *error = 0;
+    for (size_t i = 0; i < h->size; i++) {
+        *value += h->data[i].value;
+        *error += h->data[i].error;
+    }
+}
+
+int gk_integrate(Pool *pool, const IntegralFunc *f, double a, double b,
+                 double abstol, double reltol, IntegralResult *res) {
+    long batch = pool_threads(pool) * GK_BATCH_PER_THREAD;
+    Heap heap = {0};
+    heap.max_size = GK_MAX_INTERVALS;
+    heap.data = (Interval *)malloc(sizeof(Interval) * heap.max_size);
+    Interval *parents = (Interval *)malloc(sizeof(Interval) * batch);
+    Interval *children = (Interval *)malloc(sizeof(Interval) * 2 * batch);
+    if (!heap.data || !parents || !children) {
+        fprintf(stderr, "gk_integrate: malloc failed\n");
+        free(heap.data);
+        free(parents);
+        free(children);
+        return -1;
+    }
+
+    Interval whole = {a, b, 0, 0};
+    whole.value = gk15(f, a, b, &whole.error);
+    heap_push(&heap, &whole);
+    res->evaluations = 15;
+
+    int retval = 0;
+    double value = whole.value;
+    double error = whole.error;
+    for (;;) {
+        if (error <= fmax(abstol, reltol * fabs(value))) {
+            heap_totals(&heap, &value, &error);
+            if (error <= fmax(abstol, reltol * fabs(value))) {
+                break;
+            }
+        }
+        if (heap.size + batch > heap.max_size) {
+            heap_totals(&heap, &value, &error);
+            retval = -1;
+            break;
+        }
+
+        Round round = {f, parents, children, 0, 0};
+        while (round.count < batch && heap.size > 0) {
+            heap_pop(&heap, &parents[round.count++]);
+        }
+        pool_run(pool, refine, &round);
+
+        for (long i = 0; i < round.count; i++) {
+            value -= parents[i].value;
+            error -= parents[i].error;
+        }
+        for (long i = 0; i < 2 * round.count; i++) {
+            value += children[i].value;
+            error += children[i].error;
+            heap_push(&heap, &children[i]);
+        }
+        res->evaluations += 2 * 15 * round.count;
+    }
+
+    res->value = value;
+    res->error = error;
+
+    free(children);
+    free(parents);
+    free(heap.data);
+    return retval;
+}
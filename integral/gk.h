@@ -0,0 +1,14 @@
+#ifndef GK_H
+#define GK_H
+#include "integral.h"
+#include "pool.h"
+
+#define GK_MAX_INTERVALS (1L << 20)
+
+/* Single G7K15 panel over [a, b]; *error follows the QUADPACK qk15 estimate. */
+double gk15(const IntegralFunc *f, double a, double b, double *error);
+
+int gk_integrate(Pool *pool, const IntegralFunc *f, double a, double b,
+                 double abstol, double reltol, IntegralResult *res);
+
+#endif /* ifndef GK_H */
@@ -0,0 +1,14 @@
+#ifndef GRID_H
+#define GRID_H
+#include "integral.h"
+
+/* Sum of f(start + step * i), 0 <= i < n, spread over the context's workers.
+ * Small grids are summed on the calling thread. */
+double grid_sum(IntegralCtx *ctx, const IntegralFunc *f, double start, double step, long n);
+
+/* Sum of range(arg, first, count) over pieces covering 0 <= i < n, which
+ * the workers take from the scheduler in multiples of chunk_size. */
+typedef double (*grid_range_fn)(void *arg, long first, long count);
+double grid_run(IntegralCtx *ctx, grid_range_fn range, void *arg, long n, long chunk_size);
+
+#endif /* ifndef GRID_H */
@@ -1,192 +1,944 @@
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
 #include <errno.h>
-#include <sched.h>
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <time.h>
 #include <unistd.h>
 #include "cpuinfo.h"
+#include "kernel.h"
+#include "autotune.h"
+#include "integral.h"
+#include "placement.h"
+#include "rule.h"
+#include "trace.h"
 
 #define TOTAL_SUBINTERVALS (1 * 2 * 3 * 5 * 6 * 7 * 8  * 300000L)
 #define START 0.0
 #define END 10.0
-#define STEP ((END - START) / TOTAL_SUBINTERVALS)
+#define DEFAULT_CHUNK_SIZE (1L << 18)
+#define DEFAULT_ABSTOL 1e-10
+#define DEFAULT_RELTOL 1e-12
+#define DEFAULT_JOURNAL_INTERVAL 1.0
+#define DEFAULT_QMC_POINTS (1L << 20)
+#define DEFAULT_QMC_DIMS 8
+#define DEFAULT_QMC_REPLICATES 16
+#define QMC_SEED 20240229
+/* jobs per batch window without cache information, and the bounds */
+#define BATCH_WINDOW 4096
+#define BATCH_MIN_WINDOW 256
+#define BATCH_MAX_WINDOW (1L << 16)
+#define BATCH_MAX_EXPRS 64
+#define BATCH_LINE 1024
 #define MAX(x, y) (((x) > (y)) ? (x) : (y))
 #define MIN(x, y) (((x) < (y)) ? (x) : (y))
+/* long options have no short form */
+#define OPT_AUTOTUNE 256
+#define OPT_TRACE 257
+#define OPT_COUNTERS 258
+
+typedef enum Mode {
+    MODE_TRAPEZOID = 0,
+    MODE_GK,
+    MODE_ROMBERG,
+    MODE_TANHSINH,
+    MODE_QMC
+} Mode;
+
+static void print_progress(const IntegralResult *res, long n, void *arg) {
+    printf("n = %ld: %.15lg +- %lg (%ld evaluations)\n",
+           n, res->value, res->error, res->evaluations);
+    fflush(stdout);
+}
 
-typedef struct WorkerArgs {
-    double start;
-    double end;
-    long subintervals;
-    double result;
-} WorkerArgs;
+/* Batch input is read a window of jobs at a time by a reader thread, which
+ * fills one window while the workers run the other. */
+typedef struct BatchWindow {
+    IntegralJob *jobs;
+    double *values;
+    double *seconds;
+    long count;
+    long first_id;
+    int full;
+    int last;
+} BatchWindow;
+
+/* binary job records */
+typedef struct BatchRecord {
+    double a;
+    double b;
+    int64_t n;
+} BatchRecord;
+
+typedef struct BatchReader {
+    FILE *in;
+    int binary;
+    const IntegralFunc *func;
+    long line;
+    long next_id;
+    int failed;
+    long window_size;
+    BatchWindow windows[2];
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    /* expressions named on job lines, compiled once */
+    const char *sources[BATCH_MAX_EXPRS];
+    IntegralFunc funcs[BATCH_MAX_EXPRS];
+    int exprs;
+} BatchReader;
+
+typedef struct BatchOutput {
+    int completion_order;
+    BatchWindow *window;
+    double *latencies;
+    long latency_count;
+    long latency_max;
+} BatchOutput;
+
+/* -P first:last:count, evenly spaced parameter values */
+typedef struct SweepSpec {
+    double first;
+    double last;
+    long count;
+} SweepSpec;
 
-static inline __attribute__((always_inline)) double f(double x) {
-    return (2 - x * x) / (4 + x);
+static int parse_arg(const char *str, long *ptr);
+static int parse_double(const char *str, double *ptr);
+static int parse_sweep(const char *str, SweepSpec *spec);
+static int parse_interval(const char *str, double *lower, double *upper);
+static int usage(void);
+
+/* worker instrumentation, reported when the process exits */
+static Trace *trace;
+static const char *trace_path;
+static int trace_table;
+
+static void finish_trace(void) {
+    if (trace_path) {
+        trace_write_chrome(trace, trace_path);
+    }
+    if (trace_table) {
+        trace_print(trace, stderr);
+    }
+    trace_delete(trace);
 }
 
-static void *calculate_integral(void *data) {
-    WorkerArgs *args = (WorkerArgs *)data;
+static const IntegralFunc *batch_expr(BatchReader *r, const char *src) {
+    for (int i = 0; i < r->exprs; i++) {
+        if (strcmp(r->sources[i], src) == 0) {
+            return &r->funcs[i];
+        }
+    }
+    if (r->exprs == BATCH_MAX_EXPRS) {
+        fprintf(stderr, "line %ld: more than %d distinct expressions\n",
+                r->line, BATCH_MAX_EXPRS);
+        return NULL;
+    }
+
+    char err[128];
+    IntegralExpr *expr = integral_expr_compile(src, err, sizeof(err));
+    char *copy = strdup(src);
+    if (!expr || !copy) {
+        fprintf(stderr, "line %ld: bad expression: %s\n", r->line, expr ? "strdup" : err);
+        integral_expr_free(expr);
+        free(copy);
+        return NULL;
+    }
+    r->sources[r->exprs] = copy;
+    r->funcs[r->exprs].fn = NULL;
+    r->funcs[r->exprs].expr = expr;
+    return &r->funcs[r->exprs++];
+}
 
-    double start = args->start;
-    double end = args->end;
-    long subintervals = args->subintervals;
+/* Text jobs are "a b n [expression]" per line; blank lines and lines
+ * starting with '#' are skipped. Returns 1 on a job, 0 at end of input. */
+static int batch_read_text(BatchReader *r, IntegralJob *job) {
+    char line[BATCH_LINE];
+    while (fgets(line, sizeof(line), r->in)) {
+        r->line++;
+        char *p = line + strspn(line, " \t");
+        if (*p == '#' || *p == '\n' || *p == '\0') {
+            continue;
+        }
 
-    double value = (f(start) + f(end)) / 2;
-    for (long i = 1; i < subintervals; i++) {
-        value += f(start + STEP * i);
+        int used = 0;
+        if (sscanf(p, "%lf %lf %ld %n", &job->a, &job->b, &job->n, &used) != 3 ||
+            job->n < 1) {
+            fprintf(stderr, "line %ld: expected \"a b n [expression]\"\n", r->line);
+            return -1;
+        }
+        p += used;
+        p[strcspn(p, "\n")] = '\0';
+        job->f = r->func;
+        if (*p != '\0' && !(job->f = batch_expr(r, p))) {
+            return -1;
+        }
+        return 1;
     }
+    return 0;
+}
 
-    value *= STEP;
-    args->result = value;
+static int batch_read_binary(BatchReader *r, IntegralJob *job) {
+    BatchRecord rec;
+    size_t got = fread(&rec, 1, sizeof(rec), r->in);
+    if (got == 0) {
+        return 0;
+    }
+    r->line++;
+    if (got != sizeof(rec) || rec.n < 1) {
+        fprintf(stderr, "record %ld: %s\n", r->line,
+                (got != sizeof(rec)) ? "truncated" : "n < 1");
+        return -1;
+    }
+    job->f = r->func;
+    job->a = rec.a;
+    job->b = rec.b;
+    job->n = rec.n;
+    return 1;
+}
 
+static void *batch_reader(void *data) {
+    BatchReader *r = (BatchReader *)data;
+    for (int w = 0; ; w ^= 1) {
+        BatchWindow *win = &r->windows[w];
+        pthread_mutex_lock(&r->lock);
+        while (win->full) {
+            pthread_cond_wait(&r->cond, &r->lock);
+        }
+        pthread_mutex_unlock(&r->lock);
+
+        int status = 1;
+        win->count = 0;
+        win->first_id = r->next_id;
+        while (win->count < r->window_size) {
+            status = r->binary ? batch_read_binary(r, &win->jobs[win->count])
+                               : batch_read_text(r, &win->jobs[win->count]);
+            if (status <= 0) {
+                break;
+            }
+            win->count++;
+        }
+        r->next_id += win->count;
+
+        pthread_mutex_lock(&r->lock);
+        win->full = 1;
+        win->last = (status <= 0);
+        r->failed = (status < 0);
+        pthread_cond_broadcast(&r->cond);
+        pthread_mutex_unlock(&r->lock);
+        if (status <= 0) {
+            break;
+        }
+    }
     return NULL;
 }
 
-static void *fake_thread(void *data) {
-    for (;;) {
+static void batch_job_done(long index, double value, double seconds, void *arg) {
+    BatchOutput *out = (BatchOutput *)arg;
+    out->window->seconds[index] = seconds;
+    if (out->completion_order) {
+        printf("%ld %.15lg\n", out->window->first_id + index, value);
     }
+}
 
-    return NULL;
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
 }
 
-static int parse_arg(const char *str, long *ptr);
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Both windows' jobs, values and times stay in the reader's L2, which the
+ * workers' results are written back through. */
+static long batch_window_size(void) {
+    size_t l2 = cpuinfo_getcachesize(-1, 2);
+    if (l2 == 0) {
+        return BATCH_WINDOW;
+    }
+    long size = l2 / 2 / (sizeof(IntegralJob) + 2 * sizeof(double));
+    return MIN(MAX(size, BATCH_MIN_WINDOW), BATCH_MAX_WINDOW);
+}
+
+/* Streams jobs from path ("-" for stdin) through ctx and prints "id value"
+ * per job, in input order or as jobs complete. */
+static int run_batch(IntegralCtx *ctx, const char *path, int binary,
+                     int completion_order, const IntegralFunc *func) {
+    BatchReader r;
+    memset(&r, 0, sizeof(r));
+    r.binary = binary;
+    r.func = func;
+    r.in = (strcmp(path, "-") == 0) ? stdin : fopen(path, binary ? "rb" : "r");
+    if (!r.in) {
+        perror(path);
+        return -1;
+    }
+    pthread_mutex_init(&r.lock, NULL);
+    pthread_cond_init(&r.cond, NULL);
+
+    BatchOutput out = {completion_order, NULL, NULL, 0, 0};
+    int retval = 0;
+    r.window_size = batch_window_size();
+    for (int w = 0; w < 2; w++) {
+        r.windows[w].jobs = (IntegralJob *)malloc(sizeof(IntegralJob) * r.window_size);
+        r.windows[w].values = (double *)malloc(sizeof(double) * r.window_size);
+        r.windows[w].seconds = (double *)malloc(sizeof(double) * r.window_size);
+        if (!r.windows[w].jobs || !r.windows[w].values || !r.windows[w].seconds) {
+            perror("malloc");
+            retval = -1;
+            goto CLOSE;
+        }
+    }
 
-static void spawn(pthread_t *t,
-                  pthread_attr_t *attr,
-                  WorkerArgs *args,
-                  double start,
-                  double end,
-                  int cpu,
-                  size_t subintervals) {
-    //printf("%d %lg %lg %ld\n", cpu, start, end, subintervals);
-    args->start = start;
-    args->end = end;
-    args->subintervals = subintervals;
-
-    cpu_set_t cpuset;
-    CPU_ZERO(&cpuset);
-    CPU_SET(cpu, &cpuset);
-    if (pthread_attr_setaffinity_np(attr, sizeof(cpu_set_t), &cpuset)) {
-        perror("pthread_attr_setaffinity_np");
-        exit(EXIT_FAILURE);
-    }
-
-    if (pthread_create(t, attr, calculate_integral, args) != 0) {
+    pthread_t reader;
+    if ((errno = pthread_create(&reader, NULL, batch_reader, &r)) != 0) {
         perror("pthread_create");
-        exit(EXIT_FAILURE);
+        retval = -1;
+        goto CLOSE;
+    }
+
+    double start = now_seconds();
+    for (int w = 0; ; w ^= 1) {
+        BatchWindow *win = &r.windows[w];
+        pthread_mutex_lock(&r.lock);
+        while (!win->full) {
+            pthread_cond_wait(&r.cond, &r.lock);
+        }
+        pthread_mutex_unlock(&r.lock);
+
+        if (out.latency_count + win->count > out.latency_max) {
+            out.latency_max = MAX(2 * out.latency_max, out.latency_count + win->count);
+            double *grown = (double *)realloc(out.latencies,
+                                              sizeof(double) * out.latency_max);
+            if (!grown) {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+            out.latencies = grown;
+        }
+
+        out.window = win;
+        integral_run_batch(ctx, win->jobs, win->count, win->values, batch_job_done, &out);
+        for (long i = 0; i < win->count; i++) {
+            if (!completion_order) {
+                printf("%ld %.15lg\n", win->first_id + i, win->values[i]);
+            }
+            out.latencies[out.latency_count++] = win->seconds[i];
+        }
+
+        pthread_mutex_lock(&r.lock);
+        int last = win->last;
+        win->full = 0;
+        pthread_cond_broadcast(&r.cond);
+        pthread_mutex_unlock(&r.lock);
+        if (last) {
+            break;
+        }
+    }
+    double wall = now_seconds() - start;
+    pthread_join(reader, NULL);
+    fflush(stdout);
+    retval = r.failed ? -1 : 0;
+
+    long jobs = out.latency_count;
+    if (jobs > 0) {
+        qsort(out.latencies, jobs, sizeof(double), compare_doubles);
+        double sum = 0;
+        for (long i = 0; i < jobs; i++) {
+            sum += out.latencies[i];
+        }
+        fprintf(stderr, "%ld jobs in %.3lf s: %.0lf jobs/s; latency us "
+                        "min %.1lf mean %.1lf p50 %.1lf p99 %.1lf max %.1lf\n",
+                jobs, wall, jobs / wall, out.latencies[0] * 1e6, sum / jobs * 1e6,
+                out.latencies[jobs / 2] * 1e6, out.latencies[jobs * 99 / 100] * 1e6,
+                out.latencies[jobs - 1] * 1e6);
     }
+    free(out.latencies);
+
+CLOSE:
+    for (int w = 0; w < 2; w++) {
+        free(r.windows[w].jobs);
+        free(r.windows[w].values);
+        free(r.windows[w].seconds);
+    }
+    for (int i = 0; i < r.exprs; i++) {
+        integral_expr_free((IntegralExpr *)r.funcs[i].expr);
+        free((char *)r.sources[i]);
+    }
+    pthread_cond_destroy(&r.cond);
+    pthread_mutex_destroy(&r.lock);
+    if (r.in != stdin) {
+        fclose(r.in);
+    }
+    return retval;
+}
+
+/* Prints "p value" for every parameter of spec. With compare set, the same
+ * integrals are also run one parameter at a time through integral_run and
+ * both timings go to stderr. */
+static int run_sweep(IntegralCtx *ctx, IntegralExpr *expr, double a, double b, long n,
+                     const SweepSpec *spec, int compare) {
+    double *params = (double *)malloc(sizeof(double) * spec->count);
+    double *values = (double *)malloc(sizeof(double) * spec->count);
+    if (!params || !values) {
+        perror("malloc");
+        free(params);
+        free(values);
+        return -1;
+    }
+    for (long i = 0; i < spec->count; i++) {
+        params[i] = (spec->count == 1) ? spec->first :
+                    spec->first + (spec->last - spec->first) * i / (spec->count - 1);
+    }
+
+    double start = now_seconds();
+    if (integral_run_sweep(ctx, expr, a, b, n, params, spec->count, values) < 0) {
+        fprintf(stderr, "integral_run_sweep: out of memory\n");
+        free(params);
+        free(values);
+        return -1;
+    }
+    double sweep = now_seconds() - start;
+
+    for (long i = 0; i < spec->count; i++) {
+        printf("%.15lg %.15lg\n", params[i], values[i]);
+    }
+
+    if (compare) {
+        IntegralFunc func = {NULL, expr};
+        double diff = 0;
+        start = now_seconds();
+        for (long i = 0; i < spec->count; i++) {
+            integral_expr_set_param(expr, params[i]);
+            double value = integral_run(ctx, &func, a, b, n);
+            diff = MAX(diff, fabs(value - values[i]) / MAX(fabs(value), 1.0));
+        }
+        double loop = now_seconds() - start;
+        double points = (double)spec->count * (n + 1);
+        fprintf(stderr, "sweep: %.3lf s (%.3lg points/s); loop: %.3lf s (%.3lg points/s); "
+                        "speedup %.2lf, max relative difference %lg\n",
+                sweep, points / sweep, loop, points / loop, loop / sweep, diff);
+    }
+
+    free(params);
+    free(values);
+    return 0;
+}
+
+static int calibrate(IntegralCtx *ctx, const char *path, long worker_count,
+                     int print_stats) {
+    double *rates = (double *)malloc(sizeof(double) * worker_count);
+    if (!rates) {
+        perror("malloc");
+        return -1;
+    }
+
+    int cached = integral_ctx_calibrate(ctx, path, rates);
+    if (cached >= 0 && print_stats) {
+        fprintf(stderr, "calibration %s:", cached ? "loaded" : "measured");
+        for (long i = 0; i < worker_count; i++) {
+            fprintf(stderr, " %.3lg", rates[i]);
+        }
+        fprintf(stderr, " evaluations/s\n");
+    }
+
+    free(rates);
+    return (cached < 0) ? -1 : 0;
 }
 
 int main(int argc, char *argv[]) {
-    size_t physical_cores = 0;
-    size_t cores_used = 0;
     long worker_count = 0;
+    long chunk_size = DEFAULT_CHUNK_SIZE;
+    int print_stats = 0;
+    int reproducible = 0;
+    long tasks = 0;
+    const char *journal_path = NULL;
+    const char *profile_path = NULL;
+    double journal_interval = DEFAULT_JOURNAL_INTERVAL;
+    KernelIsa isa = KERNEL_AUTO;
+    static Placement placement = {PLACEMENT_SCATTER, 0, {0}, 0};
+    Mode mode = MODE_TRAPEZOID;
+    IntegralRule rule = INTEGRAL_RULE_TRAPEZOID;
+    int rule_order = 0;
+    int mixed = 0;
+    double abstol = DEFAULT_ABSTOL;
+    double reltol = DEFAULT_RELTOL;
+    double budget = 0;
+    const char *source = NULL;
+    const char *batch_path = NULL;
+    int batch_binary = 0;
+    int completion_order = 0;
+    long subintervals = 0;
+    long dims = DEFAULT_QMC_DIMS;
+    long replicates = DEFAULT_QMC_REPLICATES;
+    double lower = START;
+    double upper = END;
+    SweepSpec sweep = {0, 0, 0};
+
+    int autotune = 0;
+    int isa_set = 0;
+    int chunk_set = 0;
+    int placement_set = 0;
+    int interval_set = 0;
+    static const struct option long_options[] = {
+        {"autotune", no_argument, NULL, OPT_AUTOTUNE},
+        {"trace", required_argument, NULL, OPT_TRACE},
+        {"counters", no_argument, NULL, OPT_COUNTERS},
+        {NULL, 0, NULL, 0}
+    };
+
+    int opt = 0;
+    while ((opt = getopt_long(argc, argv, "k:c:sp:S:m:a:r:T:e:b:B:o:n:P:d:R:I:Dj:J:t:C:q:M",
+                              long_options, NULL)) != -1) {
+        switch (opt) {
+        case OPT_AUTOTUNE:
+            autotune = 1;
+            break;
+        case OPT_TRACE:
+            trace_path = optarg;
+            break;
+        case OPT_COUNTERS:
+            trace_table = 1;
+            break;
+        case 'k':
+            if (kernel_parse_isa(optarg, &isa) < 0) {
+                return EXIT_FAILURE;
+            }
+            isa_set = 1;
+            break;
+        case 'c':
+            if (parse_arg(optarg, &chunk_size) < 0) {
+                return EXIT_FAILURE;
+            }
+            chunk_set = 1;
+            break;
+        case 's':
+            print_stats = 1;
+            break;
+        case 'M':
+            mixed = 1;
+            break;
+        case 'q':
+            if (rule_parse(optarg, &rule, &rule_order) < 0) {
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'D':
+            reproducible = 1;
+            break;
+        case 't':
+            if (parse_arg(optarg, &tasks) < 0) {
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'j':
+            journal_path = optarg;
+            break;
+        case 'C':
+            profile_path = optarg;
+            break;
+        case 'J':
+            if (parse_double(optarg, &journal_interval) < 0) {
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'p':
+            if (placement_parse(optarg, &placement) < 0) {
+                return usage();
+            }
+            placement_set = 1;
+            break;
+        case 'S':
+            if (strcmp(optarg, "on") == 0 || strcmp(optarg, "off") == 0) {
+                placement.spinners = (strcmp(optarg, "on") == 0);
+            }
+            else {
+                return usage();
+            }
+            break;
+        case 'm':
+            if (strcmp(optarg, "trapezoid") == 0) {
+                mode = MODE_TRAPEZOID;
+            }
+            else if (strcmp(optarg, "gk") == 0) {
+                mode = MODE_GK;
+            }
+            else if (strcmp(optarg, "romberg") == 0) {
+                mode = MODE_ROMBERG;
+            }
+            else if (strcmp(optarg, "tanhsinh") == 0) {
+                mode = MODE_TANHSINH;
+            }
+            else if (strcmp(optarg, "qmc") == 0) {
+                mode = MODE_QMC;
+            }
+            else {
+                return usage();
+            }
+            break;
+        case 'a':
+            if (parse_double(optarg, &abstol) < 0) {
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'r':
+            if (parse_double(optarg, &reltol) < 0) {
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'T':
+            if (parse_double(optarg, &budget) < 0) {
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'e':
+            source = optarg;
+            break;
+        case 'b':
+        case 'B':
+            batch_path = optarg;
+            batch_binary = (opt == 'B');
+            break;
+        case 'o':
+            if (strcmp(optarg, "input") == 0) {
+                completion_order = 0;
+            }
+            else if (strcmp(optarg, "completion") == 0) {
+                completion_order = 1;
+            }
+            else {
+                return usage();
+            }
+            break;
+        case 'n':
+            if (parse_arg(optarg, &subintervals) < 0) {
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'd':
+            if (parse_arg(optarg, &dims) < 0) {
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'R':
+            if (parse_arg(optarg, &replicates) < 0) {
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'I':
+            if (parse_interval(optarg, &lower, &upper) < 0) {
+                return EXIT_FAILURE;
+            }
+            interval_set = 1;
+            break;
+        case 'P':
+            if (parse_sweep(optarg, &sweep) < 0) {
+                return EXIT_FAILURE;
+            }
+            break;
+        default:
+            return usage();
+        }
+    }
+
+    if (optind < argc - 1) {
+        return usage();
+    }
+    /* each of these picks what gets run, so at most one of them */
+    const char *runs[] = {
+        (sweep.count > 0) ? "-P" : NULL,
+        batch_path ? (batch_binary ? "-B" : "-b") : NULL,
+        (mode != MODE_TRAPEZOID) ? "-m" : NULL,
+        journal_path ? "-j" : NULL,
+        (tasks > 0) ? "-t" : NULL
+    };
+    const char *run = NULL;
+    for (size_t i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+        if (runs[i] && run) {
+            fprintf(stderr, "%s and %s cannot be combined\n", run, runs[i]);
+            return usage();
+        }
+        run = run ? run : runs[i];
+    }
+    if (interval_set && (mode == MODE_QMC || batch_path)) {
+        fprintf(stderr, (mode == MODE_QMC) ? "-I does not apply to -m qmc, which "
+                                             "integrates over the unit cube\n" :
+                                             "-I does not apply to %s, whose jobs "
+                                             "carry their intervals\n", run);
+        return usage();
+    }
+    if (rule != INTEGRAL_RULE_TRAPEZOID &&
+        (mode != MODE_TRAPEZOID || journal_path || tasks > 0 || batch_path || sweep.count > 0)) {
+        fprintf(stderr, "-q applies to plain runs: not with -m, -j, -t, -b, -B or -P\n");
+        return EXIT_FAILURE;
+    }
+    if (mixed && (rule != INTEGRAL_RULE_TRAPEZOID || mode != MODE_TRAPEZOID || journal_path ||
+                  tasks > 0 || batch_path || sweep.count > 0 || source)) {
+        fprintf(stderr, "-M applies to plain trapezoid runs of the built-in integrand\n");
+        return EXIT_FAILURE;
+    }
+    if (optind == argc - 1 && parse_arg(argv[optind], &worker_count) < 0) {
+        return EXIT_FAILURE;
+    }
+
+    /* the host's tuned profile fills in whatever the command line leaves
+     * open, the worker count included */
+    TuneConfig tuned;
+    char profile[PATH_MAX];
+    int have_profile = autotune_profile_path(profile, sizeof(profile)) == 0;
+    int tuned_ok = 0;
+    if (autotune) {
+        if (autotune_run(&tuned, 1) < 0) {
+            fprintf(stderr, "autotune failed\n");
+            return EXIT_FAILURE;
+        }
+        fprintf(stderr, "autotune: %ld workers, chunk %ld, %s placement, %s kernel\n",
+                tuned.threads, tuned.chunk_size, placement_name(tuned.policy),
+                kernel_name(tuned.isa));
+        if (have_profile && autotune_save(profile, &tuned) == 0) {
+            fprintf(stderr, "autotune: saved to %s\n", profile);
+        }
+        tuned_ok = 1;
+    }
+    else if (have_profile && autotune_load(profile, &tuned) == 0) {
+        tuned_ok = kernel_supported(tuned.isa);
+        if (tuned_ok && print_stats) {
+            fprintf(stderr, "using tuned profile %s\n", profile);
+        }
+    }
+    if (tuned_ok) {
+        worker_count = worker_count ? worker_count : tuned.threads;
+        chunk_size = chunk_set ? chunk_size : tuned.chunk_size;
+        placement.policy = placement_set ? placement.policy : tuned.policy;
+        isa = isa_set ? isa : tuned.isa;
+    }
+    if (worker_count == 0) {
+        return usage();
+    }
+
+    if (kernel_init(isa) < 0) {
+        return EXIT_FAILURE;
+    }
 
-    if (argc != 2) {
-        fprintf(stderr, "Usage: integral [worker count]\n");
+    IntegralFunc func = {NULL, NULL};
+    IntegralExpr *expr = NULL;
+    if (source) {
+        char err[128];
+        expr = integral_expr_compile(source, err, sizeof(err));
+        if (!expr) {
+            fprintf(stderr, "bad expression: %s\n", err);
+            return EXIT_FAILURE;
+        }
+        func.expr = expr;
+    }
+
+    int *cpus = (int *)malloc(sizeof(int) * worker_count);
+    if (!cpus) {
+        perror("malloc");
         return EXIT_FAILURE;
     }
+    if (placement.policy != PLACEMENT_NONE) {
+        cpuinfo_parse();
+    }
+    placement_plan(&placement, worker_count, cpus, NULL);
 
-    if (parse_arg(argv[1], &worker_count) < 0) {
+    IntegralCtx *ctx = integral_ctx_create_cpus(worker_count, cpus);
+    if (!ctx) {
         return EXIT_FAILURE;
     }
+    integral_ctx_set_chunk(ctx, chunk_size);
+    integral_ctx_set_reproducible(ctx, reproducible);
+    if (trace_path || trace_table) {
+        trace = trace_new(worker_count);
+        if (!trace) {
+            perror("trace_new");
+            return EXIT_FAILURE;
+        }
+        integral_ctx_set_trace(ctx, trace);
+        atexit(finish_trace);
+    }
 
-    cpuinfo_parse();
-    physical_cores = cpuinfo_getphysicalcores();
-    cores_used = MIN(physical_cores, worker_count);
+    if (placement_spin_idle(&placement, cpus, worker_count) < 0) {
+        return EXIT_FAILURE;
+    }
+    free(cpus);
 
-    pthread_attr_t attr;
-    if (pthread_attr_init(&attr) != 0) {
-        perror("pthread_attr_init");
+    if (profile_path && calibrate(ctx, profile_path, worker_count, print_stats) < 0) {
+        integral_ctx_destroy(ctx);
         return EXIT_FAILURE;
     }
 
-    pthread_t workers[worker_count];
-    WorkerArgs worker_args[worker_count];
-    size_t free_subintervals = TOTAL_SUBINTERVALS;
-    size_t subintervals_per_core = TOTAL_SUBINTERVALS / cores_used;
-    long free_workers = worker_count;
-    long workers_per_core = worker_count / cores_used;
-    long n = 0;
-    double start = START;
-    double end = END;
-
-    for (int core = 0; core < cores_used; core++) {
-        size_t subintervals_thiscore = subintervals_per_core;
-        long workers_thiscore = workers_per_core;
-        if (core == cores_used - 1) {
-            subintervals_thiscore = free_subintervals;
-            workers_thiscore = free_workers;
-        }
-        free_subintervals -= subintervals_thiscore;
-        free_workers -= workers_thiscore;
-
-        size_t logical_cnt = MIN(cpuinfo_getlogicalcores(core),
-                                 workers_thiscore);
-        long workers_per_logical = workers_thiscore / logical_cnt;
-        size_t subintervals_per_logical = subintervals_thiscore / logical_cnt;
-
-        for (long curlogical = 0; curlogical < logical_cnt; curlogical++) {
-            long workers_log = workers_per_logical;
-            size_t subintervals_log = subintervals_per_logical;
-            if (curlogical == logical_cnt - 1) {
-                workers_log = workers_thiscore;
-                subintervals_log = subintervals_thiscore;
-            }
-            workers_thiscore -= workers_log;
-            subintervals_thiscore -= subintervals_log;
-
-            size_t subintervals_per_worker = subintervals_log / workers_log;
-            for (long i = 0; i < workers_log; i++) {
-                size_t subintervals = subintervals_per_worker;
-                if (i == workers_log - 1) {
-                    subintervals = subintervals_log;
-                }
-                subintervals_log -= subintervals;
-                end = start + subintervals * STEP;
-                spawn(&workers[n], &attr, &worker_args[n],
-                      start,
-                      end,
-                      cpuinfo_getlogicalcoreid(core, curlogical),
-                      subintervals);
-                start = end;
-                n++;
-            }
-        }
-    }
-
-    for (long i = worker_count; i < physical_cores; i++) {
-        int cpu = cpuinfo_getlogicalcoreid(i, 0);
-        cpu_set_t cpuset;
-        CPU_ZERO(&cpuset);
-        CPU_SET(cpu, &cpuset);
-        if (pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpuset)) {
-            perror("pthread_attr_setaffinity_np");
-            exit(EXIT_FAILURE);
-        }
-
-        pthread_t t;
-        if (pthread_create(&t, &attr, fake_thread, NULL) != 0) {
-            perror("pthread_create");
-            exit(EXIT_FAILURE);
+    if (subintervals == 0) {
+        subintervals = (mode == MODE_QMC) ? DEFAULT_QMC_POINTS : TOTAL_SUBINTERVALS;
+    }
+
+    if (sweep.count > 0) {
+        if (!expr) {
+            fprintf(stderr, "a sweep needs an expression in x and p (-e)\n");
+            integral_ctx_destroy(ctx);
+            return EXIT_FAILURE;
         }
+        int retval = run_sweep(ctx, expr, lower, upper, subintervals, &sweep, print_stats);
+        integral_ctx_destroy(ctx);
+        integral_expr_free(expr);
+        return (retval == 0) ? 0 : EXIT_FAILURE;
+    }
+
+    if (batch_path) {
+        int retval = run_batch(ctx, batch_path, batch_binary, completion_order, &func);
+        integral_ctx_destroy(ctx);
+        integral_expr_free(expr);
+        return (retval == 0) ? 0 : EXIT_FAILURE;
+    }
+
+    if (mode == MODE_GK || mode == MODE_TANHSINH) {
+        IntegralResult res;
+        int converged = ((mode == MODE_GK) ?
+            integral_run_adaptive(ctx, &func, lower, upper, abstol, reltol, &res) :
+            integral_run_tanhsinh(ctx, &func, lower, upper, abstol, reltol, &res)) == 0;
+        printf("%.15lg\n", res.value);
+        if (print_stats || !converged) {
+            fprintf(stderr, "%s: error estimate %lg after %ld evaluations\n",
+                    converged ? "converged" : "limit reached",
+                    res.error, res.evaluations);
+        }
+        integral_ctx_destroy(ctx);
+        integral_expr_free(expr);
+        return converged ? 0 : EXIT_FAILURE;
+    }
+
+    if (mode == MODE_QMC) {
+        /* the unit cube */
+        double box_lower[INTEGRAL_QMC_MAX_DIMS] = {0};
+        double box_upper[INTEGRAL_QMC_MAX_DIMS];
+        for (int i = 0; i < INTEGRAL_QMC_MAX_DIMS; i++) {
+            box_upper[i] = 1;
+        }
+        IntegralFuncNd func_nd = {NULL, expr};
+        IntegralResult res;
+        int retval = integral_run_qmc(ctx, &func_nd, dims, box_lower, box_upper, subintervals,
+                                      replicates, QMC_SEED, &res);
+        if (retval == 0) {
+            printf("%.15lg\n", res.value);
+            if (print_stats) {
+                fprintf(stderr, "standard error %lg after %ld evaluations\n",
+                        res.error, res.evaluations);
+            }
+        }
+        integral_ctx_destroy(ctx);
+        integral_expr_free(expr);
+        return (retval == 0) ? 0 : EXIT_FAILURE;
+    }
+
+    if (mode == MODE_ROMBERG) {
+        IntegralResult res;
+        int converged = integral_run_romberg(ctx, &func, lower, upper, abstol, reltol,
+                                             budget, print_progress, NULL, &res) == 0;
+        printf("%.15lg\n", res.value);
+        if (!converged) {
+            fprintf(stderr, "stopped before reaching tolerance: error bound %lg\n",
+                    res.error);
+        }
+        integral_ctx_destroy(ctx);
+        integral_expr_free(expr);
+        return converged ? 0 : EXIT_FAILURE;
     }
 
     double value = 0;
-    for (long i = 0; i < worker_count; i++) {
-        if (pthread_join(workers[i], NULL) != 0) {
-            perror("pthread_join");
+    if (journal_path) {
+        IntegralJournalStats st;
+        if (integral_run_journaled(ctx, &func, source ? source : "builtin", lower, upper,
+                                   subintervals, journal_path, journal_interval,
+                                   &value, &st) < 0) {
+            integral_ctx_destroy(ctx);
+            integral_expr_free(expr);
+            return EXIT_FAILURE;
+        }
+        if (print_stats) {
+            fprintf(stderr, "journal: %ld of %ld chunks resumed, %ld syncs taking %.3lf s\n",
+                    st.resumed, st.chunks, st.syncs, st.sync_seconds);
+        }
+    }
+    else if (mixed) {
+        IntegralResult res;
+        if (integral_run_mixed(ctx, lower, upper, subintervals, &res) < 0) {
+            integral_ctx_destroy(ctx);
             return EXIT_FAILURE;
         }
-        value += worker_args[i].result;
+        value = res.value;
+        fprintf(stderr, "mixed precision: error estimate %lg\n", res.error);
+    }
+    else if (tasks > 0) {
+        value = integral_run_tasks(ctx, &func, lower, upper, subintervals, tasks);
+    }
+    else {
+        value = integral_run_rule(ctx, &func, rule, rule_order, lower, upper, subintervals);
+    }
+    /* all the digits when they are meant to be compared, or when a higher
+     * order rule is there to get them right */
+    printf((reproducible || journal_path) ? "%.17lg\n" :
+           (rule != INTEGRAL_RULE_TRAPEZOID) ? "%.15lg\n" : "%lg\n", value);
+    if (print_stats && rule != INTEGRAL_RULE_TRAPEZOID) {
+        char name[32];
+        rule_name(rule, rule_order, name, sizeof(name));
+        fprintf(stderr, "%s rule over %ld panels\n", name, subintervals);
     }
 
-    printf("%lg\n", value);
+    if (print_stats) {
+        long executed = 0;
+        long stolen = 0;
+        long remote = 0;
+        for (long i = 0; i < worker_count; i++) {
+            IntegralStats st;
+            integral_ctx_stats(ctx, i, &st);
+            fprintf(stderr, "worker %ld: executed %ld, stolen %ld in %ld steals "
+                            "(%ld across nodes)\n",
+                    i, st.executed, st.stolen, st.steals, st.remote);
+            executed += st.executed;
+            stolen += st.stolen;
+            remote += st.remote;
+        }
+        fprintf(stderr, "total: %ld chunks, %ld stolen (%.1f%%), %ld of them across nodes\n",
+                executed, stolen, 100.0 * stolen / executed, remote);
+    }
+    integral_ctx_destroy(ctx);
+    integral_expr_free(expr);
 
     return 0;
 }
 
+static int usage(void) {
+    fprintf(stderr, "Usage: integral [--autotune] [-k auto|scalar|sse2|avx2|avx512] [-c chunk size]\n"
+                    "                [-s] [-D] [-M] [--trace chrome trace file] [--counters]\n"
+                    "                [-p scatter|compact|physical|smt|none|list:cpus] [-S on|off]\n"
+                    "                [-m trapezoid|gk|romberg|tanhsinh|qmc] [-a abs tol] [-r rel tol]\n"
+                    "                [-I lower:upper] [-j journal file] [-J sync interval]\n"
+                    "                [-t task count] [-C calibration profile]\n"
+                    "                [-d qmc dimensions] [-R qmc replicates]\n"
+                    "                [-T time budget] [-e expression]\n"
+                    "                [-b job file | -B binary job file] [-o input|completion]\n"
+                    "                [-n subintervals] [-P first:last:count]\n"
+                    "                [-q trapezoid|simpson|boole|gauss2 ... gauss16]\n"
+                    "                [worker count]\n"
+                    "The worker count and unset -k, -c and -p come from the host's profile\n"
+                    "($INTEGRAL_PROFILE or ~/.integral-<host>.tune) once --autotune wrote one.\n"
+                    "--trace writes every worker's runs with their hardware counters as a\n"
+                    "Chrome trace; --counters prints the per-worker totals.\n"
+                    "-q picks the panel rule; -n then counts panels. -M evaluates the\n"
+                    "built-in integrand in float32 and reports the estimated error.\n"
+                    "-S on spins on the idle physical cores, within the usable CPUs.\n");
+    return EXIT_FAILURE;
+}
+
 int parse_arg(const char *str, long *ptr) {
     long n = 0;
     char *endptr = NULL;
@@ -209,3 +961,48 @@ int parse_arg(const char *str, long *ptr) {
     *ptr = n;
     return 0;
 }
+
+int parse_double(const char *str, double *ptr) {
+    char *endptr = NULL;
+    errno = 0;
+    double x = strtod(str, &endptr);
+
+    if (errno != 0) {
+        perror("strtod");
+        return -1;
+    }
+    if (*endptr != '\0' || endptr == str) {
+        fprintf(stderr, "further chars!\n");
+        return -1;
+    }
+    if (x < 0) {
+        fprintf(stderr, "x < 0!\n");
+        return -1;
+    }
+
+    *ptr = x;
+    return 0;
+}
+
+int parse_sweep(const char *str, SweepSpec *spec) {
+    int end = 0;
+    if (sscanf(str, "%lf:%lf:%ld%n", &spec->first, &spec->last, &spec->count, &end) != 3 ||
+        str[end] != '\0') {
+        fprintf(stderr, "expected first:last:count\n");
+        return -1;
+    }
+    if (spec->count < 1) {
+        fprintf(stderr, "count < 1!\n");
+        return -1;
+    }
+    return 0;
+}
+
+int parse_interval(const char *str, double *lower, double *upper) {
+    int end = 0;
+    if (sscanf(str, "%lf:%lf%n", lower, upper, &end) != 2 || str[end] != '\0') {
+        fprintf(stderr, "expected lower:upper\n");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,218 @@
+#ifndef INTEGRAL_H
+#define INTEGRAL_H
+#include <stddef.h>
+
+/* libintegral: a context owns a set of pinned worker threads that stay
+ * parked between calls, so repeated integrations only pay for the work. */
+
+typedef struct IntegralCtx IntegralCtx;
+typedef struct IntegralExpr IntegralExpr;
+typedef double (*integral_fn)(double x);
+/* Integrand of a multidimensional integral; x holds dims coordinates. */
+typedef double (*integral_fn_nd)(const double *x, int dims);
+
+#define INTEGRAL_QMC_MAX_DIMS 20
+
+/* What to integrate: a native function or a compiled expression. A NULL
+ * IntegralFunc pointer (or both members NULL) selects the built-in
+ * (2 - x^2) / (4 + x), which runs on the SIMD kernels. */
+typedef struct IntegralFunc {
+    integral_fn fn;
+    const IntegralExpr *expr;
+} IntegralFunc;
+
+/* Multidimensional counterpart; expressions name the coordinates x1, x2, ...
+ * (x is x1). NULL selects the built-in Sobol' g-function
+ * prod (|4 x_i - 2| + i) / (1 + i), whose integral over the unit cube is 1. */
+typedef struct IntegralFuncNd {
+    integral_fn_nd fn;
+    const IntegralExpr *expr;
+} IntegralFuncNd;
+
+typedef enum IntegralPlacement {
+    INTEGRAL_PLACE_CORES = 0,  /* spread over physical cores, then siblings,
+                                  grouped by NUMA node */
+    INTEGRAL_PLACE_NONE,       /* leave threads to the OS scheduler */
+    INTEGRAL_PLACE_COMPACT,    /* lowest logical CPU numbers first */
+    INTEGRAL_PLACE_PHYSICAL,   /* one logical CPU per physical core */
+    INTEGRAL_PLACE_SMT         /* all siblings of a core before the next */
+} IntegralPlacement;
+
+/* Composite panel rules for integral_run_rule. */
+typedef enum IntegralRule {
+    INTEGRAL_RULE_TRAPEZOID = 0,
+    INTEGRAL_RULE_SIMPSON,      /* degree 3, 3 points per panel */
+    INTEGRAL_RULE_BOOLE,        /* degree 5, 5 points per panel */
+    INTEGRAL_RULE_GAUSS         /* Gauss-Legendre, degree 2 order - 1 */
+} IntegralRule;
+
+#define INTEGRAL_GAUSS_MIN_ORDER 2
+#define INTEGRAL_GAUSS_MAX_ORDER 16
+
+typedef struct IntegralStats {
+    long executed;
+    long stolen;
+    long steals;
+    long remote;    /* stolen from a worker on another NUMA node */
+} IntegralStats;
+
+typedef struct IntegralResult {
+    double value;
+    double error;       /* estimated absolute error */
+    long evaluations;   /* integrand calls */
+} IntegralResult;
+
+/* Called with every improved estimate; n is the current subinterval count. */
+typedef void (*integral_progress_fn)(const IntegralResult *res, long n, void *arg);
+
+/* One trapezoid integration of a batch. f may be NULL for the built-in. */
+typedef struct IntegralJob {
+    const IntegralFunc *f;
+    double a;
+    double b;
+    long n;
+} IntegralJob;
+
+/* Called as each job of a batch finishes, possibly from a worker thread and
+ * concurrently with other calls; index is the job's position in the batch
+ * and seconds the time spent computing it. */
+typedef void (*integral_job_fn)(long index, double value, double seconds, void *arg);
+
+/* With more workers than the placement has CPUs, they wrap around. */
+IntegralCtx *integral_ctx_create(long threads, IntegralPlacement placement);
+/* Pins worker i to cpus[i], or leaves it unpinned if cpus[i] is -1. */
+IntegralCtx *integral_ctx_create_cpus(long threads, const int *cpus);
+void integral_ctx_destroy(IntegralCtx *ctx);
+
+long integral_ctx_threads(const IntegralCtx *ctx);
+/* Subintervals per scheduled chunk. */
+void integral_ctx_set_chunk(IntegralCtx *ctx, long chunk_size);
+/* Reproducible mode: grids are cut into a fixed global blocking and the
+ * block values are added up along a fixed pairwise tree, so integral_run,
+ * the grid sums behind Romberg and tanh-sinh, batches and QMC give
+ * bit-identical results for any worker count, placement and chunk size.
+ * (Sweeps and adaptive Gauss-Kronrod are deterministic in either mode.)
+ * The kernels still differ in rounding between ISAs. */
+void integral_ctx_set_reproducible(IntegralCtx *ctx, int reproducible);
+/* Splits the work by measured speed instead of the placement's equal share
+ * per core: every worker runs the selected kernel for a moment, all at once,
+ * and the initial ranges follow their evaluations per second (stealing
+ * still evens out what is left). Profiles are cached in the file at path,
+ * keyed by kernel and CPU list, so later runs of the same configuration skip
+ * the measurement; path may be NULL. rates (may be NULL) receives each
+ * worker's evaluations per second. Needs pinned workers (any placement but
+ * INTEGRAL_PLACE_NONE). Returns 1 if the profile came from the file, 0 if it
+ * was measured and -1 on errors. */
+int integral_ctx_calibrate(IntegralCtx *ctx, const char *path, double *rates);
+/* Scheduler statistics of worker for the last run. */
+void integral_ctx_stats(const IntegralCtx *ctx, long worker, IntegralStats *stats);
+/* Records every worker's runs into trace (trace.h), created for
+ * integral_ctx_threads workers; NULL turns tracing off. */
+struct Trace;
+void integral_ctx_set_trace(IntegralCtx *ctx, struct Trace *trace);
+
+/* Compiles an arithmetic expression in x, e.g. "(2 - x*x) / (4 + x)".
+ * Supports + - * / ^, abs, sqrt, exp, log, sin, cos, atan, pow and the constants
+ * pi and e. The variable p is a parameter: 0 unless set below, or swept by
+ * integral_run_sweep. x2 ... x20 are coordinates for integral_run_qmc and
+ * read as 0 elsewhere. On error returns NULL and describes the problem in err. */
+IntegralExpr *integral_expr_compile(const char *src, char *err, size_t errlen);
+void integral_expr_free(IntegralExpr *expr);
+/* Must not be called while an integration of expr is running. */
+void integral_expr_set_param(IntegralExpr *expr, double p);
+
+/* Trapezoid rule for f over [a, b] with n subintervals. */
+double integral_run(IntegralCtx *ctx, const IntegralFunc *f, double a, double b, long n);
+
+/* rule applied to each of n equal panels of [a, b]; order is the point
+ * count of INTEGRAL_RULE_GAUSS (2 ... 16) and ignored by the others. The
+ * closed rules share the panel ends. Panels are partitioned over the
+ * workers like integral_run's subintervals. Returns NAN for a bad order. */
+double integral_run_rule(IntegralCtx *ctx, const IntegralFunc *f, IntegralRule rule,
+                         int order, double a, double b, long n);
+
+/* integral_run of the built-in integrand in mixed precision: evaluated in
+ * float32 SIMD lanes, accumulated in float64 with compensation. res->error
+ * is an a posteriori estimate of the precision lost, from a sample of
+ * blocks also evaluated in double. Returns -1 if the result is NAN. */
+int integral_run_mixed(IntegralCtx *ctx, double a, double b, long n, IntegralResult *res);
+
+/* integral_run split into tasks logical tasks of about n / tasks
+ * subintervals, independent of the number of threads: the descriptors live
+ * on the heap and the context's threads take tasks from the work-stealing
+ * scheduler until none are left. Returns NAN if tasks is out of range or
+ * the descriptors cannot be allocated. */
+double integral_run_tasks(IntegralCtx *ctx, const IntegralFunc *f, double a, double b,
+                          long n, long tasks);
+
+typedef struct IntegralJournalStats {
+    long chunks;            /* chunks of the run */
+    long resumed;           /* found finished in the journal */
+    long syncs;             /* flushes of the journal to disk */
+    double sync_seconds;    /* time the workers spent flushing */
+} IntegralJournalStats;
+
+/* integral_run with a checkpoint journal in the file at path. The run uses
+ * the reproducible blocking and every finished chunk's value goes into the
+ * memory-mapped journal, one store per chunk; chunks the journal already
+ * holds are skipped, so a restarted run returns exactly what the whole run
+ * would have. The journal is flushed to disk at most every interval seconds
+ * (0: after every chunk), which bounds what a machine crash loses; a killed
+ * process loses nothing. tag names the integrand: a journal written for
+ * another tag, a, b, n or kernel is refused. Returns -1 on errors. */
+int integral_run_journaled(IntegralCtx *ctx, const IntegralFunc *f, const char *tag,
+                           double a, double b, long n, const char *path, double interval,
+                           double *value, IntegralJournalStats *stats);
+
+/* Adaptive Gauss-Kronrod (G7K15) quadrature. Intervals with the largest error
+ * estimates are bisected in parallel until the total estimate drops below
+ * max(abstol, reltol * |value|). Returns -1 if the interval limit is hit
+ * first; res then holds the best estimate reached. */
+int integral_run_adaptive(IntegralCtx *ctx, const IntegralFunc *f, double a, double b,
+                          double abstol, double reltol, IntegralResult *res);
+
+/* Romberg integration: the subinterval count doubles each level, only new
+ * midpoints are evaluated, and Richardson extrapolation runs over the
+ * trapezoid sequence. Stops at the tolerance or after budget seconds
+ * (budget <= 0: no limit); returns -1 in the latter case. */
+int integral_run_romberg(IntegralCtx *ctx, const IntegralFunc *f, double a, double b,
+                         double abstol, double reltol, double budget,
+                         integral_progress_fn progress, void *arg,
+                         IntegralResult *res);
+
+/* Tanh-sinh (double exponential) quadrature. The substitution clusters the
+ * points at the ends, so integrable endpoint singularities and nearby poles
+ * converge about as fast as smooth integrands; f is never evaluated at a or
+ * b. The step halves each level, with the new points of a level spread over
+ * the workers, until the estimate drops below max(abstol, reltol * |value|).
+ * Returns -1 if the level limit is reached first. */
+int integral_run_tanhsinh(IntegralCtx *ctx, const IntegralFunc *f, double a, double b,
+                          double abstol, double reltol, IntegralResult *res);
+
+/* Runs count independent trapezoid jobs on the context's workers, which
+ * take the next job as soon as they finish one. Jobs too large for one
+ * worker are split across all of them instead. values[i] receives the
+ * result of jobs[i]; done (may be NULL) is told about every job. */
+void integral_run_batch(IntegralCtx *ctx, const IntegralJob *jobs, long count,
+                        double *values, integral_job_fn done, void *arg);
+
+/* Trapezoid rule for expr over [a, b] with n subintervals for every p in
+ * params; values[i] receives the integral with p = params[i]. The (x, p)
+ * grid is cut into tiles that the workers share, and each tile evaluates
+ * the expression across a block of parameters at once. Returns -1 if out
+ * of memory. */
+int integral_run_sweep(IntegralCtx *ctx, const IntegralExpr *expr, double a, double b,
+                       long n, const double *params, long count, double *values);
+
+/* Quasi-Monte Carlo over the box lower[i] <= x[i] <= upper[i] in dims <=
+ * INTEGRAL_QMC_MAX_DIMS dimensions. Each of the replicates is a Sobol' point
+ * set with its own random linear scrambling and digital shift from seed, of
+ * points points (rounded up to a power of two). The workers start at their
+ * own offsets in the point stream, weighted by the context's placement.
+ * res->value is the mean over the replicates and res->error its standard
+ * error. Returns -1 on bad arguments. */
+int integral_run_qmc(IntegralCtx *ctx, const IntegralFuncNd *f, int dims,
+                     const double *lower, const double *upper, long points,
+                     int replicates, unsigned long seed, IntegralResult *res);
+
+#endif /* ifndef INTEGRAL_H */
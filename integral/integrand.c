@@ -0,0 +1,43 @@
+#include "integrand.h"
+#include "expr.h"
+#include "kernel.h"
+
+void integrand_eval(const IntegralFunc *f, const double *x, double *y, long n) {
+    if (f && f->expr) {
+        expr_eval(f->expr, x, y, n);
+        return;
+    }
+
+    integral_fn fn = (f && f->fn) ? f->fn : kernel_f;
+    for (long i = 0; i < n; i++) {
+        y[i] = fn(x[i]);
+    }
+}
+
+double integrand_sum(const IntegralFunc *f, double start, double step,
+                     long first, long count) {
+    if (f && f->expr) {
+        return expr_sum(f->expr, start, step, first, count);
+    }
+    if (f && f->fn) {
+        return kernel_sum_fn(f->fn, start, step, first, count);
+    }
+    return kernel_sum(start, step, first, count);
+}
+
+double integrand_trapezoid(const IntegralFunc *f, double start, double step,
+                           long first, long last) {
+    if (last <= first) {
+        return 0;
+    }
+    if (!f || (!f->fn && !f->expr)) {
+        return kernel_trapezoid(start, step, first, last);
+    }
+
+    double ends[2] = {start + step * first, start + step * last};
+    integrand_eval(f, ends, ends, 2);
+    double value = (ends[0] + ends[1]) / 2;
+    value += integrand_sum(f, start, step, first + 1, last - first - 1);
+
+    return value * step;
+}
@@ -0,0 +1,15 @@
+#ifndef INTEGRAND_H
+#define INTEGRAND_H
+#include "integral.h"
+
+/* Evaluation entry points shared by all integration methods. They route a
+ * NULL (built-in) integrand to the SIMD kernels, a native function to
+ * scalar loops and an expression to the block bytecode evaluator. */
+
+void integrand_eval(const IntegralFunc *f, const double *x, double *y, long n);
+double integrand_sum(const IntegralFunc *f, double start, double step,
+                     long first, long count);
+double integrand_trapezoid(const IntegralFunc *f, double start, double step,
+                           long first, long last);
+
+#endif /* ifndef INTEGRAND_H */
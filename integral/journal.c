@@ -0,0 +1,165 @@
+#include "journal.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define JOURNAL_MAGIC "INTJRNL1"
+/* A signalling NaN marks an unfinished slot: arithmetic only ever produces
+ * quiet NaNs, and an aligned 8 byte store cannot be torn by a crash, so
+ * the value itself commits the chunk. */
+#define JOURNAL_EMPTY 0x7ff4a7f1c0debad0ULL
+
+/* file layout: header, values[chunks] */
+typedef struct JournalHeader {
+    char magic[8];
+    JournalKey key;
+    int64_t chunks;
+} JournalHeader;
+
+struct Journal {
+    int fd;
+    void *map;
+    size_t size;
+    long chunks;
+    uint64_t *values;
+    long resumed;
+    int64_t interval_ns;
+    int64_t next_sync_ns;
+    long syncs;
+    int64_t sync_ns;
+};
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+Journal *journal_open(const char *path, const JournalKey *key, double interval) {
+    Journal *j = (Journal *)calloc(1, sizeof(Journal));
+    if (!j) {
+        perror("calloc");
+        return NULL;
+    }
+
+    JournalHeader want;
+    memset(&want, 0, sizeof(want));
+    memcpy(want.magic, JOURNAL_MAGIC, sizeof(want.magic));
+    /* copied bytewise so that the padding compares too */
+    memcpy(&want.key, key, sizeof(want.key));
+    want.chunks = (key->n + key->chunk_size - 1) / key->chunk_size;
+
+    j->chunks = want.chunks;
+    j->size = sizeof(JournalHeader) + want.chunks * sizeof(uint64_t);
+    j->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (j->fd < 0) {
+        perror(path);
+        goto FREE_JOURNAL;
+    }
+
+    struct stat st;
+    if (fstat(j->fd, &st) < 0) {
+        perror("fstat");
+        goto CLOSE_FD;
+    }
+    int fresh = (st.st_size == 0);
+    if (fresh && ftruncate(j->fd, j->size) < 0) {
+        perror("ftruncate");
+        goto CLOSE_FD;
+    }
+    if (!fresh && (size_t)st.st_size != j->size) {
+        fprintf(stderr, "%s: journal of a different run\n", path);
+        goto CLOSE_FD;
+    }
+
+    j->map = mmap(NULL, j->size, PROT_READ | PROT_WRITE, MAP_SHARED, j->fd, 0);
+    if (j->map == MAP_FAILED) {
+        perror("mmap");
+        goto CLOSE_FD;
+    }
+
+    j->values = (uint64_t *)((char *)j->map + sizeof(JournalHeader));
+    if (fresh) {
+        memcpy(j->map, &want, sizeof(want));
+        for (long i = 0; i < j->chunks; i++) {
+            j->values[i] = JOURNAL_EMPTY;
+        }
+    }
+    else if (memcmp(j->map, &want, sizeof(want)) != 0) {
+        fprintf(stderr, "%s: journal of a different run\n", path);
+        goto UNMAP;
+    }
+
+    for (long i = 0; i < j->chunks; i++) {
+        j->resumed += (j->values[i] != JOURNAL_EMPTY);
+    }
+    j->interval_ns = (int64_t)(interval * 1e9);
+    j->next_sync_ns = now_ns() + j->interval_ns;
+
+    return j;
+
+UNMAP:
+    munmap(j->map, j->size);
+CLOSE_FD:
+    close(j->fd);
+FREE_JOURNAL:
+    free(j);
+    return NULL;
+}
+
+static void journal_sync(Journal *j) {
+    int64_t start = now_ns();
+    msync(j->map, j->size, MS_SYNC);
+    __atomic_fetch_add(&j->syncs, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&j->sync_ns, now_ns() - start, __ATOMIC_RELAXED);
+}
+
+void journal_close(Journal *j) {
+    journal_sync(j);
+    munmap(j->map, j->size);
+    close(j->fd);
+    free(j);
+}
+
+long journal_chunks(const Journal *j) {
+    return j->chunks;
+}
+
+long journal_resumed(const Journal *j) {
+    return j->resumed;
+}
+
+long journal_syncs(const Journal *j) {
+    return j->syncs;
+}
+
+double journal_sync_seconds(const Journal *j) {
+    return j->sync_ns * 1e-9;
+}
+
+const double *journal_values(const Journal *j) {
+    return (const double *)j->values;
+}
+
+int journal_done(const Journal *j, long chunk) {
+    return __atomic_load_n(&j->values[chunk], __ATOMIC_RELAXED) != JOURNAL_EMPTY;
+}
+
+void journal_commit(Journal *j, long chunk, double value) {
+    uint64_t bits = 0;
+    memcpy(&bits, &value, sizeof(bits));
+    __atomic_store_n(&j->values[chunk], bits, __ATOMIC_RELAXED);
+
+    int64_t due = __atomic_load_n(&j->next_sync_ns, __ATOMIC_RELAXED);
+    int64_t now = now_ns();
+    if (now >= due &&
+        __atomic_compare_exchange_n(&j->next_sync_ns, &due, now + j->interval_ns, 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        journal_sync(j);
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+#include <stdint.h>
+
+/* Checkpoint journal of a blocked run, memory-mapped from a file: a slot
+ * per chunk holding its value once finished. A killed process loses
+ * nothing that was stored (the page cache keeps it); the mapping is also
+ * flushed to disk every interval seconds against machine crashes. */
+
+#define JOURNAL_TAG_LEN 64
+
+typedef struct Journal Journal;
+
+/* What the journal is for; a file written for a different run is refused.
+ * Zero the whole key before filling it in, padding included. */
+typedef struct JournalKey {
+    double a;
+    double b;
+    int64_t n;
+    int64_t chunk_size;
+    int32_t isa;
+    char tag[JOURNAL_TAG_LEN];
+} JournalKey;
+
+Journal *journal_open(const char *path, const JournalKey *key, double interval);
+/* Flushes and unmaps. */
+void journal_close(Journal *j);
+
+long journal_chunks(const Journal *j);
+/* chunks already finished when the journal was opened */
+long journal_resumed(const Journal *j);
+long journal_syncs(const Journal *j);
+double journal_sync_seconds(const Journal *j);
+
+const double *journal_values(const Journal *j);
+int journal_done(const Journal *j, long chunk);
+/* Records the value of a finished chunk; may flush. */
+void journal_commit(Journal *j, long chunk, double value);
+
+#endif /* ifndef JOURNAL_H */
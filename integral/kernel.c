@@ -0,0 +1,450 @@
+#include "kernel.h"
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KERNEL_X86
+#include <immintrin.h>
+#endif
+
+/* Mixed precision: float32 sums of blocks of MIXED_BLOCK points, every
+ * MIXED_SAMPLE-th of them checked against the double kernel. */
+#define MIXED_BLOCK 512
+#define MIXED_SAMPLE 64
+
+typedef double (*SumFn)(double start, double step, long first, long count);
+
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+
+static const char *kernel_names[KERNEL_ISA_COUNT] = {
+    "auto", "scalar", "sse2", "avx2", "avx512"
+};
+
+double kernel_f(double x) {
+    return (2 - x * x) / (4 + x);
+}
+
+static float kernel_f32(float x) {
+    return (2.0f - x * x) / (4.0f + x);
+}
+
+/* Every kernel returns sum of f(start + step * i) for first <= i < first + count.
+ * Several independent accumulators keep more than one divide in flight. */
+static double sum_scalar(double start, double step, long first, long count) {
+    double acc[4] = {0};
+    long i = 0;
+    for (; i + 4 <= count; i += 4) {
+        for (int j = 0; j < 4; j++) {
+            acc[j] += kernel_f(start + step * (first + i + j));
+        }
+    }
+    for (; i < count; i++) {
+        acc[0] += kernel_f(start + step * (first + i));
+    }
+
+    return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+}
+
+/* The float32 kernels sum one block: the points are offsets in float from
+ * the block's first point, so x itself is only rounded once. */
+static double sum_f32_scalar(double start, double step, long first, long count) {
+    const float x0 = (float)(start + step * first);
+    const float h = (float)step;
+    float acc[4] = {0};
+    /* float offsets counted up rather than converted from i, exact in a
+     * block */
+    float t[4] = {0, 1, 2, 3};
+    long i = 0;
+    for (; i + 4 <= count; i += 4) {
+        for (int j = 0; j < 4; j++) {
+            acc[j] += kernel_f32(x0 + h * t[j]);
+            t[j] += 4.0f;
+        }
+    }
+    for (; i < count; i++) {
+        acc[0] += kernel_f32(x0 + h * t[0]);
+        t[0] += 1.0f;
+    }
+
+    return ((double)acc[0] + acc[1]) + ((double)acc[2] + acc[3]);
+}
+
+#ifdef KERNEL_X86
+__attribute__((target("sse2")))
+static double sum_sse2(double start, double step, long first, long count) {
+    const __m128d two = _mm_set1_pd(2.0);
+    const __m128d four = _mm_set1_pd(4.0);
+    const __m128d vstart = _mm_set1_pd(start);
+    const __m128d vstep = _mm_set1_pd(step);
+    const __m128d inc = _mm_set1_pd(8.0);
+    __m128d idx[4];
+    __m128d acc[4];
+    for (int j = 0; j < 4; j++) {
+        idx[j] = _mm_setr_pd(first + 2 * j, first + 2 * j + 1);
+        acc[j] = _mm_setzero_pd();
+    }
+
+    long i = 0;
+    for (; i + 8 <= count; i += 8) {
+        for (int j = 0; j < 4; j++) {
+            __m128d x = _mm_add_pd(vstart, _mm_mul_pd(vstep, idx[j]));
+            __m128d num = _mm_sub_pd(two, _mm_mul_pd(x, x));
+            acc[j] = _mm_add_pd(acc[j], _mm_div_pd(num, _mm_add_pd(four, x)));
+            idx[j] = _mm_add_pd(idx[j], inc);
+        }
+    }
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(_mm_add_pd(acc[0], acc[1]),
+                                    _mm_add_pd(acc[2], acc[3])));
+    return lanes[0] + lanes[1] + sum_scalar(start, step, first + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static double sum_avx2(double start, double step, long first, long count) {
+    const __m256d two = _mm256_set1_pd(2.0);
+    const __m256d four = _mm256_set1_pd(4.0);
+    const __m256d vstart = _mm256_set1_pd(start);
+    const __m256d vstep = _mm256_set1_pd(step);
+    const __m256d inc = _mm256_set1_pd(16.0);
+    __m256d idx[4];
+    __m256d acc[4];
+    for (int j = 0; j < 4; j++) {
+        idx[j] = _mm256_setr_pd(first + 4 * j, first + 4 * j + 1,
+                                first + 4 * j + 2, first + 4 * j + 3);
+        acc[j] = _mm256_setzero_pd();
+    }
+
+    long i = 0;
+    for (; i + 16 <= count; i += 16) {
+        for (int j = 0; j < 4; j++) {
+            __m256d x = _mm256_add_pd(vstart, _mm256_mul_pd(vstep, idx[j]));
+            __m256d num = _mm256_sub_pd(two, _mm256_mul_pd(x, x));
+            acc[j] = _mm256_add_pd(acc[j],
+                                   _mm256_div_pd(num, _mm256_add_pd(four, x)));
+            idx[j] = _mm256_add_pd(idx[j], inc);
+        }
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(_mm256_add_pd(acc[0], acc[1]),
+                                          _mm256_add_pd(acc[2], acc[3])));
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) +
+           sum_scalar(start, step, first + i, count - i);
+}
+
+__attribute__((target("avx512f")))
+static double sum_avx512(double start, double step, long first, long count) {
+    const __m512d two = _mm512_set1_pd(2.0);
+    const __m512d four = _mm512_set1_pd(4.0);
+    const __m512d vstart = _mm512_set1_pd(start);
+    const __m512d vstep = _mm512_set1_pd(step);
+    const __m512d inc = _mm512_set1_pd(32.0);
+    const __m512d lane = _mm512_setr_pd(0, 1, 2, 3, 4, 5, 6, 7);
+    __m512d idx[4];
+    __m512d acc[4];
+    for (int j = 0; j < 4; j++) {
+        idx[j] = _mm512_add_pd(_mm512_set1_pd(first + 8 * j), lane);
+        acc[j] = _mm512_setzero_pd();
+    }
+
+    long i = 0;
+    for (; i + 32 <= count; i += 32) {
+        for (int j = 0; j < 4; j++) {
+            __m512d x = _mm512_add_pd(vstart, _mm512_mul_pd(vstep, idx[j]));
+            __m512d num = _mm512_sub_pd(two, _mm512_mul_pd(x, x));
+            acc[j] = _mm512_add_pd(acc[j],
+                                   _mm512_div_pd(num, _mm512_add_pd(four, x)));
+            idx[j] = _mm512_add_pd(idx[j], inc);
+        }
+    }
+
+    double value = _mm512_reduce_add_pd(_mm512_add_pd(_mm512_add_pd(acc[0], acc[1]),
+                                                      _mm512_add_pd(acc[2], acc[3])));
+    return value + sum_scalar(start, step, first + i, count - i);
+}
+
+__attribute__((target("sse2")))
+static double sum_f32_sse2(double start, double step, long first, long count) {
+    const __m128 two = _mm_set1_ps(2.0f);
+    const __m128 four = _mm_set1_ps(4.0f);
+    const __m128 x0 = _mm_set1_ps((float)(start + step * first));
+    const __m128 h = _mm_set1_ps((float)step);
+    const __m128 inc = _mm_set1_ps(8.0f);
+    __m128 idx[2] = {_mm_setr_ps(0, 1, 2, 3), _mm_setr_ps(4, 5, 6, 7)};
+    __m128 acc[2] = {_mm_setzero_ps(), _mm_setzero_ps()};
+
+    long i = 0;
+    for (; i + 8 <= count; i += 8) {
+        for (int j = 0; j < 2; j++) {
+            __m128 x = _mm_add_ps(x0, _mm_mul_ps(h, idx[j]));
+            __m128 num = _mm_sub_ps(two, _mm_mul_ps(x, x));
+            acc[j] = _mm_add_ps(acc[j], _mm_div_ps(num, _mm_add_ps(four, x)));
+            idx[j] = _mm_add_ps(idx[j], inc);
+        }
+    }
+
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_add_ps(acc[0], acc[1]));
+    return ((double)lanes[0] + lanes[1]) + ((double)lanes[2] + lanes[3]) +
+           sum_f32_scalar(start, step, first + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static double sum_f32_avx2(double start, double step, long first, long count) {
+    const __m256 two = _mm256_set1_ps(2.0f);
+    const __m256 four = _mm256_set1_ps(4.0f);
+    const __m256 x0 = _mm256_set1_ps((float)(start + step * first));
+    const __m256 h = _mm256_set1_ps((float)step);
+    const __m256 inc = _mm256_set1_ps(16.0f);
+    __m256 idx[2] = {_mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7),
+                     _mm256_setr_ps(8, 9, 10, 11, 12, 13, 14, 15)};
+    __m256 acc[2] = {_mm256_setzero_ps(), _mm256_setzero_ps()};
+
+    long i = 0;
+    for (; i + 16 <= count; i += 16) {
+        for (int j = 0; j < 2; j++) {
+            __m256 x = _mm256_add_ps(x0, _mm256_mul_ps(h, idx[j]));
+            __m256 num = _mm256_sub_ps(two, _mm256_mul_ps(x, x));
+            acc[j] = _mm256_add_ps(acc[j], _mm256_div_ps(num, _mm256_add_ps(four, x)));
+            idx[j] = _mm256_add_ps(idx[j], inc);
+        }
+    }
+
+    float lanes[8];
+    _mm256_storeu_ps(lanes, _mm256_add_ps(acc[0], acc[1]));
+    double value = 0;
+    for (int j = 0; j < 8; j++) {
+        value += lanes[j];
+    }
+    /* this runs once per block: no AVX-SSE transition into the tail */
+    _mm256_zeroupper();
+    return value + sum_f32_scalar(start, step, first + i, count - i);
+}
+
+__attribute__((target("avx512f")))
+static double sum_f32_avx512(double start, double step, long first, long count) {
+    const __m512 two = _mm512_set1_ps(2.0f);
+    const __m512 four = _mm512_set1_ps(4.0f);
+    const __m512 x0 = _mm512_set1_ps((float)(start + step * first));
+    const __m512 h = _mm512_set1_ps((float)step);
+    const __m512 inc = _mm512_set1_ps(32.0f);
+    const __m512 lane = _mm512_setr_ps(0, 1, 2, 3, 4, 5, 6, 7,
+                                       8, 9, 10, 11, 12, 13, 14, 15);
+    __m512 idx[2] = {lane, _mm512_add_ps(lane, _mm512_set1_ps(16.0f))};
+    __m512 acc[2] = {_mm512_setzero_ps(), _mm512_setzero_ps()};
+
+    long i = 0;
+    for (; i + 32 <= count; i += 32) {
+        for (int j = 0; j < 2; j++) {
+            __m512 x = _mm512_add_ps(x0, _mm512_mul_ps(h, idx[j]));
+            __m512 num = _mm512_sub_ps(two, _mm512_mul_ps(x, x));
+            acc[j] = _mm512_add_ps(acc[j], _mm512_div_ps(num, _mm512_add_ps(four, x)));
+            idx[j] = _mm512_add_ps(idx[j], inc);
+        }
+    }
+
+    double value = _mm512_reduce_add_ps(_mm512_add_ps(acc[0], acc[1]));
+    _mm256_zeroupper();
+    return value + sum_f32_scalar(start, step, first + i, count - i);
+}
+#endif
+
+static SumFn sum_kernel = sum_scalar;
+static SumFn sum_f32_kernel = sum_f32_scalar;
+static KernelIsa current_isa = KERNEL_SCALAR;
+
+static int isa_supported(KernelIsa isa) {
+#ifdef KERNEL_X86
+    __builtin_cpu_init();
+    switch (isa) {
+    case KERNEL_SCALAR:
+        return 1;
+    case KERNEL_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case KERNEL_AVX2:
+        return __builtin_cpu_supports("avx2");
+    case KERNEL_AVX512:
+        return __builtin_cpu_supports("avx512f");
+    default:
+        return 0;
+    }
+#else
+    return isa == KERNEL_SCALAR;
+#endif
+}
+
+int kernel_init(KernelIsa isa) {
+    if (isa == KERNEL_AUTO) {
+        isa = KERNEL_SCALAR;
+        for (int i = KERNEL_ISA_COUNT - 1; i > KERNEL_SCALAR; i--) {
+            if (isa_supported(i)) {
+                isa = i;
+                break;
+            }
+        }
+    }
+    else if (!isa_supported(isa)) {
+        fprintf(stderr, "kernel %s is not supported by this CPU\n",
+                kernel_name(isa));
+        return -1;
+    }
+
+    switch (isa) {
+#ifdef KERNEL_X86
+    case KERNEL_SSE2:
+        sum_kernel = sum_sse2;
+        sum_f32_kernel = sum_f32_sse2;
+        break;
+    case KERNEL_AVX2:
+        sum_kernel = sum_avx2;
+        sum_f32_kernel = sum_f32_avx2;
+        break;
+    case KERNEL_AVX512:
+        sum_kernel = sum_avx512;
+        sum_f32_kernel = sum_f32_avx512;
+        break;
+#endif
+    default:
+        sum_kernel = sum_scalar;
+        sum_f32_kernel = sum_f32_scalar;
+        break;
+    }
+    current_isa = isa;
+
+    return 0;
+}
+
+KernelIsa kernel_isa(void) {
+    return current_isa;
+}
+
+int kernel_supported(KernelIsa isa) {
+    return isa == KERNEL_AUTO || isa_supported(isa);
+}
+
+const char *kernel_name(KernelIsa isa) {
+    if (isa < 0 || isa >= KERNEL_ISA_COUNT) {
+        return "unknown";
+    }
+    return kernel_names[isa];
+}
+
+int kernel_parse_isa(const char *str, KernelIsa *isa) {
+    for (int i = 0; i < KERNEL_ISA_COUNT; i++) {
+        if (strcmp(str, kernel_names[i]) == 0) {
+            *isa = i;
+            return 0;
+        }
+    }
+
+    fprintf(stderr, "unknown kernel: %s\n", str);
+    return -1;
+}
+
+double kernel_sum(double start, double step, long first, long count) {
+    return sum_kernel(start, step, first, count);
+}
+
+double kernel_sum_fn(double (*f)(double), double start, double step,
+                     long first, long count) {
+    double acc[4] = {0};
+    long i = 0;
+    for (; i + 4 <= count; i += 4) {
+        for (int j = 0; j < 4; j++) {
+            acc[j] += f(start + step * (first + i + j));
+        }
+    }
+    for (; i < count; i++) {
+        acc[0] += f(start + step * (first + i));
+    }
+
+    return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+}
+
+double kernel_trapezoid(double start, double step, long first, long last) {
+    if (last <= first) {
+        return 0;
+    }
+
+    double value = (kernel_f(start + step * first) + kernel_f(start + step * last)) / 2;
+    value += sum_kernel(start, step, first + 1, last - first - 1);
+
+    return value * step;
+}
+
+/* Neumaier's variant of Kahan summation */
+static void add_compensated(KernelMixed *m, double x) {
+    double t = m->sum + x;
+    if (fabs(m->sum) >= fabs(x)) {
+        m->comp += (m->sum - t) + x;
+    }
+    else {
+        m->comp += (x - t) + m->sum;
+    }
+    m->sum = t;
+}
+
+void kernel_sum_mixed(double start, double step, long first, long count, KernelMixed *m) {
+    long i = first;
+    long last = first + count;
+    while (i < last) {
+        /* blocks are cut at global multiples, so the same points end up
+         * in the same float sums whatever the partition */
+        long block = i / MIXED_BLOCK;
+        long n = MIN((block + 1) * MIXED_BLOCK, last) - i;
+        double value = sum_f32_kernel(start, step, i, n);
+        add_compensated(m, value);
+        m->blocks++;
+        if (block % MIXED_SAMPLE == 0) {
+            double d = sum_kernel(start, step, i, n) - value;
+            m->sampled++;
+            m->diff += d;
+            m->diff2 += d * d;
+        }
+        i += n;
+    }
+}
+
+void kernel_mixed_merge(KernelMixed *into, const KernelMixed *from) {
+    add_compensated(into, from->sum);
+    add_compensated(into, from->comp);
+    into->blocks += from->blocks;
+    into->sampled += from->sampled;
+    into->diff += from->diff;
+    into->diff2 += from->diff2;
+}
+
+double kernel_mixed_value(const KernelMixed *m) {
+    return m->sum + m->comp;
+}
+
+double kernel_mixed_error(const KernelMixed *m) {
+    if (m->sampled < 2) {
+        /* too few samples for a spread: the a priori float32 bound */
+        return fabs(kernel_mixed_value(m)) * FLT_EPSILON;
+    }
+    /* the bias the samples show over all blocks, plus twice the standard
+     * error of extrapolating it from the sample */
+    double mean = m->diff / m->sampled;
+    double var = m->diff2 / m->sampled - mean * mean;
+    return fabs(mean * m->blocks) +
+           2 * m->blocks * sqrt((var > 0 ? var : 0) / m->sampled);
+}
+
+double kernel_trapezoid_mixed(double start, double step, long first, long last,
+                              double *error) {
+    *error = 0;
+    if (last <= first) {
+        return 0;
+    }
+
+    KernelMixed m = {0};
+    kernel_sum_mixed(start, step, first + 1, last - first - 1, &m);
+    double ends = (kernel_f(start + step * first) + kernel_f(start + step * last)) / 2;
+    *error = kernel_mixed_error(&m) * step;
+
+    return (kernel_mixed_value(&m) + ends) * step;
+}
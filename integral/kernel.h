@@ -0,0 +1,55 @@
+#ifndef KERNEL_H
+#define KERNEL_H
+
+typedef enum KernelIsa {
+    KERNEL_AUTO = 0,
+    KERNEL_SCALAR,
+    KERNEL_SSE2,
+    KERNEL_AVX2,
+    KERNEL_AVX512,
+    KERNEL_ISA_COUNT
+} KernelIsa;
+
+/* Picks the widest kernel supported by the CPU (KERNEL_AUTO) or forces one.
+ * Returns -1 if the requested ISA is not available. */
+int kernel_init(KernelIsa isa);
+KernelIsa kernel_isa(void);
+int kernel_supported(KernelIsa isa);
+const char *kernel_name(KernelIsa isa);
+int kernel_parse_isa(const char *str, KernelIsa *isa);
+
+double kernel_f(double x);
+
+/* Sum of f(start + step * i) for first <= i < first + count. */
+double kernel_sum(double start, double step, long first, long count);
+double kernel_sum_fn(double (*f)(double), double start, double step,
+                     long first, long count);
+
+/* Composite trapezoid rule over the grid points x_i = start + step * i,
+ * first <= i <= last. */
+double kernel_trapezoid(double start, double step, long first, long last);
+
+/* Mixed precision: the built-in integrand evaluated in float32 lanes, one
+ * block of points at a time, with the block sums added in float64 with
+ * compensation. A sample of the blocks is summed in double as well, and
+ * their differences give an a posteriori estimate of the precision lost. */
+typedef struct KernelMixed {
+    double sum;
+    double comp;        /* compensation term of sum */
+    long blocks;
+    long sampled;       /* blocks also summed in double */
+    double diff;        /* sum of their double - float32 differences */
+    double diff2;       /* and of the squares */
+} KernelMixed;
+
+/* Adds f(start + step * i), first <= i < first + count, into *m. */
+void kernel_sum_mixed(double start, double step, long first, long count, KernelMixed *m);
+void kernel_mixed_merge(KernelMixed *into, const KernelMixed *from);
+double kernel_mixed_value(const KernelMixed *m);
+/* Estimated absolute error of the value, about 95% confidence. */
+double kernel_mixed_error(const KernelMixed *m);
+/* kernel_trapezoid in mixed precision; *error receives the estimate. */
+double kernel_trapezoid_mixed(double start, double step, long first, long last,
+                              double *error);
+
+#endif /* ifndef KERNEL_H */
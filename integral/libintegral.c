@@ -0,0 +1,664 @@
+#include "integral.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "batch.h"
+#include "calib.h"
+#include "cpuinfo.h"
+#include "expr.h"
+#include "gk.h"
+#include "grid.h"
+#include "integrand.h"
+#include "journal.h"
+#include "kernel.h"
+#include "mixed.h"
+#include "placement.h"
+#include "pool.h"
+#include "qmc.h"
+#include "romberg.h"
+#include "rule.h"
+#include "sched.h"
+#include "sweep.h"
+#include "tanhsinh.h"
+
+#define DEFAULT_CHUNK_SIZE (1L << 18)
+/* fixed blocking of the reproducible mode, independent of the chunk size */
+#define REPRO_BLOCK (1L << 16)
+#define PAIRWISE_LEAF 8
+#define TASK_CHUNKS_PER_THREAD 256
+#define CACHE_LINE 64
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+
+/* A logical task of integral_run_tasks: a range of subintervals that any of
+ * the threads may run. */
+typedef struct Task {
+    long first;
+    long last;
+    double result;
+} Task;
+
+typedef struct TaskSet {
+    const IntegralFunc *f;
+    double start;
+    double step;
+    Task *tasks;
+} TaskSet;
+
+typedef struct WorkerSlot {
+    double result;
+} __attribute__((aligned(CACHE_LINE))) WorkerSlot;
+
+/* The workers of a NUMA node are consecutive; the last one to finish adds
+ * up their slots, so only one value per node crosses the interconnect. */
+typedef struct NodeSlot {
+    long first;
+    long last;
+    long pending;
+    double result;
+} __attribute__((aligned(CACHE_LINE))) NodeSlot;
+
+typedef enum JobKind {
+    JOB_TRAPEZOID = 0,
+    JOB_SUM,
+    JOB_RANGE
+} JobKind;
+
+typedef struct Job {
+    JobKind kind;
+    const IntegralFunc *f;
+    double start;
+    double step;
+    grid_range_fn range;
+    void *arg;
+} Job;
+
+struct IntegralCtx {
+    long threads;
+    long chunk_size;
+    int *cpus;
+    double *weights;
+    int *nodes;
+    int *llcs;
+    int pinned;
+    Pool *pool;
+    Scheduler *sched;
+    WorkerSlot **slots;     /* each allocated by its own worker */
+    NodeSlot *node_slots;
+    long node_count;
+    long *node_of;      /* each worker's index into node_slots */
+    Job job;
+    int reproducible;
+    double *blocks;     /* reproducible mode: the value of every chunk */
+    long blocks_size;
+    Journal *journal;   /* keeps the chunk values instead, when set */
+};
+
+/* Stable reorder of the workers by NUMA node and then by last-level cache,
+ * so that the workers of a node, and within it those sharing an L3, get
+ * neighbouring ranges and a contiguous run of slots. */
+static void group_workers(IntegralCtx *ctx) {
+    long n = 0;
+    int *cpus = (int *)malloc(sizeof(int) * ctx->threads);
+    double *weights = (double *)malloc(sizeof(double) * ctx->threads);
+    if (!cpus || !weights) {
+        free(cpus);
+        free(weights);
+        return;
+    }
+
+    for (long node = 0; node < (long)cpuinfo_getnodes(); node++) {
+        for (long llc = 0; llc < (long)cpuinfo_getllcs(); llc++) {
+            for (long i = 0; i < ctx->threads; i++) {
+                if (cpuinfo_getnode(ctx->cpus[i]) == node &&
+                    cpuinfo_getllc(ctx->cpus[i]) == llc) {
+                    cpus[n] = ctx->cpus[i];
+                    weights[n] = ctx->weights[i];
+                    n++;
+                }
+            }
+        }
+    }
+
+    if (n == ctx->threads) {
+        memcpy(ctx->cpus, cpus, sizeof(int) * n);
+        memcpy(ctx->weights, weights, sizeof(double) * n);
+        for (long i = 0; i < n; i++) {
+            ctx->nodes[i] = cpuinfo_getnode(cpus[i]);
+            ctx->llcs[i] = cpuinfo_getllc(cpus[i]);
+        }
+    }
+    free(cpus);
+    free(weights);
+}
+
+/* One slot per run of workers on the same node, so that nodes without
+ * workers get none; the workers are grouped by node when pinned, and the
+ * runs are still correct, only more of them, when they are not. */
+static int plan_node_slots(IntegralCtx *ctx) {
+    ctx->node_count = 0;
+    for (long i = 0; i < ctx->threads; i++) {
+        ctx->node_count += (i == 0 || ctx->nodes[i] != ctx->nodes[i - 1]);
+    }
+    ctx->node_of = (long *)malloc(sizeof(long) * ctx->threads);
+    if (!ctx->node_of ||
+        posix_memalign((void **)&ctx->node_slots, CACHE_LINE,
+                       sizeof(NodeSlot) * ctx->node_count) != 0) {
+        ctx->node_slots = NULL;
+        return -1;
+    }
+    memset(ctx->node_slots, 0, sizeof(NodeSlot) * ctx->node_count);
+
+    long slot = -1;
+    for (long i = 0; i < ctx->threads; i++) {
+        if (i == 0 || ctx->nodes[i] != ctx->nodes[i - 1]) {
+            ctx->node_slots[++slot].first = i;
+        }
+        ctx->node_slots[slot].last = i + 1;
+        ctx->node_of[i] = slot;
+    }
+    return 0;
+}
+
+/* First touch from the pinned worker puts its slot on its own node. */
+static void alloc_slot(void *arg, long worker) {
+    IntegralCtx *ctx = (IntegralCtx *)arg;
+    WorkerSlot *slot = NULL;
+    if (posix_memalign((void **)&slot, CACHE_LINE, sizeof(WorkerSlot)) == 0) {
+        slot->result = 0;
+    }
+    else {
+        slot = NULL;
+    }
+    ctx->slots[worker] = slot;
+}
+
+static void free_slots(IntegralCtx *ctx) {
+    if (!ctx->slots) {
+        return;
+    }
+    for (long i = 0; i < ctx->threads; i++) {
+        free(ctx->slots[i]);
+    }
+    free(ctx->slots);
+}
+
+IntegralExpr *integral_expr_compile(const char *src, char *err, size_t errlen) {
+    return expr_compile(src, err, errlen);
+}
+
+void integral_expr_free(IntegralExpr *expr) {
+    expr_free(expr);
+}
+
+void integral_expr_set_param(IntegralExpr *expr, double p) {
+    expr_set_param(expr, p);
+}
+
+IntegralCtx *integral_ctx_create(long threads, IntegralPlacement placement) {
+    static const PlacementPolicy policies[] = {
+        [INTEGRAL_PLACE_CORES] = PLACEMENT_SCATTER,
+        [INTEGRAL_PLACE_NONE] = PLACEMENT_NONE,
+        [INTEGRAL_PLACE_COMPACT] = PLACEMENT_COMPACT,
+        [INTEGRAL_PLACE_PHYSICAL] = PLACEMENT_PHYSICAL,
+        [INTEGRAL_PLACE_SMT] = PLACEMENT_SMT
+    };
+    if (threads < 1) {
+        fprintf(stderr, "integral_ctx_create: threads < 1\n");
+        return NULL;
+    }
+
+    int *cpus = (int *)malloc(sizeof(int) * threads);
+    if (!cpus) {
+        return NULL;
+    }
+    Placement p = {policies[placement], 0, {0}, 0};
+    if (p.policy != PLACEMENT_NONE) {
+        cpuinfo_parse();
+    }
+    placement_plan(&p, threads, cpus, NULL);
+
+    IntegralCtx *ctx = integral_ctx_create_cpus(threads, cpus);
+    free(cpus);
+    return ctx;
+}
+
+IntegralCtx *integral_ctx_create_cpus(long threads, const int *cpus) {
+    if (threads < 1) {
+        fprintf(stderr, "integral_ctx_create: threads < 1\n");
+        return NULL;
+    }
+
+    IntegralCtx *ctx = (IntegralCtx *)calloc(1, sizeof(IntegralCtx));
+    if (!ctx) {
+        return NULL;
+    }
+    ctx->threads = threads;
+    ctx->chunk_size = DEFAULT_CHUNK_SIZE;
+
+    ctx->cpus = (int *)calloc(threads, sizeof(int));
+    ctx->weights = (double *)calloc(threads, sizeof(double));
+    ctx->nodes = (int *)calloc(threads, sizeof(int));
+    ctx->llcs = (int *)calloc(threads, sizeof(int));
+    ctx->slots = (WorkerSlot **)calloc(threads, sizeof(WorkerSlot *));
+    if (!ctx->cpus || !ctx->weights || !ctx->nodes || !ctx->llcs || !ctx->slots) {
+        goto FREE_CTX;
+    }
+
+    memcpy(ctx->cpus, cpus, sizeof(int) * threads);
+    placement_weights(ctx->cpus, threads, ctx->weights);
+    ctx->pinned = 1;
+    for (long i = 0; i < threads; i++) {
+        ctx->pinned &= (cpus[i] >= 0);
+    }
+    if (ctx->pinned) {
+        cpuinfo_parse();
+        group_workers(ctx);
+    }
+
+    if (plan_node_slots(ctx) < 0) {
+        goto FREE_CTX;
+    }
+
+    ctx->sched = sched_new(threads, 0, ctx->chunk_size);
+    if (!ctx->sched) {
+        goto FREE_CTX;
+    }
+    sched_set_nodes(ctx->sched, ctx->nodes);
+    sched_set_llcs(ctx->sched, ctx->llcs);
+
+    ctx->pool = pool_new(threads, ctx->cpus);
+    if (!ctx->pool) {
+        goto FREE_SCHED;
+    }
+
+    pool_run(ctx->pool, alloc_slot, ctx);
+    for (long i = 0; i < threads; i++) {
+        if (!ctx->slots[i]) {
+            goto FREE_POOL;
+        }
+    }
+
+    return ctx;
+
+FREE_POOL:
+    pool_delete(ctx->pool);
+FREE_SCHED:
+    sched_delete(ctx->sched);
+FREE_CTX:
+    free_slots(ctx);
+    free(ctx->node_slots);
+    free(ctx->node_of);
+    free(ctx->llcs);
+    free(ctx->nodes);
+    free(ctx->weights);
+    free(ctx->cpus);
+    free(ctx);
+    return NULL;
+}
+
+void integral_ctx_destroy(IntegralCtx *ctx) {
+    pool_delete(ctx->pool);
+    sched_delete(ctx->sched);
+    free(ctx->blocks);
+    free_slots(ctx);
+    free(ctx->node_slots);
+    free(ctx->node_of);
+    free(ctx->llcs);
+    free(ctx->nodes);
+    free(ctx->weights);
+    free(ctx->cpus);
+    free(ctx);
+}
+
+long integral_ctx_threads(const IntegralCtx *ctx) {
+    return ctx->threads;
+}
+
+void integral_ctx_set_chunk(IntegralCtx *ctx, long chunk_size) {
+    ctx->chunk_size = chunk_size;
+}
+
+void integral_ctx_set_reproducible(IntegralCtx *ctx, int reproducible) {
+    ctx->reproducible = reproducible;
+}
+
+int integral_ctx_calibrate(IntegralCtx *ctx, const char *path, double *rates) {
+    if (!ctx->pinned) {
+        fprintf(stderr, "integral_ctx_calibrate: workers are not pinned\n");
+        return -1;
+    }
+
+    double *measured = rates;
+    if (!measured) {
+        measured = (double *)malloc(sizeof(double) * ctx->threads);
+        if (!measured) {
+            return -1;
+        }
+    }
+
+    const char *isa = kernel_name(kernel_isa());
+    int cached = path && calib_load(path, isa, ctx->cpus, ctx->threads, measured) == 0;
+    if (!cached) {
+        calib_measure(ctx->pool, CALIB_SECONDS, measured);
+        if (path) {
+            calib_save(path, isa, ctx->cpus, ctx->threads, measured);
+        }
+    }
+
+    double total = 0;
+    for (long i = 0; i < ctx->threads; i++) {
+        total += measured[i];
+    }
+    for (long i = 0; i < ctx->threads; i++) {
+        ctx->weights[i] = measured[i] / total;
+    }
+
+    if (measured != rates) {
+        free(measured);
+    }
+    return cached;
+}
+
+void integral_ctx_stats(const IntegralCtx *ctx, long worker, IntegralStats *stats) {
+    const SchedStats *st = sched_stats(ctx->sched, worker);
+    stats->executed = st->executed;
+    stats->stolen = st->stolen;
+    stats->steals = st->steals;
+    stats->remote = st->remote;
+}
+
+void integral_ctx_set_trace(IntegralCtx *ctx, Trace *trace) {
+    pool_set_trace(ctx->pool, trace);
+}
+
+static double run_piece(const Job *job, long first, long count) {
+    if (job->kind == JOB_SUM) {
+        return integrand_sum(job->f, job->start, job->step, first, count);
+    }
+    if (job->kind == JOB_RANGE) {
+        return job->range(job->arg, first, count);
+    }
+    return integrand_trapezoid(job->f, job->start, job->step, first, first + count);
+}
+
+static void run_worker(void *arg, long worker) {
+    IntegralCtx *ctx = (IntegralCtx *)arg;
+    const Job *job = &ctx->job;
+
+    double value = 0;
+    long first = 0;
+    long count = 0;
+    while (sched_next(ctx->sched, worker, &first, &count) == 0) {
+        value += run_piece(job, first, count);
+    }
+    ctx->slots[worker]->result = value;
+
+    NodeSlot *node = &ctx->node_slots[ctx->node_of[worker]];
+    if (__atomic_sub_fetch(&node->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+        double sum = 0;
+        for (long i = node->first; i < node->last; i++) {
+            sum += ctx->slots[i]->result;
+        }
+        node->result = sum;
+    }
+}
+
+/* Every chunk's value goes to its own slot, so nothing depends on which
+ * worker ran it or when. */
+static void run_worker_blocks(void *arg, long worker) {
+    IntegralCtx *ctx = (IntegralCtx *)arg;
+    long first = 0;
+    long count = 0;
+    while (sched_next(ctx->sched, worker, &first, &count) == 0) {
+        long chunk = sched_chunk_of(ctx->sched, first);
+        if (!ctx->journal) {
+            ctx->blocks[chunk] = run_piece(&ctx->job, first, count);
+        }
+        else if (!journal_done(ctx->journal, chunk)) {
+            journal_commit(ctx->journal, chunk, run_piece(&ctx->job, first, count));
+        }
+    }
+}
+
+/* The tree's shape depends only on n. */
+static double pairwise_sum(const double *v, long n) {
+    if (n <= PAIRWISE_LEAF) {
+        double value = 0;
+        for (long i = 0; i < n; i++) {
+            value += v[i];
+        }
+        return value;
+    }
+    long half = n / 2;
+    return pairwise_sum(v, half) + pairwise_sum(v + half, n - half);
+}
+
+static double run_job(IntegralCtx *ctx, long n, long chunk_size) {
+    if (ctx->reproducible) {
+        /* range jobs choose a chunk size that does not depend on the
+         * context; the grid sums fall back to the fixed blocking */
+        if (ctx->job.kind != JOB_RANGE) {
+            chunk_size = REPRO_BLOCK;
+        }
+        long chunks = (n + chunk_size - 1) / chunk_size;
+        if (!ctx->journal && chunks > ctx->blocks_size) {
+            /* fresh pages rather than realloc's copy, so that the workers
+             * first touch their own ranges of the array */
+            free(ctx->blocks);
+            ctx->blocks = NULL;
+            ctx->blocks_size = 0;
+            double *blocks = (double *)malloc(sizeof(double) * chunks);
+            if (!blocks) {
+                fprintf(stderr, "run_job: out of memory\n");
+                return NAN;
+            }
+            ctx->blocks = blocks;
+            ctx->blocks_size = chunks;
+        }
+    }
+
+    sched_reset(ctx->sched, n, chunk_size);
+    double weight = 0;
+    long first = 0;
+    for (long i = 0; i < ctx->threads; i++) {
+        weight += ctx->weights[i];
+        long last = (i == ctx->threads - 1) ? n : (long)(weight * n);
+        sched_assign(ctx->sched, i, sched_chunk_of(ctx->sched, first),
+                     sched_chunk_of(ctx->sched, last));
+        first = last;
+    }
+
+    if (ctx->reproducible) {
+        pool_run(ctx->pool, run_worker_blocks, ctx);
+        return pairwise_sum(ctx->journal ? journal_values(ctx->journal) : ctx->blocks,
+                            sched_chunks(ctx->sched));
+    }
+
+    for (long node = 0; node < ctx->node_count; node++) {
+        ctx->node_slots[node].pending = ctx->node_slots[node].last -
+                                        ctx->node_slots[node].first;
+    }
+    pool_run(ctx->pool, run_worker, ctx);
+
+    double value = 0;
+    for (long node = 0; node < ctx->node_count; node++) {
+        value += ctx->node_slots[node].result;
+    }
+
+    return value;
+}
+
+double integral_run(IntegralCtx *ctx, const IntegralFunc *f, double a, double b, long n) {
+    ctx->job.kind = JOB_TRAPEZOID;
+    ctx->job.f = f;
+    ctx->job.start = a;
+    ctx->job.step = (b - a) / n;
+
+    return run_job(ctx, n, ctx->chunk_size);
+}
+
+double integral_run_rule(IntegralCtx *ctx, const IntegralFunc *f, IntegralRule rule,
+                         int order, double a, double b, long n) {
+    return rule_integrate(ctx, f, rule, order, a, b, n);
+}
+
+int integral_run_mixed(IntegralCtx *ctx, double a, double b, long n, IntegralResult *res) {
+    return mixed_integrate(ctx, a, b, n, res);
+}
+
+static double run_tasks(void *arg, long first, long count) {
+    TaskSet *set = (TaskSet *)arg;
+    double value = 0;
+    for (Task *t = set->tasks + first; t < set->tasks + first + count; t++) {
+        t->result = integrand_trapezoid(set->f, set->start, set->step, t->first, t->last);
+        value += t->result;
+    }
+    return value;
+}
+
+double integral_run_tasks(IntegralCtx *ctx, const IntegralFunc *f, double a, double b,
+                          long n, long tasks) {
+    if (tasks < 1 || tasks > n) {
+        fprintf(stderr, "integral_run_tasks: need 1 <= tasks <= n\n");
+        return NAN;
+    }
+
+    TaskSet set = {f, a, (b - a) / n, (Task *)malloc(sizeof(Task) * tasks)};
+    if (!set.tasks) {
+        perror("malloc");
+        return NAN;
+    }
+    for (long i = 0; i < tasks; i++) {
+        set.tasks[i].first = (long)((double)n * i / tasks);
+        set.tasks[i].last = (long)((double)n * (i + 1) / tasks);
+    }
+    set.tasks[tasks - 1].last = n;
+
+    /* a chunk is a handful of tasks, enough to keep the scheduler off the
+     * profile but with its descriptors in half the L1; the results are
+     * added in task order, so the value depends on the task count only */
+    long chunk = tasks / (ctx->threads * TASK_CHUNKS_PER_THREAD);
+    long l1_tasks = cpuinfo_getcachesize(ctx->cpus[0], 1) / 2 / sizeof(Task);
+    if (l1_tasks > 0 && chunk > l1_tasks) {
+        chunk = l1_tasks;
+    }
+    grid_run(ctx, run_tasks, &set, tasks, (chunk > 1) ? chunk : 1);
+    double value = 0;
+    for (long i = 0; i < tasks; i++) {
+        value += set.tasks[i].result;
+    }
+
+    free(set.tasks);
+    return value;
+}
+
+int integral_run_journaled(IntegralCtx *ctx, const IntegralFunc *f, const char *tag,
+                           double a, double b, long n, const char *path, double interval,
+                           double *value, IntegralJournalStats *stats) {
+    JournalKey key;
+    memset(&key, 0, sizeof(key));
+    key.a = a;
+    key.b = b;
+    key.n = n;
+    key.chunk_size = REPRO_BLOCK;
+    key.isa = kernel_isa();
+    strncpy(key.tag, tag ? tag : "", sizeof(key.tag) - 1);
+
+    Journal *journal = journal_open(path, &key, interval);
+    if (!journal) {
+        return -1;
+    }
+
+    int reproducible = ctx->reproducible;
+    ctx->reproducible = 1;
+    ctx->journal = journal;
+    *value = integral_run(ctx, f, a, b, n);
+    ctx->journal = NULL;
+    ctx->reproducible = reproducible;
+
+    if (stats) {
+        stats->chunks = journal_chunks(journal);
+        stats->resumed = journal_resumed(journal);
+        stats->syncs = journal_syncs(journal);
+        stats->sync_seconds = journal_sync_seconds(journal);
+    }
+    journal_close(journal);
+    return 0;
+}
+
+double grid_sum(IntegralCtx *ctx, const IntegralFunc *f, double start, double step, long n) {
+    /* not worth waking the pool for less than a chunk */
+    if (n <= (ctx->reproducible ? REPRO_BLOCK : ctx->chunk_size)) {
+        return integrand_sum(f, start, step, 0, n);
+    }
+
+    ctx->job.kind = JOB_SUM;
+    ctx->job.f = f;
+    ctx->job.start = start;
+    ctx->job.step = step;
+
+    return run_job(ctx, n, ctx->chunk_size);
+}
+
+void integral_run_batch(IntegralCtx *ctx, const IntegralJob *jobs, long count,
+                        double *values, integral_job_fn done, void *arg) {
+    /* a job bigger than one chunk per worker is worth the whole pool; in
+     * the reproducible mode anything over one block must take the blocked
+     * path whatever the worker count */
+    long max_n = ctx->reproducible ? REPRO_BLOCK : ctx->chunk_size * ctx->threads;
+    for (long i = 0; i < count; i++) {
+        if (jobs[i].n <= max_n) {
+            continue;
+        }
+        struct timespec start;
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        values[i] = integral_run(ctx, jobs[i].f, jobs[i].a, jobs[i].b, jobs[i].n);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (done) {
+            done(i, values[i], (end.tv_sec - start.tv_sec) +
+                               (end.tv_nsec - start.tv_nsec) * 1e-9, arg);
+        }
+    }
+
+    batch_run(ctx->pool, jobs, count, max_n, values, done, arg);
+}
+
+int integral_run_sweep(IntegralCtx *ctx, const IntegralExpr *expr, double a, double b,
+                       long n, const double *params, long count, double *values) {
+    return sweep_run(ctx->pool, expr, a, b, n, params, count, values);
+}
+
+double grid_run(IntegralCtx *ctx, grid_range_fn range, void *arg, long n, long chunk_size) {
+    ctx->job.kind = JOB_RANGE;
+    ctx->job.range = range;
+    ctx->job.arg = arg;
+
+    return run_job(ctx, n, chunk_size);
+}
+
+int integral_run_qmc(IntegralCtx *ctx, const IntegralFuncNd *f, int dims,
+                     const double *lower, const double *upper, long points,
+                     int replicates, unsigned long seed, IntegralResult *res) {
+    return qmc_integrate(ctx, f, dims, lower, upper, points, replicates, seed, res);
+}
+
+int integral_run_adaptive(IntegralCtx *ctx, const IntegralFunc *f, double a, double b,
+                          double abstol, double reltol, IntegralResult *res) {
+    return gk_integrate(ctx->pool, f, a, b, abstol, reltol, res);
+}
+
+int integral_run_tanhsinh(IntegralCtx *ctx, const IntegralFunc *f, double a, double b,
+                          double abstol, double reltol, IntegralResult *res) {
+    return tanhsinh_integrate(ctx, f, a, b, abstol, reltol, res);
+}
+
+int integral_run_romberg(IntegralCtx *ctx, const IntegralFunc *f, double a, double b,
+                         double abstol, double reltol, double budget,
+                         integral_progress_fn progress, void *arg,
+                         IntegralResult *res) {
+    return romberg_integrate(ctx, f, a, b, abstol, reltol, budget,
+                             progress, arg, res);
+}
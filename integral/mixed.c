@@ -0,0 +1,43 @@
+#include "mixed.h"
+#include <math.h>
+#include <pthread.h>
+#include "grid.h"
+#include "kernel.h"
+
+/* a multiple of the kernel's float32 block, and fixed for the
+ * reproducible mode */
+#define MIXED_CHUNK (1L << 18)
+
+typedef struct Mixed {
+    double start;
+    double step;
+    pthread_mutex_t lock;
+    KernelMixed total;  /* the error statistics of all chunks */
+} Mixed;
+
+/* Interior point i + 1 of the grid for every i of the range. */
+static double run_chunk(void *arg, long first, long count) {
+    Mixed *m = (Mixed *)arg;
+    KernelMixed part = {0};
+    kernel_sum_mixed(m->start, m->step, first + 1, count, &part);
+
+    pthread_mutex_lock(&m->lock);
+    kernel_mixed_merge(&m->total, &part);
+    pthread_mutex_unlock(&m->lock);
+    return kernel_mixed_value(&part);
+}
+
+int mixed_integrate(IntegralCtx *ctx, double a, double b, long n, IntegralResult *res) {
+    Mixed m = {a, (b - a) / n, PTHREAD_MUTEX_INITIALIZER, {0}};
+
+    /* the chunk values go through grid_run's own summation, which keeps
+     * the reproducible mode's fixed order */
+    double interior = (n > 1) ? grid_run(ctx, run_chunk, &m, n - 1, MIXED_CHUNK) : 0;
+    double ends = (kernel_f(a) + kernel_f(b)) / 2;
+    pthread_mutex_destroy(&m.lock);
+
+    res->value = (interior + ends) * m.step;
+    res->error = kernel_mixed_error(&m.total) * fabs(m.step);
+    res->evaluations = n + 1;
+    return isnan(res->value) ? -1 : 0;
+}
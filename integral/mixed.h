@@ -0,0 +1,7 @@
+#ifndef MIXED_H
+#define MIXED_H
+#include "integral.h"
+
+int mixed_integrate(IntegralCtx *ctx, double a, double b, long n, IntegralResult *res);
+
+#endif /* ifndef MIXED_H */
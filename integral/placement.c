@@ -0,0 +1,238 @@
+#define _GNU_SOURCE
+#include "placement.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include "cpuinfo.h"
+
+static const char *const names[] = {
+    "scatter", "compact", "physical", "smt", "list", "none"
+};
+
+static int compare_ints(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+const char *placement_name(PlacementPolicy policy) {
+    return names[policy];
+}
+
+/* "0,2,4-7" */
+static int parse_list(const char *str, Placement *p) {
+    p->list_len = 0;
+    while (*str) {
+        char *end = NULL;
+        long first = strtol(str, &end, 10);
+        long last = first;
+        if (end == str || first < 0) {
+            return -1;
+        }
+        if (*end == '-') {
+            str = end + 1;
+            last = strtol(str, &end, 10);
+            if (end == str || last < first) {
+                return -1;
+            }
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            if (p->list_len == PLACEMENT_MAX_CPUS) {
+                return -1;
+            }
+            p->list[p->list_len++] = cpu;
+        }
+        if (*end == ',') {
+            end++;
+        }
+        else if (*end != '\0') {
+            return -1;
+        }
+        str = end;
+    }
+    return (p->list_len > 0) ? 0 : -1;
+}
+
+int placement_parse(const char *str, Placement *p) {
+    if (strncmp(str, "list:", 5) == 0) {
+        if (parse_list(str + 5, p) < 0) {
+            fprintf(stderr, "bad CPU list: %s\n", str + 5);
+            return -1;
+        }
+        p->policy = PLACEMENT_LIST;
+        return 0;
+    }
+    if (strcmp(str, "cores") == 0) {
+        p->policy = PLACEMENT_SCATTER;
+        return 0;
+    }
+    for (int i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (i != PLACEMENT_LIST && strcmp(str, names[i]) == 0) {
+            p->policy = (PlacementPolicy)i;
+            return 0;
+        }
+    }
+    fprintf(stderr, "unknown placement: %s\n", str);
+    return -1;
+}
+
+/* The CPUs a policy uses, in the order workers are handed out; order has
+ * room for every allowed CPU. Apart from an explicit list, a cgroup quota
+ * caps how many are used. */
+static long order_cpus(const Placement *p, int *order) {
+    long n = 0;
+    size_t cores = cpuinfo_getphysicalcores();
+    size_t max_logical = 0;
+    for (size_t core = 0; core < cores; core++) {
+        if (cpuinfo_getlogicalcores(core) > max_logical) {
+            max_logical = cpuinfo_getlogicalcores(core);
+        }
+    }
+
+    switch (p->policy) {
+    case PLACEMENT_SCATTER:
+        for (size_t sibling = 0; sibling < max_logical; sibling++) {
+            for (size_t core = 0; core < cores; core++) {
+                if (sibling < cpuinfo_getlogicalcores(core)) {
+                    order[n++] = cpuinfo_getlogicalcoreid(core, sibling);
+                }
+            }
+        }
+        break;
+    case PLACEMENT_PHYSICAL:
+        for (size_t core = 0; core < cores; core++) {
+            order[n++] = cpuinfo_getlogicalcoreid(core, 0);
+        }
+        break;
+    case PLACEMENT_SMT:
+    case PLACEMENT_COMPACT:
+        for (size_t core = 0; core < cores; core++) {
+            for (size_t sibling = 0; sibling < cpuinfo_getlogicalcores(core); sibling++) {
+                order[n++] = cpuinfo_getlogicalcoreid(core, sibling);
+            }
+        }
+        if (p->policy == PLACEMENT_COMPACT) {
+            qsort(order, n, sizeof(int), compare_ints);
+        }
+        break;
+    case PLACEMENT_LIST:
+        memcpy(order, p->list, sizeof(int) * p->list_len);
+        return p->list_len;
+    default:
+        break;
+    }
+
+    if (n > (long)cpuinfo_getusablecpus()) {
+        n = cpuinfo_getusablecpus();
+    }
+    return n;
+}
+
+void placement_plan(const Placement *p, long threads, int *cpus, double *weights) {
+    long n = 0;
+    int *order = NULL;
+    if (p->policy != PLACEMENT_NONE) {
+        size_t size = (p->policy == PLACEMENT_LIST) ? p->list_len : cpuinfo_getcpus();
+        order = (int *)malloc(sizeof(int) * (size ? size : 1));
+        if (order) {
+            n = order_cpus(p, order);
+        }
+        else {
+            perror("malloc");
+        }
+    }
+
+    if (n == 0) {
+        for (long i = 0; i < threads; i++) {
+            cpus[i] = -1;
+            if (weights) {
+                weights[i] = 1.0 / threads;
+            }
+        }
+        free(order);
+        return;
+    }
+
+    for (long i = 0; i < threads; i++) {
+        cpus[i] = order[i % n];
+    }
+    free(order);
+    if (weights) {
+        placement_weights(cpus, threads, weights);
+    }
+}
+
+void placement_weights(const int *cpus, long threads, double *weights) {
+    long distinct = 0;
+    for (long i = 0; i < threads; i++) {
+        long sharing = 0;
+        long first = i;
+        for (long j = 0; j < threads; j++) {
+            if (cpus[j] == cpus[i]) {
+                sharing++;
+                first = (j < first) ? j : first;
+            }
+        }
+        distinct += (first == i);
+        weights[i] = 1.0 / sharing;
+    }
+    for (long i = 0; i < threads; i++) {
+        weights[i] /= distinct;
+    }
+}
+
+static void *spinner(void *data) {
+    for (;;) {
+    }
+
+    return NULL;
+}
+
+int placement_spin_idle(const Placement *p, const int *cpus, long threads) {
+    if (!p->spinners || p->policy == PLACEMENT_NONE) {
+        return 0;
+    }
+
+    pthread_attr_t attr;
+    if ((errno = pthread_attr_init(&attr)) != 0) {
+        perror("pthread_attr_init");
+        return -1;
+    }
+
+    int retval = 0;
+    long budget = (long)cpuinfo_getusablecpus() - threads;
+    for (size_t core = 0; core < cpuinfo_getphysicalcores() && retval == 0 && budget > 0;
+         core++) {
+        int busy = 0;
+        for (size_t sibling = 0; sibling < cpuinfo_getlogicalcores(core); sibling++) {
+            int cpu = cpuinfo_getlogicalcoreid(core, sibling);
+            for (long i = 0; i < threads; i++) {
+                busy |= (cpus[i] == cpu);
+            }
+        }
+        if (busy) {
+            continue;
+        }
+
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(cpuinfo_getlogicalcoreid(core, 0), &cpuset);
+        pthread_t t;
+        if ((errno = pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpuset)) != 0) {
+            perror("pthread_attr_setaffinity_np");
+            retval = -1;
+        }
+        else if ((errno = pthread_create(&t, &attr, spinner, NULL)) != 0) {
+            perror("pthread_create");
+            retval = -1;
+        }
+        else {
+            pthread_detach(t);
+            budget--;
+        }
+    }
+
+    pthread_attr_destroy(&attr);
+    return retval;
+}
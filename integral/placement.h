@@ -0,0 +1,45 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+/* Thread placement policies shared by integral and the network server:
+ * which logical CPU each worker is pinned to, and whether idle physical
+ * cores get a spinning thread to keep turbo clocks from skewing runs. */
+
+#define PLACEMENT_MAX_CPUS 1024
+
+typedef enum PlacementPolicy {
+    PLACEMENT_SCATTER = 0,  /* one worker per physical core, then siblings */
+    PLACEMENT_COMPACT,      /* lowest logical CPU numbers first */
+    PLACEMENT_PHYSICAL,     /* first logical CPU of each core only */
+    PLACEMENT_SMT,          /* all siblings of a core before the next core */
+    PLACEMENT_LIST,         /* the CPUs in list, in order */
+    PLACEMENT_NONE          /* unpinned */
+} PlacementPolicy;
+
+typedef struct Placement {
+    PlacementPolicy policy;
+    int spinners;           /* spin on physical cores without workers */
+    int list[PLACEMENT_MAX_CPUS];
+    long list_len;
+} Placement;
+
+/* Parses "scatter", "compact", "physical", "smt", "none" or
+ * "list:0,2,4-7" ("cores" is scatter); spinners are left alone. */
+int placement_parse(const char *str, Placement *p);
+const char *placement_name(PlacementPolicy policy);
+
+/* Fills cpus[i] for each of threads workers (-1: unpinned), wrapping
+ * around when there are more workers than CPUs, and weights[i] with an
+ * equal share per CPU split between the workers on it. weights may be
+ * NULL. Needs cpuinfo_parse() for every policy but none and list. */
+void placement_plan(const Placement *p, long threads, int *cpus, double *weights);
+/* The weights placement_plan gives workers pinned to cpus. */
+void placement_weights(const int *cpus, long threads, double *weights);
+
+/* Starts a spinning thread on the first logical CPU of every physical
+ * core none of cpus is on, if p asks for them, as long as the workers and
+ * spinners together stay within the usable CPUs (the cgroup quota would
+ * otherwise go to the spinners). Returns -1 on errors. */
+int placement_spin_idle(const Placement *p, const int *cpus, long threads);
+
+#endif /* ifndef PLACEMENT_H */
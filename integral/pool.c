@@ -0,0 +1,201 @@
+#define _GNU_SOURCE
+#include "pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define POOL_SPIN (1 << 12)
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() do {} while (0)
+#endif
+
+typedef struct PoolWorker {
+    Pool *pool;
+    long id;
+} PoolWorker;
+
+struct Pool {
+    long threads;
+    pthread_t *tids;
+    PoolWorker *workers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    unsigned long generation;
+    long pending;
+    int stop;
+    int spin;
+
+    PoolTask task;
+    void *arg;
+    Trace *trace;
+};
+
+static void *pool_worker(void *data) {
+    PoolWorker *w = (PoolWorker *)data;
+    Pool *pool = w->pool;
+    unsigned long seen = 0;
+
+    for (;;) {
+        for (int i = 0; i < pool->spin; i++) {
+            if (__atomic_load_n(&pool->generation, __ATOMIC_ACQUIRE) != seen) {
+                break;
+            }
+            cpu_relax();
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        while (pool->generation == seen) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        seen = pool->generation;
+        int stop = pool->stop;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (stop) {
+            break;
+        }
+
+        if (!pool->trace) {
+            pool->task(pool->arg, w->id);
+        }
+        else {
+            trace_begin(pool->trace, w->id);
+            pool->task(pool->arg, w->id);
+            trace_end(pool->trace, w->id, "task");
+        }
+
+        if (__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+            pthread_mutex_lock(&pool->lock);
+            pthread_cond_signal(&pool->done);
+            pthread_mutex_unlock(&pool->lock);
+        }
+    }
+
+    return NULL;
+}
+
+Pool *pool_new(long threads, const int *cpus) {
+    Pool *pool = (Pool *)calloc(1, sizeof(Pool));
+    if (!pool) {
+        return NULL;
+    }
+
+    pool->tids = (pthread_t *)calloc(threads, sizeof(pthread_t));
+    pool->workers = (PoolWorker *)calloc(threads, sizeof(PoolWorker));
+    if (!pool->tids || !pool->workers) {
+        goto FREE_POOL;
+    }
+
+    /* spinning only pays off when the caller and every worker have a CPU */
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0 &&
+        CPU_COUNT(&allowed) > threads) {
+        pool->spin = POOL_SPIN;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    pthread_attr_t attr;
+    if ((errno = pthread_attr_init(&attr)) != 0) {
+        perror("pthread_attr_init");
+        goto FREE_POOL;
+    }
+
+    for (long i = 0; i < threads; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].id = i;
+
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        if (cpus && cpus[i] >= 0) {
+            CPU_SET(cpus[i], &cpuset);
+        }
+        else {
+            sched_getaffinity(0, sizeof(cpuset), &cpuset);
+        }
+        if ((errno = pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpuset)) != 0) {
+            perror("pthread_attr_setaffinity_np");
+            goto STOP_WORKERS;
+        }
+
+        if ((errno = pthread_create(&pool->tids[i], &attr, pool_worker, &pool->workers[i])) != 0) {
+            perror("pthread_create");
+            goto STOP_WORKERS;
+        }
+        pool->threads++;
+    }
+    pthread_attr_destroy(&attr);
+
+    return pool;
+
+STOP_WORKERS:
+    pthread_attr_destroy(&attr);
+    pool_delete(pool);
+    return NULL;
+
+FREE_POOL:
+    free(pool->tids);
+    free(pool->workers);
+    free(pool);
+    return NULL;
+}
+
+void pool_delete(Pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    __atomic_add_fetch(&pool->generation, 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (long i = 0; i < pool->threads; i++) {
+        pthread_join(pool->tids[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->tids);
+    free(pool->workers);
+    free(pool);
+}
+
+long pool_threads(const Pool *pool) {
+    return pool->threads;
+}
+
+void pool_set_trace(Pool *pool, Trace *trace) {
+    pool->trace = trace;
+}
+
+void pool_run(Pool *pool, PoolTask task, void *arg) {
+    pool->task = task;
+    pool->arg = arg;
+    __atomic_store_n(&pool->pending, pool->threads, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&pool->lock);
+    __atomic_add_fetch(&pool->generation, 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->spin; i++) {
+        if (__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) == 0) {
+            return;
+        }
+        cpu_relax();
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    while (__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) != 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,23 @@
+#ifndef POOL_H
+#define POOL_H
+#include "trace.h"
+
+/* Persistent pool of (optionally pinned) worker threads. Between runs the
+ * workers spin briefly and then park on a condition variable. */
+
+typedef struct Pool Pool;
+typedef void (*PoolTask)(void *arg, long worker);
+
+/* cpus[i] is the CPU worker i is pinned to, or -1 to leave it unpinned.
+ * cpus may be NULL. */
+Pool *pool_new(long threads, const int *cpus);
+void pool_delete(Pool *pool);
+
+long pool_threads(const Pool *pool);
+/* Runs task(arg, worker) on every worker and waits for all of them. */
+void pool_run(Pool *pool, PoolTask task, void *arg);
+/* Traces every task run as a span of its worker, NULL to stop. Only to be
+ * changed between runs. */
+void pool_set_trace(Pool *pool, Trace *trace);
+
+#endif /* ifndef POOL_H */
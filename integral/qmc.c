@@ -0,0 +1,294 @@
+#include "qmc.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "expr.h"
+#include "grid.h"
+#include "kernel.h"
+#include "vmath.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define QMC_X86
+#endif
+
+#define QMC_BITS 32
+/* low index bits covered by the per-block table */
+#define QMC_BLOCK_BITS 7
+/* pieces per point set, enough for stealing to even out the weighted start */
+#define QMC_CHUNKS 1024
+
+#if (1 << QMC_BLOCK_BITS) != EXPR_BLOCK
+#error "QMC_BLOCK_BITS must match EXPR_BLOCK"
+#endif
+
+/* Primitive polynomials and initial direction numbers for dimensions 2..20,
+ * from Joe and Kuo's new-joe-kuo-6.21201 table: degree s, the middle
+ * coefficients a and m_1 .. m_s. Dimension 1 is the van der Corput sequence. */
+static const struct {
+    int s;
+    unsigned a;
+    unsigned m[7];
+} directions[INTEGRAL_QMC_MAX_DIMS - 1] = {
+    {1, 0, {1}},
+    {2, 1, {1, 3}},
+    {3, 1, {1, 3, 1}},
+    {3, 2, {1, 1, 1}},
+    {4, 1, {1, 1, 3, 3}},
+    {4, 4, {1, 3, 5, 13}},
+    {5, 2, {1, 1, 5, 5, 17}},
+    {5, 4, {1, 1, 5, 5, 5}},
+    {5, 7, {1, 1, 7, 11, 19}},
+    {5, 11, {1, 1, 5, 1, 1}},
+    {5, 13, {1, 1, 1, 3, 11}},
+    {5, 14, {1, 3, 5, 5, 31}},
+    {6, 1, {1, 3, 3, 9, 7, 49}},
+    {6, 13, {1, 1, 1, 15, 21, 21}},
+    {6, 16, {1, 3, 1, 13, 27, 49}},
+    {6, 19, {1, 1, 1, 15, 7, 5}},
+    {6, 22, {1, 3, 1, 15, 13, 25}},
+    {6, 25, {1, 1, 5, 5, 19, 61}},
+    {7, 1, {1, 3, 7, 11, 23, 15, 103}}
+};
+
+/* One randomized point set. Point k has coordinate j equal to the XOR of
+ * dirs[j][b] over the set bits b of k, XORed with shift[j]; low[j] holds
+ * those XORs for the bits below QMC_BLOCK_BITS, so a block of EXPR_BLOCK
+ * points needs one XOR per coordinate. */
+typedef struct Qmc {
+    const IntegralFuncNd *f;
+    int dims;
+    const double *lower;
+    double width[INTEGRAL_QMC_MAX_DIMS];
+    uint32_t dirs[INTEGRAL_QMC_MAX_DIMS][QMC_BITS];
+    uint32_t shift[INTEGRAL_QMC_MAX_DIMS];
+    uint32_t low[INTEGRAL_QMC_MAX_DIMS][EXPR_BLOCK];
+} Qmc;
+
+static uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static void sobol_directions(int dim, uint32_t *v) {
+    if (dim == 0) {
+        for (int b = 0; b < QMC_BITS; b++) {
+            v[b] = 1u << (QMC_BITS - 1 - b);
+        }
+        return;
+    }
+
+    int s = directions[dim - 1].s;
+    unsigned a = directions[dim - 1].a;
+    for (int b = 0; b < s; b++) {
+        v[b] = directions[dim - 1].m[b] << (QMC_BITS - 1 - b);
+    }
+    for (int b = s; b < QMC_BITS; b++) {
+        v[b] = v[b - s] ^ (v[b - s] >> s);
+        for (int k = 1; k < s; k++) {
+            if ((a >> (s - 1 - k)) & 1) {
+                v[b] ^= v[b - k];
+            }
+        }
+    }
+}
+
+/* Random linear matrix scrambling: digit i of the result is digit i of the
+ * input plus a random combination of the more significant digits. */
+static void scramble(uint32_t *v, uint64_t *rng) {
+    uint32_t rows[QMC_BITS];
+    for (int bit = 0; bit < QMC_BITS; bit++) {
+        uint32_t above = (uint32_t)~((2ULL << bit) - 1);
+        rows[bit] = ((uint32_t)splitmix64(rng) & above) | (1u << bit);
+    }
+
+    for (int b = 0; b < QMC_BITS; b++) {
+        uint32_t y = 0;
+        for (int bit = 0; bit < QMC_BITS; bit++) {
+            y |= (uint32_t)__builtin_parity(rows[bit] & v[b]) << bit;
+        }
+        v[b] = y;
+    }
+}
+
+static void randomize(Qmc *q, unsigned long seed, int replicate) {
+    uint64_t rng = seed ^ (0xd1b54a32d192ed03ULL * (replicate + 1));
+    for (int j = 0; j < q->dims; j++) {
+        sobol_directions(j, q->dirs[j]);
+        scramble(q->dirs[j], &rng);
+        q->shift[j] = (uint32_t)splitmix64(&rng);
+
+        q->low[j][0] = 0;
+        for (int i = 1; i < EXPR_BLOCK; i++) {
+            int b = __builtin_ctz(i);
+            q->low[j][i] = q->low[j][i & (i - 1)] ^ q->dirs[j][b];
+        }
+    }
+}
+
+#define QMC_INLINE static inline __attribute__((always_inline))
+
+/* Coordinates of points k0 .. k0 + EXPR_BLOCK - 1, k0 a multiple of
+ * EXPR_BLOCK, at the centre of their 2^-32 cells. */
+QMC_INLINE void generate_block(const Qmc *q, long k0, double (*coords)[EXPR_BLOCK]) {
+    for (int j = 0; j < q->dims; j++) {
+        uint32_t base = q->shift[j];
+        for (long k = k0 >> QMC_BLOCK_BITS, b = QMC_BLOCK_BITS; k; k >>= 1, b++) {
+            if (k & 1) {
+                base ^= q->dirs[j][b];
+            }
+        }
+
+        const uint32_t *low = q->low[j];
+        double scale = q->width[j] * 0x1p-32;
+        double offset = q->lower[j] + q->width[j] * 0x1p-33;
+        for (int i = 0; i < EXPR_BLOCK; i++) {
+            /* exact uint32 -> double that vectorizes without AVX-512DQ */
+            double u = vm_double(0x4330000000000000ULL | (base ^ low[i])) - 0x1p52;
+            coords[j][i] = offset + scale * u;
+        }
+    }
+}
+
+QMC_INLINE void builtin_block(int dims, const double (*coords)[EXPR_BLOCK],
+                              double *restrict y) {
+    for (int i = 0; i < EXPR_BLOCK; i++) {
+        y[i] = 1;
+    }
+    for (int j = 0; j < dims; j++) {
+        const double *restrict c = coords[j];
+        double a = j + 1;
+        double scale = 1 / (1 + a);
+        for (int i = 0; i < EXPR_BLOCK; i++) {
+            y[i] *= (fabs(4 * c[i] - 2) + a) * scale;
+        }
+    }
+}
+
+typedef struct QmcOps {
+    void (*generate)(const Qmc *q, long k0, double (*coords)[EXPR_BLOCK]);
+    void (*builtin)(int dims, const double (*coords)[EXPR_BLOCK], double *y);
+} QmcOps;
+
+#define QMC_DEFINE_OPS(suffix, attr) \
+    attr static void generate_##suffix(const Qmc *q, long k0, \
+                                       double (*coords)[EXPR_BLOCK]) { \
+        generate_block(q, k0, coords); \
+    } \
+    attr static void builtin_##suffix(int dims, const double (*coords)[EXPR_BLOCK], \
+                                      double *y) { \
+        builtin_block(dims, coords, y); \
+    } \
+    static const QmcOps ops_##suffix = {generate_##suffix, builtin_##suffix}
+
+QMC_DEFINE_OPS(default, );
+#ifdef QMC_X86
+QMC_DEFINE_OPS(avx2, __attribute__((target("avx2"))));
+QMC_DEFINE_OPS(avx512, __attribute__((target("avx512f"))));
+#endif
+
+static const QmcOps *qmc_ops(void) {
+#ifdef QMC_X86
+    switch (kernel_isa()) {
+    case KERNEL_AVX2:
+        return &ops_avx2;
+    case KERNEL_AVX512:
+        return &ops_avx512;
+    default:
+        break;
+    }
+#endif
+    return &ops_default;
+}
+
+/* Sum of the integrand over points first .. first + count - 1; both are
+ * multiples of EXPR_BLOCK. */
+static double run_points(void *arg, long first, long count) {
+    const Qmc *q = (const Qmc *)arg;
+    const QmcOps *ops = qmc_ops();
+    double coords[INTEGRAL_QMC_MAX_DIMS][EXPR_BLOCK] __attribute__((aligned(64)));
+    double y[EXPR_BLOCK] __attribute__((aligned(64)));
+    double acc[EXPR_BLOCK] = {0};
+
+    for (long k0 = first; k0 < first + count; k0 += EXPR_BLOCK) {
+        ops->generate(q, k0, coords);
+        if (q->f && q->f->expr) {
+            expr_eval_points(q->f->expr, (const double (*)[EXPR_BLOCK])coords, y);
+        }
+        else if (q->f && q->f->fn) {
+            for (int i = 0; i < EXPR_BLOCK; i++) {
+                double x[INTEGRAL_QMC_MAX_DIMS];
+                for (int j = 0; j < q->dims; j++) {
+                    x[j] = coords[j][i];
+                }
+                y[i] = q->f->fn(x, q->dims);
+            }
+        }
+        else {
+            ops->builtin(q->dims, (const double (*)[EXPR_BLOCK])coords, y);
+        }
+
+        for (int i = 0; i < EXPR_BLOCK; i++) {
+            acc[i] += y[i];
+        }
+    }
+
+    double value = 0;
+    for (int i = 0; i < EXPR_BLOCK; i++) {
+        value += acc[i];
+    }
+    return value;
+}
+
+int qmc_integrate(IntegralCtx *ctx, const IntegralFuncNd *f, int dims,
+                  const double *lower, const double *upper, long points,
+                  int replicates, unsigned long seed, IntegralResult *res) {
+    if (dims < 1 || dims > INTEGRAL_QMC_MAX_DIMS || replicates < 2 ||
+        points < 1 || points > QMC_MAX_POINTS) {
+        fprintf(stderr, "qmc_integrate: bad arguments\n");
+        return -1;
+    }
+    if (f && f->expr && expr_dims(f->expr) > dims) {
+        fprintf(stderr, "qmc_integrate: expression uses x%d in %d dimensions\n",
+                expr_dims(f->expr), dims);
+        return -1;
+    }
+
+    long n = EXPR_BLOCK;
+    while (n < points) {
+        n *= 2;
+    }
+    /* a function of n alone, which the reproducible mode relies on */
+    long chunk_size = EXPR_BLOCK;
+    while (chunk_size * 2 <= n / QMC_CHUNKS) {
+        chunk_size *= 2;
+    }
+
+    Qmc q;
+    q.f = f;
+    q.dims = dims;
+    q.lower = lower;
+    double volume = 1;
+    for (int j = 0; j < dims; j++) {
+        q.width[j] = upper[j] - lower[j];
+        volume *= q.width[j];
+    }
+
+    /* Welford's update: the replicates agree to many digits, so the
+     * textbook sum of squares would cancel */
+    double mean = 0;
+    double m2 = 0;
+    for (int r = 0; r < replicates; r++) {
+        randomize(&q, seed, r);
+        double estimate = volume * grid_run(ctx, run_points, &q, n, chunk_size) / n;
+        double delta = estimate - mean;
+        mean += delta / (r + 1);
+        m2 += delta * (estimate - mean);
+    }
+
+    res->value = mean;
+    res->error = sqrt(m2 / (replicates - 1) / replicates);
+    res->evaluations = n * replicates;
+    return 0;
+}
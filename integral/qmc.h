@@ -0,0 +1,12 @@
+#ifndef QMC_H
+#define QMC_H
+#include "integral.h"
+
+#define QMC_MAX_POINTS (1L << 32)
+
+/* See integral_run_qmc. */
+int qmc_integrate(IntegralCtx *ctx, const IntegralFuncNd *f, int dims,
+                  const double *lower, const double *upper, long points,
+                  int replicates, unsigned long seed, IntegralResult *res);
+
+#endif /* ifndef QMC_H */
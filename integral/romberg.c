@@ -0,0 +1,73 @@
+#include "romberg.h"
+#include <math.h>
+#include <time.h>
+#include "grid.h"
+#include "integrand.h"
+
+static double elapsed(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) + (now.tv_nsec - since->tv_nsec) * 1e-9;
+}
+
+/* Level k holds the trapezoid sum over n = ROMBERG_START_N * 2^k subintervals.
+ * Only the n / 2 new midpoints are evaluated, the rest comes from level k - 1.
+ * Row k of the Richardson table is built from row k - 1 alone, so two rows
+ * are enough. */
+int romberg_integrate(IntegralCtx *ctx, const IntegralFunc *f, double a, double b,
+                      double abstol, double reltol, double budget,
+                      integral_progress_fn progress, void *arg,
+                      IntegralResult *res) {
+    double prev[ROMBERG_MAX_LEVELS];
+    double cur[ROMBERG_MAX_LEVELS];
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    long n = ROMBERG_START_N;
+    double h = (b - a) / n;
+    double ends[2] = {a, b};
+    integrand_eval(f, ends, ends, 2);
+    double trapezoid = h * ((ends[0] + ends[1]) / 2 + grid_sum(ctx, f, a + h, h, n - 1));
+    res->evaluations = n + 1;
+    res->value = trapezoid;
+    res->error = INFINITY;
+    prev[0] = trapezoid;
+    if (progress) {
+        progress(res, n, arg);
+    }
+
+    for (int k = 1; k < ROMBERG_MAX_LEVELS; k++) {
+        if (budget > 0 && elapsed(&start) >= budget) {
+            return -1;
+        }
+
+        double midpoints = grid_sum(ctx, f, a + h / 2, h, n);
+        res->evaluations += n;
+        n *= 2;
+        h /= 2;
+        trapezoid = trapezoid / 2 + h * midpoints;
+
+        cur[0] = trapezoid;
+        double factor = 1;
+        for (int j = 1; j <= k; j++) {
+            factor *= 4;
+            cur[j] = cur[j - 1] + (cur[j - 1] - prev[j - 1]) / (factor - 1);
+        }
+
+        res->value = cur[k];
+        res->error = fabs(cur[k] - prev[k - 1]);
+        if (progress) {
+            progress(res, n, arg);
+        }
+        if (k >= ROMBERG_MIN_LEVELS &&
+            res->error <= fmax(abstol, reltol * fabs(res->value))) {
+            return 0;
+        }
+
+        for (int j = 0; j <= k; j++) {
+            prev[j] = cur[j];
+        }
+    }
+
+    return -1;
+}
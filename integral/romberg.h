@@ -0,0 +1,15 @@
+#ifndef ROMBERG_H
+#define ROMBERG_H
+#include "integral.h"
+
+#define ROMBERG_START_N 16
+#define ROMBERG_MAX_LEVELS 32
+/* levels an estimate needs before its error bound is trusted */
+#define ROMBERG_MIN_LEVELS 4
+
+int romberg_integrate(IntegralCtx *ctx, const IntegralFunc *f, double a, double b,
+                      double abstol, double reltol, double budget,
+                      integral_progress_fn progress, void *arg,
+                      IntegralResult *res);
+
+#endif /* ifndef ROMBERG_H */
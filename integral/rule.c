@@ -0,0 +1,196 @@
+#include "rule.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "grid.h"
+#include "integrand.h"
+
+#define RULE_MAX_GAUSS INTEGRAL_GAUSS_MAX_ORDER
+/* integrand evaluations per scheduled chunk, whatever the rule */
+#define RULE_CHUNK_POINTS (1L << 18)
+
+/* Gauss-Legendre abscissae on [-1, 1] and their weights, the non-negative
+ * half of each order; the rest mirrors it. */
+static const double gauss_nodes[RULE_MAX_GAUSS + 1][RULE_MAX_GAUSS / 2] = {
+    [2] = {5.7735026918962576451e-1},
+    [3] = {0, 7.7459666924148337704e-1},
+    [4] = {3.3998104358485626480e-1, 8.6113631159405257522e-1},
+    [5] = {0, 5.3846931010568309104e-1, 9.0617984593866399280e-1},
+    [6] = {2.3861918608319690863e-1, 6.6120938646626451366e-1, 9.3246951420315202781e-1},
+    [7] = {0, 4.0584515137739716691e-1, 7.4153118559939443986e-1, 9.4910791234275852453e-1},
+    [8] = {1.8343464249564980494e-1, 5.2553240991632898582e-1, 7.9666647741362673959e-1,
+           9.6028985649753623168e-1},
+    [9] = {0, 3.2425342340380892904e-1, 6.1337143270059039731e-1, 8.3603110732663579430e-1,
+           9.6816023950762608984e-1},
+    [10] = {1.4887433898163121088e-1, 4.3339539412924719080e-1, 6.7940956829902440623e-1,
+           8.6506336668898451073e-1, 9.7390652851717172008e-1},
+    [11] = {0, 2.6954315595234497233e-1, 5.1909612920681181593e-1,
+           7.3015200557404932409e-1, 8.8706259976809529908e-1, 9.7822865814605699280e-1},
+    [12] = {1.2523340851146891547e-1, 3.6783149899818019375e-1, 5.8731795428661744730e-1,
+           7.6990267419430468704e-1, 9.0411725637047485668e-1, 9.8156063424671925069e-1},
+    [13] = {0, 2.3045831595513479407e-1, 4.4849275103644685288e-1,
+           6.4234933944034022064e-1, 8.0157809073330991279e-1, 9.1759839922297796521e-1,
+           9.8418305471858814947e-1},
+    [14] = {1.0805494870734366207e-1, 3.1911236892788976044e-1, 5.1524863635815409196e-1,
+           6.8729290481168547015e-1, 8.2720131506976499319e-1, 9.2843488366357351734e-1,
+           9.8628380869681233884e-1},
+    [15] = {0, 2.0119409399743452230e-1, 3.9415134707756336990e-1,
+           5.7097217260853884754e-1, 7.2441773136017004742e-1, 8.4820658341042721620e-1,
+           9.3727339240070590431e-1, 9.8799251802048542849e-1},
+    [16] = {9.5012509837637440185e-2, 2.8160355077925891323e-1, 4.5801677765722738634e-1,
+           6.1787624440264374845e-1, 7.5540440835500303390e-1, 8.6563120238783174388e-1,
+           9.4457502307323257608e-1, 9.8940093499164993260e-1},
+};
+static const double gauss_weights[RULE_MAX_GAUSS + 1][RULE_MAX_GAUSS / 2] = {
+    [2] = {1.0000000000000000000},
+    [3] = {8.8888888888888888889e-1, 5.5555555555555555556e-1},
+    [4] = {6.5214515486254614263e-1, 3.4785484513745385737e-1},
+    [5] = {5.6888888888888888889e-1, 4.7862867049936646804e-1, 2.3692688505618908751e-1},
+    [6] = {4.6791393457269104739e-1, 3.6076157304813860757e-1, 1.7132449237917034504e-1},
+    [7] = {4.1795918367346938776e-1, 3.8183005050511894495e-1, 2.7970539148927666790e-1,
+           1.2948496616886969327e-1},
+    [8] = {3.6268378337836198296e-1, 3.1370664587788728734e-1, 2.2238103445337447054e-1,
+           1.0122853629037625915e-1},
+    [9] = {3.3023935500125976316e-1, 3.1234707704000284007e-1, 2.6061069640293546232e-1,
+           1.8064816069485740406e-1, 8.1274388361574411972e-2},
+    [10] = {2.9552422471475287017e-1, 2.6926671930999635509e-1, 2.1908636251598204400e-1,
+           1.4945134915058059315e-1, 6.6671344308688137594e-2},
+    [11] = {2.7292508677790063071e-1, 2.6280454451024666218e-1, 2.3319376459199047992e-1,
+           1.8629021092773425143e-1, 1.2558036946490462464e-1, 5.5668567116173666483e-2},
+    [12] = {2.4914704581340278500e-1, 2.3349253653835480876e-1, 2.0316742672306592175e-1,
+           1.6007832854334622634e-1, 1.0693932599531843096e-1, 4.7175336386511827195e-2},
+    [13] = {2.3255155323087391020e-1, 2.2628318026289723841e-1, 2.0781604753688850231e-1,
+           1.7814598076194573828e-1, 1.3887351021978723846e-1, 9.2121499837728447914e-2,
+           4.0484004765315879520e-2},
+    [14] = {2.1526385346315779020e-1, 2.0519846372129560397e-1, 1.8553839747793781374e-1,
+           1.5720316715819353457e-1, 1.2151857068790318469e-1, 8.0158087159760209806e-2,
+           3.5119460331751863032e-2},
+    [15] = {2.0257824192556127288e-1, 1.9843148532711157646e-1, 1.8616100001556221103e-1,
+           1.6626920581699393355e-1, 1.3957067792615431445e-1, 1.0715922046717193501e-1,
+           7.0366047488108124709e-2, 3.0753241996117268355e-2},
+    [16] = {1.8945061045506849628e-1, 1.8260341504492358887e-1, 1.6915651939500253819e-1,
+           1.4959598881657673208e-1, 1.2462897125553387205e-1, 9.5158511682492784810e-2,
+           6.2253523938647892863e-2, 2.7152459411754094852e-2},
+};
+
+/* A rule on the panel [0, 1]: the weight of each end (closed rules), and
+ * the interior nodes with theirs; all weights sum to 1. */
+typedef struct Rule {
+    const IntegralFunc *f;
+    double a;
+    double h;
+    double ends;
+    int nodes;
+    double t[RULE_MAX_GAUSS];
+    double w[RULE_MAX_GAUSS];
+} Rule;
+
+/* Node by node rather than panel by panel: every node of the rule is a
+ * grid of its own with the panel width as the step, so each pass is one
+ * strided sum on the SIMD kernels. */
+static double run_panels(void *arg, long first, long count) {
+    const Rule *r = (const Rule *)arg;
+    double value = 0;
+    if (r->ends != 0) {
+        /* the inner panel ends belong to two panels each */
+        double ends[2] = {r->a + r->h * first, r->a + r->h * (first + count)};
+        integrand_eval(r->f, ends, ends, 2);
+        value = r->ends * (ends[0] + ends[1] +
+                           2 * integrand_sum(r->f, r->a, r->h, first + 1, count - 1));
+    }
+    for (int k = 0; k < r->nodes; k++) {
+        value += r->w[k] * integrand_sum(r->f, r->a + r->h * r->t[k], r->h, first, count);
+    }
+    return value * r->h;
+}
+
+static void add_node(Rule *r, double t, double w) {
+    r->t[r->nodes] = t;
+    r->w[r->nodes] = w;
+    r->nodes++;
+}
+
+double rule_integrate(IntegralCtx *ctx, const IntegralFunc *f, IntegralRule rule,
+                      int order, double a, double b, long n) {
+    Rule r;
+    memset(&r, 0, sizeof(r));
+    r.f = f;
+    r.a = a;
+    r.h = (b - a) / n;
+
+    switch (rule) {
+    case INTEGRAL_RULE_TRAPEZOID:
+        return integral_run(ctx, f, a, b, n);
+    case INTEGRAL_RULE_SIMPSON:
+        r.ends = 1.0 / 6;
+        add_node(&r, 0.5, 4.0 / 6);
+        break;
+    case INTEGRAL_RULE_BOOLE:
+        r.ends = 7.0 / 90;
+        add_node(&r, 0.25, 32.0 / 90);
+        add_node(&r, 0.5, 12.0 / 90);
+        add_node(&r, 0.75, 32.0 / 90);
+        break;
+    case INTEGRAL_RULE_GAUSS:
+        if (order < INTEGRAL_GAUSS_MIN_ORDER || order > INTEGRAL_GAUSS_MAX_ORDER) {
+            fprintf(stderr, "rule_integrate: Gauss-Legendre order must be %d ... %d\n",
+                    INTEGRAL_GAUSS_MIN_ORDER, INTEGRAL_GAUSS_MAX_ORDER);
+            return NAN;
+        }
+        for (int i = 0; i < (order + 1) / 2; i++) {
+            double x = gauss_nodes[order][i];
+            double w = gauss_weights[order][i] / 2;
+            if (x == 0) {
+                add_node(&r, 0.5, w);
+                continue;
+            }
+            add_node(&r, (1 - x) / 2, w);
+            add_node(&r, (1 + x) / 2, w);
+        }
+        break;
+    default:
+        fprintf(stderr, "rule_integrate: unknown rule\n");
+        return NAN;
+    }
+
+    /* the chunk depends on the rule only, which keeps the reproducible
+     * mode's blocking fixed */
+    long points = r.nodes + (r.ends != 0);
+    return grid_run(ctx, run_panels, &r, n, RULE_CHUNK_POINTS / points);
+}
+
+int rule_parse(const char *str, IntegralRule *rule, int *order) {
+    int end = 0;
+    *order = 0;
+    if (strcmp(str, "trapezoid") == 0) {
+        *rule = INTEGRAL_RULE_TRAPEZOID;
+        return 0;
+    }
+    if (strcmp(str, "simpson") == 0) {
+        *rule = INTEGRAL_RULE_SIMPSON;
+        return 0;
+    }
+    if (strcmp(str, "boole") == 0) {
+        *rule = INTEGRAL_RULE_BOOLE;
+        return 0;
+    }
+    if (sscanf(str, "gauss%d%n", order, &end) == 1 && str[end] == '\0' &&
+        *order >= INTEGRAL_GAUSS_MIN_ORDER && *order <= INTEGRAL_GAUSS_MAX_ORDER) {
+        *rule = INTEGRAL_RULE_GAUSS;
+        return 0;
+    }
+
+    fprintf(stderr, "unknown rule: %s (trapezoid, simpson, boole or gauss%d ... gauss%d)\n",
+            str, INTEGRAL_GAUSS_MIN_ORDER, INTEGRAL_GAUSS_MAX_ORDER);
+    return -1;
+}
+
+void rule_name(IntegralRule rule, int order, char *buf, size_t len) {
+    static const char *const names[] = {"trapezoid", "simpson", "boole"};
+    if (rule == INTEGRAL_RULE_GAUSS) {
+        snprintf(buf, len, "gauss%d", order);
+    }
+    else {
+        snprintf(buf, len, "%s", names[rule]);
+    }
+}
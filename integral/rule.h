@@ -0,0 +1,13 @@
+#ifndef RULE_H
+#define RULE_H
+#include "integral.h"
+
+double rule_integrate(IntegralCtx *ctx, const IntegralFunc *f, IntegralRule rule,
+                      int order, double a, double b, long n);
+
+/* trapezoid, simpson, boole or gauss<order>, e.g. gauss8 */
+int rule_parse(const char *str, IntegralRule *rule, int *order);
+/* Writes the name rule_parse reads back into buf. */
+void rule_name(IntegralRule rule, int order, char *buf, size_t len);
+
+#endif /* ifndef RULE_H */
@@ -0,0 +1,188 @@
+#include "sched.h"
+#include <stdlib.h>
+#include <pthread.h>
+
+#define CACHE_LINE 64
+
+enum {
+    STEAL_LLC = 0,
+    STEAL_NODE,
+    STEAL_REMOTE
+};
+
+typedef struct Deque {
+    pthread_mutex_t lock;
+    long head;
+    long tail;
+    SchedStats stats;
+} __attribute__((aligned(CACHE_LINE))) Deque;
+
+struct Scheduler {
+    long workers;
+    long total;
+    long chunk_size;
+    long chunks;
+    const int *nodes;
+    const int *llcs;
+    Deque *deques;
+};
+
+Scheduler *sched_new(long workers, long total, long chunk_size) {
+    Scheduler *s = (Scheduler *)calloc(1, sizeof(Scheduler));
+    if (!s) {
+        return NULL;
+    }
+
+    if (posix_memalign((void **)&s->deques, CACHE_LINE,
+                       sizeof(Deque) * workers) != 0) {
+        free(s);
+        return NULL;
+    }
+
+    s->workers = workers;
+    for (long i = 0; i < workers; i++) {
+        pthread_mutex_init(&s->deques[i].lock, NULL);
+    }
+    sched_reset(s, total, chunk_size);
+
+    return s;
+}
+
+void sched_reset(Scheduler *s, long total, long chunk_size) {
+    s->total = total;
+    s->chunk_size = chunk_size;
+    s->chunks = (total + chunk_size - 1) / chunk_size;
+    for (long i = 0; i < s->workers; i++) {
+        s->deques[i].head = 0;
+        s->deques[i].tail = 0;
+        s->deques[i].stats = (SchedStats){0};
+    }
+}
+
+void sched_delete(Scheduler *s) {
+    for (long i = 0; i < s->workers; i++) {
+        pthread_mutex_destroy(&s->deques[i].lock);
+    }
+    free(s->deques);
+    free(s);
+}
+
+long sched_chunks(const Scheduler *s) {
+    return s->chunks;
+}
+
+long sched_chunk_of(const Scheduler *s, long subinterval) {
+    if (subinterval >= s->total) {
+        return s->chunks;
+    }
+    return subinterval / s->chunk_size;
+}
+
+void sched_set_nodes(Scheduler *s, const int *nodes) {
+    s->nodes = nodes;
+}
+
+void sched_set_llcs(Scheduler *s, const int *llcs) {
+    s->llcs = llcs;
+}
+
+void sched_assign(Scheduler *s, long worker, long first_chunk, long last_chunk) {
+    Deque *d = &s->deques[worker];
+    pthread_mutex_lock(&d->lock);
+    d->head = first_chunk;
+    d->tail = last_chunk;
+    pthread_mutex_unlock(&d->lock);
+}
+
+static int pop(Deque *d, long *chunk) {
+    int found = 0;
+    pthread_mutex_lock(&d->lock);
+    if (d->head < d->tail) {
+        *chunk = d->head++;
+        found = 1;
+    }
+    pthread_mutex_unlock(&d->lock);
+
+    return found;
+}
+
+/* 0: the workers share a last-level cache, 1: a NUMA node, 2: neither */
+static int distance(const Scheduler *s, long a, long b) {
+    if (s->nodes && s->nodes[a] != s->nodes[b]) {
+        return STEAL_REMOTE;
+    }
+    if (s->llcs && s->llcs[a] != s->llcs[b]) {
+        return STEAL_NODE;
+    }
+    return STEAL_LLC;
+}
+
+static int steal_from(Scheduler *s, long worker, int tier, long *chunk) {
+    Deque *self = &s->deques[worker];
+
+    for (long i = 1; i < s->workers; i++) {
+        long v = (worker + i) % s->workers;
+        if (distance(s, worker, v) != tier) {
+            continue;
+        }
+        Deque *victim = &s->deques[v];
+
+        /* racy peek to skip empty victims without taking their lock */
+        if (__atomic_load_n(&victim->tail, __ATOMIC_RELAXED) -
+            __atomic_load_n(&victim->head, __ATOMIC_RELAXED) <= 0) {
+            continue;
+        }
+
+        pthread_mutex_lock(&victim->lock);
+        long left = victim->tail - victim->head;
+        if (left <= 0) {
+            pthread_mutex_unlock(&victim->lock);
+            continue;
+        }
+        long take = (left + 1) / 2;
+        long first = victim->tail - take;
+        victim->tail = first;
+        pthread_mutex_unlock(&victim->lock);
+
+        pthread_mutex_lock(&self->lock);
+        self->head = first + 1;
+        self->tail = first + take;
+        self->stats.stolen += take;
+        self->stats.steals++;
+        if (tier == STEAL_REMOTE) {
+            self->stats.remote += take;
+        }
+        pthread_mutex_unlock(&self->lock);
+
+        *chunk = first;
+        return 1;
+    }
+
+    return 0;
+}
+
+static int steal(Scheduler *s, long worker, long *chunk) {
+    return steal_from(s, worker, STEAL_LLC, chunk) ||
+           (s->llcs && steal_from(s, worker, STEAL_NODE, chunk)) ||
+           (s->nodes && steal_from(s, worker, STEAL_REMOTE, chunk));
+}
+
+int sched_next(Scheduler *s, long worker, long *first, long *count) {
+    long chunk = 0;
+    if (!pop(&s->deques[worker], &chunk) && !steal(s, worker, &chunk)) {
+        return -1;
+    }
+
+    s->deques[worker].stats.executed++;
+    *first = chunk * s->chunk_size;
+    *count = s->chunk_size;
+    if (*first + *count > s->total) {
+        *count = s->total - *first;
+    }
+
+    return 0;
+}
+
+const SchedStats *sched_stats(const Scheduler *s, long worker) {
+    return &s->deques[worker].stats;
+}
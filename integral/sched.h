@@ -0,0 +1,41 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+/* Work-stealing scheduler over fixed-size chunks of subintervals.
+ * Every worker owns a deque holding a contiguous range of chunk ids. The
+ * owner pops chunks from the front; an idle worker steals the back half of
+ * the next non-empty victim's range, trying workers that share its
+ * last-level cache first, then those on its NUMA node, then the rest. */
+
+typedef struct Scheduler Scheduler;
+
+typedef struct SchedStats {
+    long executed;  /* chunks run by the worker */
+    long stolen;    /* chunks it took from other workers */
+    long steals;    /* successful steal operations */
+    long remote;    /* chunks stolen from another node */
+} SchedStats;
+
+Scheduler *sched_new(long workers, long total, long chunk_size);
+void sched_delete(Scheduler *s);
+/* Empties all deques and clears the statistics for a new run. */
+void sched_reset(Scheduler *s, long total, long chunk_size);
+
+long sched_chunks(const Scheduler *s);
+/* Converts a subinterval boundary into the chunk id that starts there. */
+long sched_chunk_of(const Scheduler *s, long subinterval);
+/* nodes[i] is worker i's NUMA node; NULL (the default) puts all on one.
+ * The array must outlive the scheduler. */
+void sched_set_nodes(Scheduler *s, const int *nodes);
+/* Same for the workers' last-level caches. */
+void sched_set_llcs(Scheduler *s, const int *llcs);
+/* Gives worker the chunks [first_chunk, last_chunk). */
+void sched_assign(Scheduler *s, long worker, long first_chunk, long last_chunk);
+
+/* Fetches the next piece of work for worker as a subinterval range.
+ * Returns 0 on success and -1 once there is no work left anywhere. */
+int sched_next(Scheduler *s, long worker, long *first, long *count);
+
+const SchedStats *sched_stats(const Scheduler *s, long worker);
+
+#endif /* ifndef SCHED_H */
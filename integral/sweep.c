@@ -0,0 +1,104 @@
+#include "sweep.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* A tile is EXPR_BLOCK parameters by SWEEP_SEGMENT grid points. The p side
+ * keeps the expression's registers (EXPR_MAX_REGS blocks, 16 KB) and the
+ * accumulators in L1 for the whole tile; the x side only sets how much work
+ * a worker takes at once. Both are fixed, so the partial sums and their
+ * order do not depend on the number of workers. */
+#define SWEEP_SEGMENT (1L << 14)
+
+typedef struct Sweep {
+    const Expr *e;
+    double a;
+    double step;
+    long n;
+    const double *params;   /* blocks * EXPR_BLOCK, padded */
+    long segments;
+    long tiles;
+    double *partial;        /* tiles * EXPR_BLOCK */
+    double *ends;           /* blocks * EXPR_BLOCK */
+    long next;
+} Sweep;
+
+static void run_tiles(void *arg, long worker) {
+    Sweep *s = (Sweep *)arg;
+    long t = 0;
+    while ((t = __atomic_fetch_add(&s->next, 1, __ATOMIC_RELAXED)) < s->tiles) {
+        long block = t / s->segments;
+        long segment = t % s->segments;
+        const double *p = s->params + block * EXPR_BLOCK;
+        double *acc = s->partial + t * EXPR_BLOCK;
+
+        /* interior points 1 .. n - 1 */
+        long first = 1 + segment * SWEEP_SEGMENT;
+        long last = first + SWEEP_SEGMENT;
+        if (last > s->n) {
+            last = s->n;
+        }
+        memset(acc, 0, sizeof(double) * EXPR_BLOCK);
+        if (first < last) {
+            expr_sweep(s->e, p, s->a, s->step, first, last - first, acc);
+        }
+
+        if (segment == 0) {
+            double lo[EXPR_BLOCK] = {0};
+            double hi[EXPR_BLOCK] = {0};
+            expr_sweep(s->e, p, s->a, s->step, 0, 1, lo);
+            expr_sweep(s->e, p, s->a, s->step, s->n, 1, hi);
+            double *ends = s->ends + block * EXPR_BLOCK;
+            for (int j = 0; j < EXPR_BLOCK; j++) {
+                ends[j] = (lo[j] + hi[j]) / 2;
+            }
+        }
+    }
+}
+
+int sweep_run(Pool *pool, const Expr *e, double a, double b, long n,
+              const double *params, long count, double *values) {
+    if (count <= 0) {
+        return 0;
+    }
+
+    long blocks = (count + EXPR_BLOCK - 1) / EXPR_BLOCK;
+    long segments = (n - 1 + SWEEP_SEGMENT - 1) / SWEEP_SEGMENT;
+    if (segments < 1) {
+        segments = 1;
+    }
+
+    double *padded = (double *)malloc(sizeof(double) * blocks * EXPR_BLOCK);
+    double *partial = (double *)malloc(sizeof(double) * blocks * segments * EXPR_BLOCK);
+    double *ends = (double *)malloc(sizeof(double) * blocks * EXPR_BLOCK);
+    if (!padded || !partial || !ends) {
+        free(padded);
+        free(partial);
+        free(ends);
+        return -1;
+    }
+
+    /* the last block is padded with a parameter known to be in the domain */
+    memcpy(padded, params, sizeof(double) * count);
+    for (long j = count; j < blocks * EXPR_BLOCK; j++) {
+        padded[j] = params[count - 1];
+    }
+
+    Sweep s = {e, a, (b - a) / n, n, padded, segments, blocks * segments,
+               partial, ends, 0};
+    pool_run(pool, run_tiles, &s);
+
+    for (long j = 0; j < count; j++) {
+        long block = j / EXPR_BLOCK;
+        long lane = j % EXPR_BLOCK;
+        double value = ends[block * EXPR_BLOCK + lane];
+        for (long seg = 0; seg < segments; seg++) {
+            value += partial[(block * segments + seg) * EXPR_BLOCK + lane];
+        }
+        values[j] = value * s.step;
+    }
+
+    free(padded);
+    free(partial);
+    free(ends);
+    return 0;
+}
@@ -0,0 +1,12 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+#include "expr.h"
+#include "pool.h"
+
+/* Trapezoid rule for e(x; params[j]) over [a, b] with n subintervals, for
+ * 0 <= j < count, all in one pass over shared tiles of the (x, p) grid.
+ * Returns -1 if out of memory. */
+int sweep_run(Pool *pool, const Expr *e, double a, double b, long n,
+              const double *params, long count, double *values);
+
+#endif /* ifndef SWEEP_H */
@@ -0,0 +1,254 @@
+#include "tanhsinh.h"
+#include <float.h>
+#include <math.h>
+#include "expr.h"
+#include "grid.h"
+#include "integrand.h"
+
+#define TANHSINH_BLOCK 64
+/* below this many new points a level is not worth waking the pool */
+#define TANHSINH_PARALLEL_POINTS 2048
+#define TANHSINH_CHUNK 256
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+
+/* Level k of the rule with step h = 2^-k sums w(t) f(x(t)) over t = j h,
+ * x(t) = c + r tanh(pi/2 sinh t). The level only adds the odd j. Near the
+ * ends x is formed from the distance d = 2 r / (e^(pi sinh t) + 1) to the
+ * endpoint, so singular integrands are never evaluated on the endpoint
+ * itself. An expression runs as its copy shifted to each end (expr_shift),
+ * which reads d directly and so keeps every digit of x - a; for a native
+ * integrand the points that round onto a are dropped instead, which caps
+ * the accuracy for a singularity at a point far from 0 (about
+ * 2 sqrt(ulp(a)) for 1/sqrt), and the mass they would have added counts
+ * towards the error. */
+typedef struct Side {
+    IntegralFunc f;
+    int shifted;        /* f reads sign * d rather than end + sign * d */
+    double end;
+    double sign;        /* direction from end into the interval */
+    double r;
+} Side;
+
+typedef struct Level {
+    const Side *sides;
+    double h;
+    long left;          /* new points with t > 0 on the left side */
+    long right;
+} Level;
+
+/* distance from the nearer end (in units of r) and weight of the pair at t */
+static double abscissa(double r, double t, double *weight) {
+    double u = M_PI_2 * sinh(t);
+    double q = exp(-2 * u);
+    *weight = r * M_PI_2 * cosh(t) * 4 * q / ((1 + q) * (1 + q));
+    return r * 2 * q / (1 + q);
+}
+
+/* y[i] = f at distance d[i] from the side's end, and keep[i] whether the
+ * point counts. A point that rounds onto the end counts only for a shifted
+ * expression, and only while its value is finite (a cancellation the shift
+ * could not fold away). */
+static void eval_side(const Side *side, const double *d, double *y, int *keep, long n) {
+    double x[TANHSINH_BLOCK] = {0};
+    int inside[TANHSINH_BLOCK];
+    for (long i = 0; i < n; i++) {
+        double abs_x = side->end + side->sign * d[i];
+        inside[i] = d[i] > 0 && (abs_x - side->end) * side->sign > 0;
+        keep[i] = inside[i] || (side->shifted && d[i] > 0);
+        if (side->shifted) {
+            x[i] = side->sign * (keep[i] ? d[i] : side->r);
+        }
+        else {
+            x[i] = keep[i] ? abs_x : side->end + side->sign * side->r;
+        }
+    }
+
+    integrand_eval(&side->f, x, y, n);
+    for (long i = 0; i < n; i++) {
+        keep[i] &= inside[i] || isfinite(y[i]);
+    }
+}
+
+/* Points 0 .. left - 1 are t = (2 i + 1) h on the left of the centre, the
+ * rest the same t on the right. */
+static double run_points(void *arg, long first, long count) {
+    const Level *lv = (const Level *)arg;
+    double value = 0;
+
+    long k = first;
+    while (k < first + count) {
+        int right = k >= lv->left;
+        long stop = right ? first + count : MIN(first + count, lv->left);
+        long len = MIN(stop - k, TANHSINH_BLOCK);
+        const Side *side = &lv->sides[right];
+
+        double d[TANHSINH_BLOCK];
+        double w[TANHSINH_BLOCK];
+        double y[TANHSINH_BLOCK];
+        int keep[TANHSINH_BLOCK];
+        for (long i = 0; i < len; i++) {
+            long j = right ? k + i - lv->left : k + i;
+            d[i] = abscissa(side->r, (2 * j + 1) * lv->h, &w[i]);
+        }
+        eval_side(side, d, y, keep, len);
+        for (long i = 0; i < len; i++) {
+            if (keep[i]) {
+                value += w[i] * y[i];
+            }
+        }
+        k += len;
+    }
+
+    return value;
+}
+
+/* The integral over the piece next to the side's end that the rule cannot
+ * reach, from the innermost point it may use: 2 d |f| is exact for an
+ * inverse square root singularity at the end and twice too much for a
+ * bounded integrand. */
+static double tail(const Side *side, double d) {
+    double y = 0;
+    int keep = 0;
+    eval_side(side, &d, &y, &keep, 1);
+    if (!keep) {
+        d = fabs(nextafter(side->end, side->end + side->sign) - side->end);
+        eval_side(side, &d, &y, &keep, 1);
+    }
+    return 2 * d * fabs(y);
+}
+
+/* Walks out from t = 0 in unit steps until the terms of one side drop below
+ * the rounding of the running sum or its points stop counting; returns the
+ * sum of the unit-step rule and the extent of each side. A side cut short
+ * by the rounding or by TANHSINH_TMAX adds its tail to *lost. */
+static double first_level(const Side *sides, double *extents, double *lost,
+                          long *evaluations) {
+    double r = sides[0].r;
+    double y = 0;
+    int keep = 0;
+    eval_side(&sides[0], &r, &y, &keep, 1);
+    double sum = r * M_PI_2 * y;
+    extents[0] = extents[1] = TANHSINH_TMAX;
+    *lost = 0;
+    *evaluations = 1;
+
+    int done[2] = {0, 0};
+    for (int t = 1; t <= TANHSINH_TMAX && !(done[0] && done[1]); t++) {
+        double w = 0;
+        double d = abscissa(r, t, &w);
+        for (int side = 0; side < 2; side++) {
+            if (done[side]) {
+                continue;
+            }
+            eval_side(&sides[side], &d, &y, &keep, 1);
+            *evaluations += 1;
+            double term = w * y;
+            if (!keep) {
+                *lost += tail(&sides[side], d);
+                *evaluations += 1;
+            }
+            if (!keep || fabs(term) <= DBL_EPSILON * fabs(sum)) {
+                extents[side] = t;
+                done[side] = 1;
+                continue;
+            }
+            sum += term;
+        }
+    }
+
+    double w = 0;
+    double d = abscissa(r, TANHSINH_TMAX, &w);
+    for (int side = 0; side < 2; side++) {
+        if (!done[side]) {
+            *lost += tail(&sides[side], d);
+            *evaluations += 1;
+        }
+    }
+    return sum;
+}
+
+static int integrate(IntegralCtx *ctx, const Side *sides, double abstol, double reltol,
+                     IntegralResult *res) {
+    double extents[2] = {0, 0};
+    double lost = 0;
+    double value = first_level(sides, extents, &lost, &res->evaluations);
+    double prev = value;
+    double prev2 = value;
+    res->value = value;
+    res->error = INFINITY;
+
+    Level lv = {sides, 1, 0, 0};
+    for (int k = 1; k <= TANHSINH_MAX_LEVELS; k++) {
+        lv.h /= 2;
+        /* odd multiples of h below each side's extent */
+        lv.left = (long)(extents[0] / lv.h + 1) / 2;
+        lv.right = (long)(extents[1] / lv.h + 1) / 2;
+        long n = lv.left + lv.right;
+
+        double sum = (n < TANHSINH_PARALLEL_POINTS) ? run_points(&lv, 0, n) :
+                     grid_run(ctx, run_points, &lv, n, TANHSINH_CHUNK);
+        value = value / 2 + lv.h * sum;
+        res->evaluations += n;
+
+        /* the number of correct digits roughly doubles per level, so the
+         * next difference is about the square of the last one's ratio */
+        double e1 = fabs(value - prev);
+        double e2 = fabs(value - prev2);
+        double estimate = (k >= 2 && e1 < e2) ? e1 * e1 / e2 : e1;
+        double error = estimate + lost;
+        double tol = fmax(abstol, reltol * fabs(value));
+        res->value = value;
+        res->error = fmax(error, 4 * DBL_EPSILON * fabs(value));
+        if (k >= TANHSINH_MIN_LEVELS && error <= tol) {
+            return 0;
+        }
+        /* more levels cannot win back what the rounding lost */
+        if (k >= TANHSINH_MIN_LEVELS && lost > tol && estimate <= lost) {
+            return -1;
+        }
+
+        prev2 = prev;
+        prev = value;
+    }
+
+    return -1;
+}
+
+int tanhsinh_integrate(IntegralCtx *ctx, const IntegralFunc *f, double a, double b,
+                       double abstol, double reltol, IntegralResult *res) {
+    if (a == b) {
+        res->value = 0;
+        res->error = 0;
+        res->evaluations = 0;
+        return 0;
+    }
+    if (a > b) {
+        int retval = tanhsinh_integrate(ctx, f, b, a, abstol, reltol, res);
+        res->value = -res->value;
+        return retval;
+    }
+
+    IntegralFunc func = {f ? f->fn : NULL, f ? f->expr : NULL};
+    double r = (b - a) / 2;
+    Side sides[2] = {{func, 0, a, 1, r}, {func, 0, b, -1, r}};
+    if (func.expr) {
+        IntegralExpr *left = expr_shift(func.expr, a);
+        IntegralExpr *right = expr_shift(func.expr, b);
+        if (left && right) {
+            sides[0].f.expr = left;
+            sides[1].f.expr = right;
+            sides[0].shifted = sides[1].shifted = 1;
+        }
+        else {
+            expr_free(left);
+            expr_free(right);
+        }
+    }
+
+    int retval = integrate(ctx, sides, abstol, reltol, res);
+    if (sides[0].shifted) {
+        expr_free((IntegralExpr *)sides[0].f.expr);
+        expr_free((IntegralExpr *)sides[1].f.expr);
+    }
+    return retval;
+}
@@ -0,0 +1,14 @@
+#ifndef TANHSINH_H
+#define TANHSINH_H
+#include "integral.h"
+
+#define TANHSINH_MAX_LEVELS 12
+/* levels an estimate needs before its error bound is trusted */
+#define TANHSINH_MIN_LEVELS 3
+/* t range limit; the points beyond it round onto the endpoints */
+#define TANHSINH_TMAX 6
+
+int tanhsinh_integrate(IntegralCtx *ctx, const IntegralFunc *f, double a, double b,
+                       double abstol, double reltol, IntegralResult *res);
+
+#endif /* ifndef TANHSINH_H */
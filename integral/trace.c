@@ -0,0 +1,298 @@
+#define _GNU_SOURCE
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define CACHE_LINE 64
+#define TRACE_MIN_SPANS 64
+
+typedef struct Span {
+    const char *name;
+    double start;
+    double end;
+    int cpu_start;
+    int cpu_end;
+    long long counters[TRACE_COUNTERS];     /* -1 if missing */
+} Span;
+
+/* value, time enabled and time running, as perf reads them */
+typedef struct Reading {
+    unsigned long long value;
+    unsigned long long enabled;
+    unsigned long long running;
+} Reading;
+
+typedef struct TraceWorker {
+    int opened;
+    int fds[TRACE_COUNTERS];    /* -1 if the kernel refused the event */
+    Reading begin[TRACE_COUNTERS];
+    long switches;
+    double start;
+    int cpu;
+    cpu_set_t seen;
+    Span *spans;
+    long count;
+    long size;
+} __attribute__((aligned(CACHE_LINE))) TraceWorker;
+
+struct Trace {
+    long workers;
+    double epoch;
+    pthread_mutex_t lock;   /* span arrays, against concurrent writers */
+    TraceWorker *w;
+};
+
+static const char *const COUNTER_NAMES[TRACE_COUNTERS] = {
+    "cycles", "instructions", "cache_misses", "migrations", "context_switches"
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static long context_switches(void) {
+    struct rusage ru;
+    if (getrusage(RUSAGE_THREAD, &ru) != 0) {
+        return 0;
+    }
+    return ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+/* Counts for the calling thread on any CPU. Kernel-side counting is tried
+ * first since migrations happen there; perf_event_paranoid 2 only allows
+ * user space, which still covers the hardware events. */
+static int open_counter(unsigned type, unsigned long long config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd < 0 && type == PERF_TYPE_HARDWARE) {
+        attr.exclude_kernel = 1;
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    return fd;
+}
+
+static void open_counters(TraceWorker *w) {
+    w->fds[TRACE_CYCLES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    w->fds[TRACE_INSTRUCTIONS] = open_counter(PERF_TYPE_HARDWARE,
+                                              PERF_COUNT_HW_INSTRUCTIONS);
+    w->fds[TRACE_CACHE_MISSES] = open_counter(PERF_TYPE_HARDWARE,
+                                              PERF_COUNT_HW_CACHE_MISSES);
+    w->fds[TRACE_MIGRATIONS] = open_counter(PERF_TYPE_SOFTWARE,
+                                            PERF_COUNT_SW_CPU_MIGRATIONS);
+    /* getrusage has them for free */
+    w->fds[TRACE_CONTEXT_SWITCHES] = -1;
+    w->opened = 1;
+}
+
+static int read_counter(int fd, Reading *r) {
+    return (fd >= 0 && read(fd, r, sizeof(*r)) == sizeof(*r)) ? 0 : -1;
+}
+
+Trace *trace_new(long workers) {
+    Trace *trace = (Trace *)calloc(1, sizeof(Trace));
+    if (!trace) {
+        return NULL;
+    }
+    if (posix_memalign((void **)&trace->w, CACHE_LINE, sizeof(TraceWorker) * workers) != 0) {
+        free(trace);
+        return NULL;
+    }
+    memset(trace->w, 0, sizeof(TraceWorker) * workers);
+
+    trace->workers = workers;
+    trace->epoch = now_seconds();
+    pthread_mutex_init(&trace->lock, NULL);
+    return trace;
+}
+
+void trace_delete(Trace *trace) {
+    for (long i = 0; i < trace->workers; i++) {
+        TraceWorker *w = &trace->w[i];
+        for (int c = 0; w->opened && c < TRACE_COUNTERS; c++) {
+            if (w->fds[c] >= 0) {
+                close(w->fds[c]);
+            }
+        }
+        free(w->spans);
+    }
+    pthread_mutex_destroy(&trace->lock);
+    free(trace->w);
+    free(trace);
+}
+
+void trace_begin(Trace *trace, long worker) {
+    TraceWorker *w = &trace->w[worker];
+    if (!w->opened) {
+        open_counters(w);
+    }
+
+    w->cpu = sched_getcpu();
+    w->switches = context_switches();
+    for (int c = 0; c < TRACE_COUNTERS; c++) {
+        if (w->fds[c] >= 0 && read_counter(w->fds[c], &w->begin[c]) < 0) {
+            close(w->fds[c]);
+            w->fds[c] = -1;
+        }
+    }
+    w->start = now_seconds();
+}
+
+void trace_end(Trace *trace, long worker, const char *name) {
+    double end = now_seconds();
+    TraceWorker *w = &trace->w[worker];
+
+    Span span;
+    span.name = name;
+    span.start = w->start - trace->epoch;
+    span.end = end - trace->epoch;
+    span.cpu_start = w->cpu;
+    span.cpu_end = sched_getcpu();
+    for (int c = 0; c < TRACE_COUNTERS; c++) {
+        Reading r;
+        span.counters[c] = -1;
+        if (read_counter(w->fds[c], &r) < 0) {
+            continue;
+        }
+        /* scaled up for the time the event was multiplexed out */
+        unsigned long long value = r.value - w->begin[c].value;
+        unsigned long long enabled = r.enabled - w->begin[c].enabled;
+        unsigned long long running = r.running - w->begin[c].running;
+        span.counters[c] = (running > 0 && running < enabled) ?
+                           (long long)((double)value * enabled / running) : (long long)value;
+    }
+    span.counters[TRACE_CONTEXT_SWITCHES] = context_switches() - w->switches;
+    if (span.counters[TRACE_MIGRATIONS] < 0) {
+        /* a lower bound without the software event */
+        span.counters[TRACE_MIGRATIONS] = (span.cpu_start != span.cpu_end);
+    }
+
+    pthread_mutex_lock(&trace->lock);
+    if (w->count == w->size) {
+        long size = w->size ? 2 * w->size : TRACE_MIN_SPANS;
+        Span *spans = (Span *)realloc(w->spans, sizeof(Span) * size);
+        if (!spans) {
+            pthread_mutex_unlock(&trace->lock);
+            return;
+        }
+        w->spans = spans;
+        w->size = size;
+    }
+    w->spans[w->count++] = span;
+    if (span.cpu_start >= 0) {
+        CPU_SET(span.cpu_start, &w->seen);
+    }
+    if (span.cpu_end >= 0) {
+        CPU_SET(span.cpu_end, &w->seen);
+    }
+    pthread_mutex_unlock(&trace->lock);
+}
+
+int trace_write_chrome(Trace *trace, const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+
+    pthread_mutex_lock(&trace->lock);
+    fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for (long i = 0; i < trace->workers; i++) {
+        fprintf(f, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %ld, "
+                   "\"args\": {\"name\": \"worker %ld\"}}",
+                i ? ",\n" : "", i, i);
+    }
+    for (long i = 0; i < trace->workers; i++) {
+        const TraceWorker *w = &trace->w[i];
+        for (long s = 0; s < w->count; s++) {
+            const Span *span = &w->spans[s];
+            fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %ld, "
+                       "\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"cpu\": %d, \"cpu_end\": %d",
+                    span->name, i, span->start * 1e6, (span->end - span->start) * 1e6,
+                    span->cpu_start, span->cpu_end);
+            for (int c = 0; c < TRACE_COUNTERS; c++) {
+                if (span->counters[c] >= 0) {
+                    fprintf(f, ", \"%s\": %lld", COUNTER_NAMES[c], span->counters[c]);
+                }
+            }
+            fprintf(f, "}}");
+        }
+    }
+    fprintf(f, "\n]}\n");
+    pthread_mutex_unlock(&trace->lock);
+
+    if (fclose(f) != 0) {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+static void print_count(FILE *out, long long value, int width) {
+    if (value < 0) {
+        fprintf(out, " %*s", width, "n/a");
+    }
+    else {
+        fprintf(out, " %*lld", width, value);
+    }
+}
+
+void trace_print(Trace *trace, FILE *out) {
+    fprintf(out, "worker  busy s  spans cpus last  migr         cycles   instructions"
+                 "   IPC   cache misses  ctx sw\n");
+    int missing = 0;
+
+    pthread_mutex_lock(&trace->lock);
+    for (long i = 0; i < trace->workers; i++) {
+        const TraceWorker *w = &trace->w[i];
+        double busy = 0;
+        long long totals[TRACE_COUNTERS] = {0};
+        for (long s = 0; s < w->count; s++) {
+            busy += w->spans[s].end - w->spans[s].start;
+            for (int c = 0; c < TRACE_COUNTERS; c++) {
+                if (w->spans[s].counters[c] < 0 || totals[c] < 0) {
+                    totals[c] = -1;
+                }
+                else {
+                    totals[c] += w->spans[s].counters[c];
+                }
+            }
+        }
+
+        fprintf(out, "%6ld %7.3f %6ld %4d %4d", i, busy, w->count, CPU_COUNT(&w->seen),
+                w->count ? w->spans[w->count - 1].cpu_end : -1);
+        print_count(out, totals[TRACE_MIGRATIONS], 5);
+        print_count(out, totals[TRACE_CYCLES], 14);
+        print_count(out, totals[TRACE_INSTRUCTIONS], 14);
+        if (totals[TRACE_CYCLES] > 0 && totals[TRACE_INSTRUCTIONS] >= 0) {
+            fprintf(out, " %5.2f", (double)totals[TRACE_INSTRUCTIONS] / totals[TRACE_CYCLES]);
+        }
+        else {
+            fprintf(out, " %5s", "n/a");
+        }
+        print_count(out, totals[TRACE_CACHE_MISSES], 14);
+        print_count(out, totals[TRACE_CONTEXT_SWITCHES], 7);
+        fprintf(out, "\n");
+        missing |= w->opened && w->fds[TRACE_CYCLES] < 0;
+    }
+    pthread_mutex_unlock(&trace->lock);
+
+    if (missing) {
+        fprintf(out, "n/a: no hardware counters (no PMU, or kernel.perf_event_paranoid)\n");
+    }
+}
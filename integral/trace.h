@@ -0,0 +1,37 @@
+#ifndef TRACE_H
+#define TRACE_H
+#include <stdio.h>
+
+/* Optional per-worker instrumentation: every traced span records its wall
+ * time, the CPU the worker started and ended on, and the deltas of the
+ * thread's hardware counters (perf_event_open, user space only), context
+ * switches and CPU migrations. Counters the kernel refuses are reported as
+ * missing; the timeline works regardless. */
+
+enum {
+    TRACE_CYCLES = 0,
+    TRACE_INSTRUCTIONS,
+    TRACE_CACHE_MISSES,
+    TRACE_MIGRATIONS,
+    TRACE_CONTEXT_SWITCHES,
+    TRACE_COUNTERS
+};
+
+typedef struct Trace Trace;
+
+Trace *trace_new(long workers);
+void trace_delete(Trace *trace);
+
+/* Called by worker itself around a span; the first call opens the
+ * worker's counters, so it must always come from the same thread. */
+void trace_begin(Trace *trace, long worker);
+void trace_end(Trace *trace, long worker, const char *name);
+
+/* Chrome trace event format (chrome://tracing, Perfetto): one complete
+ * event per span with the counters in its args. */
+int trace_write_chrome(Trace *trace, const char *path);
+/* Totals per worker: busy time, spans, CPUs, migrations, cycles,
+ * instructions, IPC, cache misses and context switches. */
+void trace_print(Trace *trace, FILE *out);
+
+#endif /* ifndef TRACE_H */
@@ -0,0 +1,133 @@
+#include "vmath.h"
+#include "kernel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VMATH_X86
+#endif
+
+/* Fixed-size blocks keep the trip count a multiple of every vector width;
+ * the tail goes through a block padded with 1.0 rather than zero, which
+ * keeps log, pow and division finite in the unused lanes. */
+#define VMATH_BLOCK 64
+
+typedef struct VmathOps {
+    void (*unary[5])(const double *x, double *y);
+    void (*pow)(const double *x, const double *p, double *y);
+} VmathOps;
+
+enum {
+    VM_EXP = 0,
+    VM_LOG,
+    VM_SIN,
+    VM_COS,
+    VM_ATAN
+};
+
+#define VMATH_BLOCK_FN(name, fn, attr) \
+    attr static void name(const double *restrict x, double *restrict y) { \
+        for (int i = 0; i < VMATH_BLOCK; i++) { \
+            y[i] = fn(x[i]); \
+        } \
+    }
+
+#define VMATH_DEFINE_OPS(suffix, attr) \
+    VMATH_BLOCK_FN(exp_##suffix, vm_exp, attr) \
+    VMATH_BLOCK_FN(log_##suffix, vm_log, attr) \
+    VMATH_BLOCK_FN(sin_##suffix, vm_sin, attr) \
+    VMATH_BLOCK_FN(cos_##suffix, vm_cos, attr) \
+    VMATH_BLOCK_FN(atan_##suffix, vm_atan, attr) \
+    attr static void pow_##suffix(const double *restrict x, \
+                                  const double *restrict p, \
+                                  double *restrict y) { \
+        for (int i = 0; i < VMATH_BLOCK; i++) { \
+            y[i] = vm_pow(x[i], p[i]); \
+        } \
+    } \
+    static const VmathOps ops_##suffix = { \
+        {exp_##suffix, log_##suffix, sin_##suffix, cos_##suffix, atan_##suffix}, \
+        pow_##suffix \
+    }
+
+VMATH_DEFINE_OPS(default, );
+#ifdef VMATH_X86
+VMATH_DEFINE_OPS(avx2, __attribute__((target("avx2"))));
+VMATH_DEFINE_OPS(avx512, __attribute__((target("avx512f"))));
+#endif
+
+static const VmathOps *vmath_ops(void) {
+#ifdef VMATH_X86
+    switch (kernel_isa()) {
+    case KERNEL_AVX2:
+        return &ops_avx2;
+    case KERNEL_AVX512:
+        return &ops_avx512;
+    default:
+        break;
+    }
+#endif
+    return &ops_default;
+}
+
+static void run_binary(const double *x, const double *p, double *y, long n) {
+    void (*block)(const double *, const double *, double *) = vmath_ops()->pow;
+    double xb[VMATH_BLOCK] __attribute__((aligned(64)));
+    double pb[VMATH_BLOCK] __attribute__((aligned(64)));
+    double yb[VMATH_BLOCK] __attribute__((aligned(64)));
+
+    long done = 0;
+    for (; done + VMATH_BLOCK <= n; done += VMATH_BLOCK) {
+        block(x + done, p + done, y + done);
+    }
+    if (done < n) {
+        long len = n - done;
+        for (long i = 0; i < VMATH_BLOCK; i++) {
+            xb[i] = (i < len) ? x[done + i] : 1.0;
+            pb[i] = (i < len) ? p[done + i] : 1.0;
+        }
+        block(xb, pb, yb);
+        memcpy(y + done, yb, sizeof(double) * len);
+    }
+}
+
+static void run_unary(int fn, const double *x, double *y, long n) {
+    void (*block)(const double *, double *) = vmath_ops()->unary[fn];
+    double xb[VMATH_BLOCK] __attribute__((aligned(64)));
+    double yb[VMATH_BLOCK] __attribute__((aligned(64)));
+
+    long done = 0;
+    for (; done + VMATH_BLOCK <= n; done += VMATH_BLOCK) {
+        block(x + done, y + done);
+    }
+    if (done < n) {
+        long len = n - done;
+        for (long i = 0; i < VMATH_BLOCK; i++) {
+            xb[i] = (i < len) ? x[done + i] : 1.0;
+        }
+        block(xb, yb);
+        memcpy(y + done, yb, sizeof(double) * len);
+    }
+}
+
+void vmath_exp(const double *x, double *y, long n) {
+    run_unary(VM_EXP, x, y, n);
+}
+
+void vmath_log(const double *x, double *y, long n) {
+    run_unary(VM_LOG, x, y, n);
+}
+
+void vmath_sin(const double *x, double *y, long n) {
+    run_unary(VM_SIN, x, y, n);
+}
+
+void vmath_cos(const double *x, double *y, long n) {
+    run_unary(VM_COS, x, y, n);
+}
+
+void vmath_atan(const double *x, double *y, long n) {
+    run_unary(VM_ATAN, x, y, n);
+}
+
+void vmath_pow(const double *x, const double *p, double *y, long n) {
+    run_binary(x, p, y, n);
+}
@@ -0,0 +1,361 @@
+#ifndef VMATH_H
+#define VMATH_H
+#include <stdint.h>
+#include <string.h>
+
+/* Branch-free double precision exp/log/sin/cos/atan/pow. Every function is
+ * straight-line arithmetic on the IEEE bit pattern with selects instead of
+ * branches, so a fixed-count loop over them vectorizes at whatever width the
+ * enclosing function is compiled for (SSE2 by default, AVX2 or AVX-512 via
+ * target attributes). Only SSE2 integer operations are used on the bits.
+ * GCC if-converts the selects only with -fno-trapping-math.
+ *
+ * Maximum error against a long double reference, checked by vmathtest:
+ *   vm_exp   1 ULP   whole range; 0 below -745.13, inf above 709.78
+ *   vm_log   1 ULP   whole range, subnormals included
+ *   vm_sin   1 ULP   |x| < 1e6; arguments are reduced by a three-part pi/2,
+ *   vm_cos   1 ULP   so accuracy degrades gradually past that
+ *   vm_atan  1 ULP   whole range
+ *   vm_pow   2 ULP   |y| <= 100, grows slowly with |y|; C99 special cases
+ *
+ * The polynomials and reductions follow fdlibm. */
+
+#define VM_INLINE static inline __attribute__((always_inline))
+
+/* adding this rounds |x| < 2^51 to an integer held in the low mantissa bits */
+#define VM_SHIFT 0x1.8p52
+
+VM_INLINE uint64_t vm_bits(double x) {
+    uint64_t u;
+    memcpy(&u, &x, sizeof(u));
+    return u;
+}
+
+VM_INLINE double vm_double(uint64_t u) {
+    double x;
+    memcpy(&x, &u, sizeof(x));
+    return x;
+}
+
+/* 2^n for -1022 <= n <= 1023 */
+VM_INLINE double vm_pow2(uint64_t n) {
+    return vm_double((n + 1023) << 52);
+}
+
+/* all ones if n is odd, zero otherwise */
+VM_INLINE uint64_t vm_odd_mask(uint64_t n) {
+    return -(n & 1);
+}
+
+VM_INLINE double vm_select(uint64_t mask, double a, double b) {
+    return vm_double((vm_bits(a) & mask) | (vm_bits(b) & ~mask));
+}
+
+/* Splits x into 26-bit halves by masking, so products of halves are exact
+ * with or without FMA contraction. */
+VM_INLINE double vm_high(double x) {
+    return vm_double(vm_bits(x) & 0xfffffffff8000000ULL);
+}
+
+/* e^(hi + lo) with |lo| far below ulp(hi) */
+VM_INLINE double vm_exp_dd(double hi, double lo) {
+    const double inv_ln2 = 1.44269504088896338700e+00;
+    const double ln2_hi = 6.93147180369123816490e-01;
+    const double ln2_lo = 1.90821492927058770002e-10;
+
+    /* keeps n inside the two-step scaling range; NaN passes through */
+    double x = hi > 709.8 ? 709.8 : hi;
+    x = x < -745.2 ? -745.2 : x;
+
+    double k = x * inv_ln2 + VM_SHIFT;
+    double n = k - VM_SHIFT;
+    /* r = rh - rl with rh exact */
+    double rh = x - n * ln2_hi;
+    double rl = n * ln2_lo - lo;
+    double r = rh - rl;
+
+    /* |r| <= ln2 / 2, e^r = 1 + r + r^2 * p(r) with p from the Taylor
+     * series through r^13 */
+    double p = 1.6059043836821613e-10;
+    p = p * r + 2.08767569878681e-09;
+    p = p * r + 2.505210838544172e-08;
+    p = p * r + 2.755731922398589e-07;
+    p = p * r + 2.7557319223985893e-06;
+    p = p * r + 2.48015873015873e-05;
+    p = p * r + 0.0001984126984126984;
+    p = p * r + 0.001388888888888889;
+    p = p * r + 0.008333333333333333;
+    p = p * r + 0.041666666666666664;
+    p = p * r + 0.16666666666666666;
+    p = p * r + 0.5;
+    double e = 1.0 + (rh + (r * r * p - rl));
+
+    /* n may reach -1075 or 1024, so scale by 2^n1 * 2^n2 */
+    uint64_t ni = vm_bits(k) - vm_bits(VM_SHIFT);
+    uint64_t n1 = vm_bits(n * 0.5 + VM_SHIFT) - vm_bits(VM_SHIFT);
+    return e * vm_pow2(n1) * vm_pow2(ni - n1);
+}
+
+VM_INLINE double vm_exp(double x) {
+    return vm_exp_dd(x, 0);
+}
+
+/* x = 2^k * m with m in [sqrt(2)/2, sqrt(2)), subnormals included; returns
+ * f = m - 1, which is exact */
+VM_INLINE double vm_log_reduce(double x, double *k) {
+    double sub = x < 0x1p-1022 ? 54.0 : 0.0;
+    double xs = x < 0x1p-1022 ? x * 0x1p54 : x;
+
+    uint64_t u = vm_bits(xs) + ((uint64_t)(0x3ff00000 - 0x3fe6a09e) << 32);
+    *k = vm_double((u >> 52) | 0x4330000000000000ULL) - (0x1p52 + 1023) - sub;
+    return vm_double((u & 0x000fffffffffffffULL) + ((uint64_t)0x3fe6a09e << 32)) - 1.0;
+}
+
+VM_INLINE double vm_log(double x) {
+    const double ln2_hi = 6.93147180369123816490e-01;
+    const double ln2_lo = 1.90821492927058770002e-10;
+    const double lg1 = 6.666666666666735130e-01;
+    const double lg2 = 3.999999999940941908e-01;
+    const double lg3 = 2.857142874366239149e-01;
+    const double lg4 = 2.222219843214978396e-01;
+    const double lg5 = 1.818357216161805012e-01;
+    const double lg6 = 1.531383769920937332e-01;
+    const double lg7 = 1.479819860511658591e-01;
+
+    /* log(1 + f) = f - hfsq + s * (hfsq + R(s^2)), s = f / (2 + f) */
+    double k;
+    double f = vm_log_reduce(x, &k);
+    double s = f / (2.0 + f);
+    double z = s * s;
+    double w = z * z;
+    double t1 = w * (lg2 + w * (lg4 + w * lg6));
+    double t2 = z * (lg1 + w * (lg3 + w * (lg5 + w * lg7)));
+    double hfsq = 0.5 * f * f;
+    double y = s * (hfsq + t2 + t1) + k * ln2_lo - hfsq + f + k * ln2_hi;
+
+    y = x == 0 ? -__builtin_inf() : y;
+    y = x < 0 ? __builtin_nan("") : y;
+    y = x == __builtin_inf() ? x : y;
+    return x != x ? x : y;
+}
+
+/* log(x) as hi + lo for finite positive x, good to about 2^-63 relative,
+ * which is what pow needs to stay within an ulp or two. Same reduction as
+ * vm_log, but R is the plain atanh series carried to s^22 (fdlibm's minimax
+ * R is only good to 2^-58) and the rounding of s is corrected. */
+VM_INLINE double vm_log_dd(double x, double *lo) {
+    const double ln2_hi = 6.93147180369123816490e-01;
+    const double ln2_lo = 1.90821492927058770002e-10;
+
+    double k;
+    double f = vm_log_reduce(x, &k);
+    double d = 2.0 + f;
+    double s = f / d;
+    double z = s * s;
+    double r = 2.0 / 23;
+    r = r * z + 2.0 / 21;
+    r = r * z + 2.0 / 19;
+    r = r * z + 2.0 / 17;
+    r = r * z + 2.0 / 15;
+    r = r * z + 2.0 / 13;
+    r = r * z + 2.0 / 11;
+    r = r * z + 2.0 / 9;
+    r = r * z + 2.0 / 7;
+    r = r * z + 2.0 / 5;
+    r = r * z + 2.0 / 3;
+    r *= z;
+    double hfsq = 0.5 * f * f;
+
+    /* ds = f / (2 + f) - s from the exact residual; d(tail)/ds ~ hfsq + 3R */
+    double dl = (2.0 - d) + f;
+    double sh = vm_high(s);
+    double sl = s - sh;
+    double dh = vm_high(d);
+    double dt = d - dh;
+    double res = (((f - sh * dh) - sh * dt) - sl * dh) - sl * dt;
+    double ds = (res - s * dl) / d;
+
+    /* hfsq exactly, as hh + hl */
+    double fh = vm_high(f);
+    double fl = f - fh;
+    double hh = hfsq;
+    double hl = 0.5 * (((fh * fh - 2 * hh) + 2 * fh * fl) + fl * fl);
+
+    /* tail = s * (hfsq + R) as th + tl */
+    double q = hh + r;
+    double ql = (hh - q) + r;
+    double qh = vm_high(q);
+    double qt = q - qh;
+    double th = s * q;
+    double tl = (((sh * qh - th) + sh * qt) + sl * qh) + sl * qt;
+    tl += s * (ql + hl) + ds * (hfsq + 3 * r);
+
+    /* k * ln2_hi + f - hh + th with the rounding errors collected in e */
+    double a = f - hh;
+    double e = (f - a) - hh;
+    double kh = k * ln2_hi;
+    double hi = kh + a;
+    e += (kh - hi) + a;
+    double hi2 = hi + th;
+    e += (hi - hi2) + th;
+    e += tl - hl + k * ln2_lo;
+    hi = hi2;
+
+    double sum = hi + e;
+    *lo = e - (sum - hi);
+    return sum;
+}
+
+/* sin(r + rl) and cos(r + rl) for |r| <= pi/4, rl below ulp(r) */
+VM_INLINE double vm_sin_poly(double r, double rl) {
+    double z = r * r;
+    double v = z * r;
+    double p = 1.58969099521155010221e-10;
+    p = p * z - 2.50507602534068634195e-08;
+    p = p * z + 2.75573137070700676789e-06;
+    p = p * z - 1.98412698298579493134e-04;
+    p = p * z + 8.33333333332248946124e-03;
+    return r - ((z * (0.5 * rl - v * p) - rl) - v * -1.66666666666666324348e-01);
+}
+
+VM_INLINE double vm_cos_poly(double r, double rl) {
+    double z = r * r;
+    double p = -1.13596475577881948265e-11;
+    p = p * z + 2.08757232129817482790e-09;
+    p = p * z - 2.75573143513906633035e-07;
+    p = p * z + 2.48015872894767294178e-05;
+    p = p * z - 1.38888888888741095749e-03;
+    p = p * z + 4.16666666666666019037e-02;
+    double hz = 0.5 * z;
+    double w = 1.0 - hz;
+    return w + (((1.0 - w) - hz) + (z * z * p - r * rl));
+}
+
+/* sin(x + quadrant * pi/2) */
+VM_INLINE double vm_sin_quadrant(double x, uint64_t quadrant) {
+    const double inv_pio2 = 6.36619772367581382433e-01;
+    const double pio2_1 = 1.57079632673412561417e+00;
+    const double pio2_2 = 6.07710050630396597660e-11;
+    const double pio2_3 = 2.02226624871116645580e-21;
+
+    /* every n * pio2_i is exact while |n| < 2^20 */
+    double k = x * inv_pio2 + VM_SHIFT;
+    double n = k - VM_SHIFT;
+    double a = x - n * pio2_1;
+    double w = n * pio2_2;
+    double r1 = a - w;
+    double w2 = n * pio2_3;
+    double r = r1 - w2;
+    double rl = ((r1 - r) - w2) + ((a - r1) - w);
+
+    uint64_t q = vm_bits(k) - vm_bits(VM_SHIFT) + quadrant;
+    double y = vm_select(vm_odd_mask(q), vm_cos_poly(r, rl), vm_sin_poly(r, rl));
+    return vm_double(vm_bits(y) ^ ((q & 2) << 62));
+}
+
+VM_INLINE double vm_sin(double x) {
+    return vm_sin_quadrant(x, 0);
+}
+
+VM_INLINE double vm_cos(double x) {
+    return vm_sin_quadrant(x, 1);
+}
+
+VM_INLINE double vm_atan(double x) {
+    const double a0 = 3.33333333333329318027e-01;
+    const double a1 = -1.99999999998764832476e-01;
+    const double a2 = 1.42857142725034663711e-01;
+    const double a3 = -1.11111104054623557880e-01;
+    const double a4 = 9.09088713343650656196e-02;
+    const double a5 = -7.69187620504482999495e-02;
+    const double a6 = 6.66107313738753120669e-02;
+    const double a7 = -5.83357013379057348645e-02;
+    const double a8 = 4.97687799461593236017e-02;
+    const double a9 = -3.65315727442169155270e-02;
+    const double a10 = 1.62858201153657823623e-02;
+
+    uint64_t sign = vm_bits(x) & 0x8000000000000000ULL;
+    double ax = vm_double(vm_bits(x) ^ sign);
+
+    /* atan(ax) = hi + atan(t) on five ranges, picked without branches */
+    double num = ax;
+    double den = 1.0;
+    double hi = 0;
+    double lo = 0;
+    num = ax >= 0.4375 ? 2.0 * ax - 1.0 : num;
+    den = ax >= 0.4375 ? 2.0 + ax : den;
+    hi = ax >= 0.4375 ? 4.63647609000806093515e-01 : hi;
+    lo = ax >= 0.4375 ? 2.26987774529616870924e-17 : lo;
+    num = ax >= 0.6875 ? ax - 1.0 : num;
+    den = ax >= 0.6875 ? ax + 1.0 : den;
+    hi = ax >= 0.6875 ? 7.85398163397448278999e-01 : hi;
+    lo = ax >= 0.6875 ? 3.06161699786838301793e-17 : lo;
+    num = ax >= 1.1875 ? ax - 1.5 : num;
+    den = ax >= 1.1875 ? 1.0 + 1.5 * ax : den;
+    hi = ax >= 1.1875 ? 9.82793723247329054082e-01 : hi;
+    lo = ax >= 1.1875 ? 1.39033110312309984516e-17 : lo;
+    num = ax >= 2.4375 ? -1.0 : num;
+    den = ax >= 2.4375 ? ax : den;
+    hi = ax >= 2.4375 ? 1.57079632679489655800e+00 : hi;
+    lo = ax >= 2.4375 ? 6.12323399573676603587e-17 : lo;
+
+    double t = num / den;
+    double z = t * t;
+    double w = z * z;
+    double s1 = z * (a0 + w * (a2 + w * (a4 + w * (a6 + w * (a8 + w * a10)))));
+    double s2 = w * (a1 + w * (a3 + w * (a5 + w * (a7 + w * a9))));
+    double y = hi - ((t * (s1 + s2) - lo) - t);
+    return vm_double(vm_bits(y) ^ sign);
+}
+
+VM_INLINE double vm_pow(double x, double y) {
+    const double inf = __builtin_inf();
+    double ax = vm_double(vm_bits(x) & 0x7fffffffffffffffULL);
+    double ay = vm_double(vm_bits(y) & 0x7fffffffffffffffULL);
+
+    double lo;
+    double hi = vm_log_dd(ax, &lo);
+    hi = ax == 0 ? -inf : hi;
+    hi = ax == inf ? inf : hi;
+
+    /* y * log|x| as ph + pl, Dekker's product again */
+    double ph = y * hi;
+    double yh = vm_high(y);
+    double yl = y - yh;
+    double lh = vm_high(hi);
+    double ll = hi - lh;
+    double pl = ((yh * lh - ph) + yh * ll + yl * lh) + yl * ll + y * lo;
+    /* only matters in range; elsewhere it may be inf - inf */
+    pl = vm_double(vm_bits(ph) & 0x7fffffffffffffffULL) < 1024.0 ? pl : 0;
+    double r = vm_exp_dd(ph, pl);
+
+    /* d = |y| - 2 * round(|y| / 2) is 0 for even y, +-1 for odd y and
+     * strictly between for non-integral y */
+    double w = ay < 0x1p60 ? ay : 0x1p60;
+    double d = w - 2 * ((w * 0.5 + 0x1p52) - 0x1p52);
+    double d2 = d * d;
+    double sign = vm_double((vm_bits(x) & 0x8000000000000000ULL) | vm_bits(1.0));
+
+    r *= d2 == 1.0 ? sign : 1.0;
+    /* negative finite x to a non-integral power; NaN by multiplying */
+    double domain = (x < 0 ? 1.0 : 0.0) * (x > -inf ? 1.0 : 0.0) *
+                    (d2 > 0 ? 1.0 : 0.0) * (d2 < 1 ? 1.0 : 0.0);
+    r = domain != 0 ? __builtin_nan("") : r;
+    r = x == -1.0 ? (ay == inf ? 1.0 : r) : r;
+    r = x != x ? x + y : r;
+    r = y != y ? x + y : r;
+    r = x == 1.0 ? 1.0 : r;
+    r = y == 0 ? 1.0 : r;
+    return r;
+}
+
+/* Array forms for callers outside a SIMD block; they dispatch on
+ * kernel_isa() like the integration kernels do. */
+void vmath_exp(const double *x, double *y, long n);
+void vmath_log(const double *x, double *y, long n);
+void vmath_sin(const double *x, double *y, long n);
+void vmath_cos(const double *x, double *y, long n);
+void vmath_atan(const double *x, double *y, long n);
+void vmath_pow(const double *x, const double *p, double *y, long n);
+
+#endif /* ifndef VMATH_H */
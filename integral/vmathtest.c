@@ -0,0 +1,217 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "kernel.h"
+#include "vmath.h"
+
+/* Checks vmath against a long double reference and times it against glibc
+ * for every kernel ISA the CPU supports. Exits non-zero if any function
+ * exceeds the bound documented in vmath.h. */
+
+#define SAMPLES (1L << 20)
+#define ROUNDS 8
+
+typedef enum Dist {
+    DIST_UNIFORM = 0,
+    DIST_LOG       /* log-uniform magnitude, random sign unless lo > 0 */
+} Dist;
+
+typedef struct Case {
+    const char *name;
+    double ulp_bound;
+    void (*vec)(const double *x, double *y, long n);
+    double (*libm)(double);
+    long double (*ref)(long double);
+    Dist dist;
+    double lo;
+    double hi;
+} Case;
+
+static const Case cases[] = {
+    {"exp", 1.0, vmath_exp, exp, expl, DIST_UNIFORM, -745.0, 709.7},
+    {"exp", 1.0, vmath_exp, exp, expl, DIST_UNIFORM, -1.0, 1.0},
+    {"log", 1.0, vmath_log, log, logl, DIST_LOG, 1e-310, 1e308},
+    {"log", 1.0, vmath_log, log, logl, DIST_UNIFORM, 0.5, 2.0},
+    {"sin", 1.0, vmath_sin, sin, sinl, DIST_UNIFORM, -10.0, 10.0},
+    {"sin", 1.0, vmath_sin, sin, sinl, DIST_UNIFORM, -1e6, 1e6},
+    {"cos", 1.0, vmath_cos, cos, cosl, DIST_UNIFORM, -10.0, 10.0},
+    {"cos", 1.0, vmath_cos, cos, cosl, DIST_UNIFORM, -1e6, 1e6},
+    {"atan", 1.0, vmath_atan, atan, atanl, DIST_UNIFORM, -4.0, 4.0},
+    {"atan", 1.0, vmath_atan, atan, atanl, DIST_LOG, -1e300, 1e300},
+};
+
+static unsigned long long rng_state = 0x9e3779b97f4a7c15ULL;
+
+static double uniform(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (rng_state >> 11) * 0x1p-53;
+}
+
+static double sample(Dist dist, double lo, double hi) {
+    if (dist == DIST_UNIFORM) {
+        return lo + (hi - lo) * uniform();
+    }
+    double mag_lo = (lo > 0) ? log(lo) : log(1e-300);
+    double x = exp(mag_lo + (log(fabs(hi)) - mag_lo) * uniform());
+    return (lo < 0 && uniform() < 0.5) ? -x : x;
+}
+
+/* distance from the reference in units of the last place of the result */
+static double ulp_error(double y, long double ref) {
+    if (isnan(y) || isnan((double)ref)) {
+        return (isnan(y) && isnan((double)ref)) ? 0 : INFINITY;
+    }
+    double r = (double)ref;
+    if (isinf(r) || isinf(y)) {
+        return (y == r) ? 0 : INFINITY;
+    }
+    double ulp = nextafter(fabs(r), INFINITY) - fabs(r);
+    if (fabs((long double)y) < fabsl(ref) && fabs(r) == fabsl(ref)) {
+        ulp = fabs(r) - nextafter(fabs(r), 0);
+    }
+    return (double)(fabsl((long double)y - ref) / ulp);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double max_error(const double *x, const double *y, long double (*ref)(long double),
+                        long n, double *worst_x) {
+    double worst = 0;
+    for (long i = 0; i < n; i++) {
+        double err = ulp_error(y[i], ref(x[i]));
+        if (err > worst) {
+            worst = err;
+            *worst_x = x[i];
+        }
+    }
+    return worst;
+}
+
+static int run_case(const Case *c, double *x, double *y) {
+    for (long i = 0; i < SAMPLES; i++) {
+        x[i] = sample(c->dist, c->lo, c->hi);
+    }
+
+    double t0 = now();
+    for (int r = 0; r < ROUNDS; r++) {
+        c->vec(x, y, SAMPLES);
+    }
+    double t_vec = now() - t0;
+
+    double worst_x = 0;
+    double worst = max_error(x, y, c->ref, SAMPLES, &worst_x);
+
+    volatile double sink = 0;
+    t0 = now();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (long i = 0; i < SAMPLES; i++) {
+            y[i] = c->libm(x[i]);
+        }
+        sink += y[r];
+    }
+    double t_libm = now() - t0;
+
+    double libm_x = 0;
+    double libm_worst = max_error(x, y, c->ref, SAMPLES, &libm_x);
+
+    int ok = worst <= c->ulp_bound;
+    printf("  %-5s [%9.3g, %9.3g]  %5.2f ulp (x=%-12.6g) glibc %5.2f ulp  "
+           "%6.2f ns vs %6.2f ns  %5.2fx  %s\n",
+           c->name, c->lo, c->hi, worst, worst_x, libm_worst,
+           t_vec / ROUNDS / SAMPLES * 1e9, t_libm / ROUNDS / SAMPLES * 1e9,
+           t_libm / t_vec, ok ? "ok" : "FAIL");
+    return ok;
+}
+
+static int run_pow(double *x, double *y) {
+    double *p = (double *)malloc(sizeof(double) * SAMPLES);
+    if (!p) {
+        return 0;
+    }
+    for (long i = 0; i < SAMPLES; i++) {
+        x[i] = sample(DIST_LOG, 1e-3, 1e3);
+        p[i] = sample(DIST_UNIFORM, -100, 100);
+    }
+
+    double t0 = now();
+    for (int r = 0; r < ROUNDS; r++) {
+        vmath_pow(x, p, y, SAMPLES);
+    }
+    double t_vec = now() - t0;
+
+    double worst = 0;
+    for (long i = 0; i < SAMPLES; i++) {
+        double err = ulp_error(y[i], powl(x[i], p[i]));
+        worst = (err > worst) ? err : worst;
+    }
+
+    t0 = now();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (long i = 0; i < SAMPLES; i++) {
+            y[i] = pow(x[i], p[i]);
+        }
+    }
+    double t_libm = now() - t0;
+
+    /* C99 Annex F special cases */
+    static const double special[][3] = {
+        {-2.0, 3.0, -8.0}, {-2.0, 2.0, 4.0}, {-2.0, 0.5, NAN},
+        {0.0, -1.0, INFINITY}, {-0.0, -3.0, -INFINITY}, {0.0, 2.0, 0.0},
+        {-1.0, INFINITY, 1.0}, {1.0, NAN, 1.0}, {NAN, 0.0, 1.0},
+        {0.5, INFINITY, 0.0}, {2.0, -INFINITY, 0.0}, {-INFINITY, 3.0, -INFINITY},
+        {-INFINITY, 0.5, INFINITY}, {2.0, 1024.0, INFINITY}, {2.0, -1075.0, 0.0},
+        {-8.0, 1.0 / 3.0, NAN}, {-1.5, 9007199254740993.0, INFINITY}
+    };
+    int special_ok = 1;
+    for (size_t i = 0; i < sizeof(special) / sizeof(special[0]); i++) {
+        double r = 0;
+        vmath_pow(&special[i][0], &special[i][1], &r, 1);
+        double want = special[i][2];
+        if (!(r == want && signbit(r) == signbit(want)) && !(isnan(r) && isnan(want))) {
+            printf("  pow(%g, %g) = %g, want %g\n", special[i][0], special[i][1], r, want);
+            special_ok = 0;
+        }
+    }
+
+    int ok = worst <= 2.0 && special_ok;
+    printf("  %-5s [%9.3g, %9.3g]  %5.2f ulp                   "
+           "          %6.2f ns vs %6.2f ns  %5.2fx  %s\n",
+           "pow", 1e-3, 1e3, worst,
+           t_vec / ROUNDS / SAMPLES * 1e9, t_libm / ROUNDS / SAMPLES * 1e9,
+           t_libm / t_vec, ok ? "ok" : "FAIL");
+    free(p);
+    return ok;
+}
+
+int main(void) {
+    double *x = (double *)malloc(sizeof(double) * SAMPLES);
+    double *y = (double *)malloc(sizeof(double) * SAMPLES);
+    if (!x || !y) {
+        fprintf(stderr, "malloc failed\n");
+        return EXIT_FAILURE;
+    }
+
+    int ok = 1;
+    for (int isa = KERNEL_SSE2; isa < KERNEL_ISA_COUNT; isa++) {
+        if (kernel_init((KernelIsa)isa) != 0) {
+            continue;
+        }
+        printf("%s:\n", kernel_name((KernelIsa)isa));
+        for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+            ok &= run_case(&cases[i], x, y);
+        }
+        ok &= run_pow(x, y);
+    }
+
+    free(x);
+    free(y);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -9,6 +9,7 @@
 #include <ifaddrs.h>
 #include <unistd.h>
 #include <errno.h>
+#include <signal.h>
 #include <pthread.h>
 #include <netdb.h>
 #include <linux/if_link.h>
@@ -16,49 +17,138 @@
 #include <net/if.h>
 #include <netinet/tcp.h>
 #include "common.h"
+#include "protocol.h"
+#include <time.h>
 
 static int bind_socket(int fd);
 static int broadcast(int broadcastfd);
 static int server_handshake(int sockfd);
 static void *thread_routine(void *data);
 
+// jobs sent ahead on a connection, so the server never waits for the next
+#define CLIENT_WINDOW 2
+
+// the work split into count jobs, handed out to the connections in order;
+// the jobs in flight on a lost connection go back for the others to take
+typedef struct JobQueue
+{
+    pthread_mutex_t lock;
+    pthread_cond_t changed;     // a job came back or finished, or one failed
+    long next;
+    long count;
+    long finished;
+    long *retry;                // job ids put back, taken before the next ones
+    long retry_count;
+    int failed;                 // a server rejected a job, retrying is useless
+    uint32_t flags;
+    const char *expr;   // empty for the servers' built-in integrand
+    double *values;
+    double *errors;
+} JobQueue;
+
 typedef struct ThreadArgs
 {
     long index;
-    long total_threads;
     int sockfd;
     int broadcastfd;
-    double result;
+    long window;
+    JobQueue *queue;
+    long jobs;      // done over this thread's connection
 } ThreadArgs;
 
+static int run_jobs(int serverfd, ThreadArgs *args);
+static int usage(void);
+
 pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 
 int main(int argc, char *argv[])
 {
     int retval = EXIT_SUCCESS;
     int broadcastfd = 0;
+    long job_count = 0;
+    long window = CLIENT_WINDOW;
+    JobQueue queue = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, 0, NULL, 0, 0,
+                      0, "", NULL, NULL};
 
-    if (argc != 2)
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "j:w:Me:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'j':
+            if (parse_arg(optarg, &job_count) < 0)
+            {
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'w':
+            if (parse_arg(optarg, &window) < 0)
+            {
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'M':
+            queue.flags |= JOB_MIXED;
+            break;
+        case 'e':
+            if (strlen(optarg) > PROTO_MAX_EXPR)
+            {
+                fprintf(stderr, "expression longer than %d bytes\n", PROTO_MAX_EXPR);
+                return EXIT_FAILURE;
+            }
+            queue.expr = optarg;
+            break;
+        default:
+            return usage();
+        }
+    }
+    if (optind != argc - 1)
     {
-        fprintf(stderr, "Usage: client [worker_count]\n");
+        return usage();
+    }
+    if ((queue.flags & JOB_MIXED) && queue.expr[0])
+    {
+        fprintf(stderr, "-M needs the built-in integrand, not -e\n");
         return EXIT_FAILURE;
     }
+    // a write to a lost server fails with EPIPE instead of ending the run
+    signal(SIGPIPE, SIG_IGN);
 
     long n = 0;
-    if (parse_arg(argv[1], &n) < 0)
+    if (parse_arg(argv[optind], &n) < 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    queue.count = job_count ? job_count : n;
+    if (queue.count > TOTAL_SUBINTERVALS)
+    {
+        fprintf(stderr, "more jobs than subintervals\n");
+        return EXIT_FAILURE;
+    }
+    queue.values = (double *)calloc(queue.count, sizeof(double));
+    queue.errors = (double *)calloc(queue.count, sizeof(double));
+    queue.retry = (long *)calloc(queue.count, sizeof(long));
+    if (!queue.values || !queue.errors || !queue.retry)
     {
+        perror("calloc");
+        free(queue.values);
+        free(queue.errors);
+        free(queue.retry);
         return EXIT_FAILURE;
     }
 
     pthread_t threads[n];
     ThreadArgs threadargs[n];
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
 
     broadcastfd = socket(AF_INET, SOCK_DGRAM, 0);
     if (broadcastfd < 0)
     {
         perror("socket");
         retval = EXIT_FAILURE;
-        goto RETURN;
+        goto FREE_QUEUE;
     }
 
     int on = 1;
@@ -125,38 +215,78 @@ int main(int argc, char *argv[])
     for (long i = 0; i < n; i++)
     {
         threadargs[i].index = i;
-        threadargs[i].total_threads = n;
         threadargs[i].sockfd = sockfd;
         threadargs[i].broadcastfd = broadcastfd;
+        threadargs[i].window = window;
+        threadargs[i].queue = &queue;
+        threadargs[i].jobs = 0;
 
-        if (pthread_create(&threads[i], NULL, thread_routine, &threadargs[i]) != 0)
+        if ((errno = pthread_create(&threads[i], NULL, thread_routine, &threadargs[i])) != 0)
         {
             perror("pthread_create");
             goto CLOSE_SOCKFD;
         }
     }
 
-    double value = 0;
     for (long i = 0; i < n; i++)
     {
-        if (pthread_join(threads[i], NULL) != 0)
+        if ((errno = pthread_join(threads[i], NULL)) != 0)
         {
             perror("pthread_join");
             goto CLOSE_SOCKFD;
         }
-        value += threadargs[i].result;
+    }
+
+    struct timespec finished;
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    if (queue.failed || queue.finished < queue.count)
+    {
+        fprintf(stderr, "%ld of %ld jobs done: %s\n", queue.finished, queue.count,
+                queue.failed ? "a server rejected a job" : "no server left for the rest");
+        retval = EXIT_FAILURE;
+        goto CLOSE_SOCKFD;
+    }
+
+    // in job order, whichever connection ran them
+    double value = 0;
+    double error = 0;
+    for (long i = 0; i < queue.count; i++)
+    {
+        value += queue.values[i];
+        error += queue.errors[i];
     }
 
     printf("\nResult value: %lg\n", value);
+    if (queue.flags & JOB_MIXED)
+    {
+        printf("Error estimate: %lg\n", error);
+    }
+    printf("%ld jobs over %ld connections in %.3lf s\n", queue.count, n,
+           (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) * 1e-9);
 
 CLOSE_SOCKFD:
     close(sockfd);
 CLOSE_BROADCASTFD:
     close(broadcastfd);
-RETURN:
+FREE_QUEUE:
+    free(queue.values);
+    free(queue.errors);
+    free(queue.retry);
     return retval;
 }
 
+int usage(void)
+{
+    fprintf(stderr, "Usage: client [-j job count] [-w jobs in flight per connection] [-M] "
+                    "[-e expression]\n"
+                    "              connection_count\n"
+                    "The jobs (one per connection by default) are shared out over the\n"
+                    "connections, which stay open until none are left. -M asks the servers\n"
+                    "for float32 evaluation with an error estimate. -e integrates an\n"
+                    "expression in x, in integral's syntax, instead of the built-in one.\n");
+    return EXIT_FAILURE;
+}
+
 int bind_socket(int fd)
 {
     struct sockaddr_in addr;
@@ -222,15 +352,15 @@ RETURN:
 
 int server_handshake(int sockfd)
 {
-    char buf[MAX_MSG_SIZE + 1] = {0};
     int fd = accept(sockfd, NULL, NULL);
-    ssize_t bytes_read = read(fd, buf, MAX_MSG_SIZE);
-    if (bytes_read < 0)
+    if (fd < 0)
     {
-        perror("read");
+        perror("accept");
         return -1;
     }
-    else if(bytes_read == 0)
+
+    Frame frame;
+    if (proto_recv(fd, &frame) != 0 || frame.type != MSG_HELLO)
     {
         puts("Lost connection to server...");
         close(fd);
@@ -249,8 +379,147 @@ int server_handshake(int sockfd)
     setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &keepcnt, sizeof(int));
     setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &keepidle, sizeof(int));
     setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &keepintvl, sizeof(int));
+    // pipelined jobs are small frames that should not wait for more data
+    int nodelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(int));
 
-    return (strcmp(MSG_RESPONSE, buf) == 0) ? fd : -1;
+    return fd;
+}
+
+// The next job, or -1 once there are none left to start. With wait, it
+// stays for the jobs in flight elsewhere, which may yet come back.
+static long take_job(JobQueue *queue, int wait)
+{
+    long id = -1;
+    pthread_mutex_lock(&queue->lock);
+    while (!queue->failed)
+    {
+        if (queue->retry_count > 0)
+        {
+            id = queue->retry[--queue->retry_count];
+            break;
+        }
+        if (queue->next < queue->count)
+        {
+            id = queue->next++;
+            break;
+        }
+        if (!wait || queue->finished == queue->count)
+        {
+            break;
+        }
+        pthread_cond_wait(&queue->changed, &queue->lock);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return id;
+}
+
+static void finish_job(JobQueue *queue, long id, double value, double error)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->values[id] = value;
+    queue->errors[id] = error;
+    queue->finished++;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static void return_jobs(JobQueue *queue, const long *ids, long count)
+{
+    pthread_mutex_lock(&queue->lock);
+    for (long i = 0; i < count; i++)
+    {
+        queue->retry[queue->retry_count++] = ids[i];
+    }
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static void fail_jobs(JobQueue *queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->failed = 1;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// Keeps up to window jobs in flight on the connection until every job is
+// done, then says goodbye. If the connection goes, so do its jobs in
+// flight, back to the queue.
+int run_jobs(int serverfd, ThreadArgs *args)
+{
+    JobQueue *queue = args->queue;
+    long per_job = TOTAL_SUBINTERVALS / queue->count;
+    long inflight = 0;
+    long *ids = (long *)malloc(sizeof(long) * args->window);
+    if (!ids)
+    {
+        perror("malloc");
+        return -1;
+    }
+
+    while (1)
+    {
+        long id = 0;
+        while (inflight < args->window && (id = take_job(queue, inflight == 0)) >= 0)
+        {
+            Job job;
+            job.first = id * per_job;
+            job.count = (id != queue->count - 1) ? per_job : TOTAL_SUBINTERVALS - job.first;
+            job.flags = queue->flags;
+            strcpy(job.expr, queue->expr);
+            ids[inflight++] = id;
+            if (proto_send_job(serverfd, id, &job) < 0)
+            {
+                goto LOST;
+            }
+        }
+        if (inflight == 0)
+        {
+            break;
+        }
+
+        Frame frame;
+        if (proto_recv(serverfd, &frame) != 0)
+        {
+            goto LOST;
+        }
+        if (frame.type == MSG_ERROR)
+        {
+            fprintf(stderr, "server error %u on job %llu: %.*s\n",
+                    (frame.length >= 4) ? proto_get_u32(frame.payload) : 0,
+                    (unsigned long long)frame.job_id,
+                    (frame.length >= 4) ? (int)frame.length - 4 : 0, frame.payload + 4);
+            fail_jobs(queue);
+            free(ids);
+            return -1;
+        }
+
+        double value = 0;
+        double error = 0;
+        long slot = 0;
+        while (slot < inflight && (uint64_t)ids[slot] != frame.job_id)
+        {
+            slot++;
+        }
+        if (proto_parse_result(&frame, &value, &error) < 0 || slot == inflight)
+        {
+            fprintf(stderr, "unexpected frame of type %u\n", frame.type);
+            goto LOST;
+        }
+        ids[slot] = ids[--inflight];
+        finish_job(queue, frame.job_id, value, error);
+        args->jobs++;
+    }
+
+    free(ids);
+    return proto_send_empty(serverfd, MSG_BYE, 0);
+
+LOST:
+    printf("Lost connection %ld, %ld jobs go back to the queue\n", args->index, inflight);
+    return_jobs(queue, ids, inflight);
+    free(ids);
+    return -1;
 }
 
 static void *thread_routine(void *data)
@@ -261,18 +530,6 @@ static void *thread_routine(void *data)
     int sockfd = args->sockfd;
     int broadcastfd = args->broadcastfd;
 
-    long start_subint = args->index * (TOTAL_SUBINTERVALS / args->total_threads);
-    long subintervals = 0;
-    if (args->index != args->total_threads - 1)
-    {
-        subintervals = TOTAL_SUBINTERVALS / args->total_threads;
-    }
-    else
-    {
-        subintervals = TOTAL_SUBINTERVALS - (TOTAL_SUBINTERVALS / args->total_threads) *
-                       (args->total_threads - 1);
-    }
-
     int serverfd = 0;
     // TODO: move to another function?
     while (1)
@@ -315,42 +572,22 @@ static void *thread_routine(void *data)
         puts("Connecting to server...");
         serverfd = server_handshake(sockfd);
         pthread_mutex_unlock(&mutex);
-        if (serverfd >= 0)
-        {
-            puts("Server connected");
-        }
-        else
+        if (serverfd < 0)
         {
             puts("Server handshake failed...");
-        }
-
-        long buffer[] = {start_subint, subintervals};
-        if (write(serverfd, (char *)buffer, sizeof(buffer)) < sizeof(buffer))
-        {
-            perror("write");
-            close(serverfd);
             continue;
         }
+        puts("Server connected");
 
-        double value;
-        ssize_t bytesread = read(serverfd, (char *)&value, sizeof(value));
-        if (bytesread < 0)
+        // the other connections finish the jobs of a lost one
+        if (run_jobs(serverfd, args) < 0)
         {
-            perror("read");
             close(serverfd);
-            exit(EXIT_FAILURE);
-            continue;
-        }
-        else if (bytesread == 0)
-        {
-            puts("Lost connection!");
-            close(serverfd);
-            exit(EXIT_FAILURE);
-            continue;
+            retval = EXIT_FAILURE;
+            goto RETURN;
         }
 
-        args->result = value;
-        printf("Received: %lg\n", value);
+        printf("Connection %ld: %ld jobs\n", args->index, args->jobs);
         close(serverfd);
         break;
     }
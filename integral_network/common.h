@@ -37,7 +37,6 @@ typedef struct Data
 #define MAX_SERVERS 1024
 
 static const char MSG_BROADCAST[] = "HI";
-static const char MSG_RESPONSE[] = "OH HI";
 
 int parse_arg(const char *str, long *ptr);
 int setfd_nonblock(int fd);
@@ -0,0 +1,246 @@
+#include "protocol.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#define JOB_SIZE 24
+#define RESULT_SIZE 16
+
+void proto_put_u32(unsigned char *p, uint32_t v)
+{
+    for (int i = 3; i >= 0; i--)
+    {
+        p[i] = v & 0xff;
+        v >>= 8;
+    }
+}
+
+void proto_put_u64(unsigned char *p, uint64_t v)
+{
+    for (int i = 7; i >= 0; i--)
+    {
+        p[i] = v & 0xff;
+        v >>= 8;
+    }
+}
+
+void proto_put_f64(unsigned char *p, double v)
+{
+    uint64_t bits = 0;
+    memcpy(&bits, &v, sizeof(bits));
+    proto_put_u64(p, bits);
+}
+
+uint32_t proto_get_u32(const unsigned char *p)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+uint64_t proto_get_u64(const unsigned char *p)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+double proto_get_f64(const unsigned char *p)
+{
+    uint64_t bits = proto_get_u64(p);
+    double v = 0;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+static int write_full(int fd, const unsigned char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            perror("write");
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// 1 if the peer closed before the first byte
+static int read_full(int fd, unsigned char *buf, size_t len)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t n = read(fd, buf + done, len - done);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            perror("read");
+            return -1;
+        }
+        if (n == 0)
+        {
+            return (done == 0) ? 1 : -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+int proto_send(int fd, const Frame *frame)
+{
+    // one write per frame, so that pipelined frames do not wait on Nagle
+    unsigned char buf[PROTO_HEADER_SIZE + PROTO_MAX_PAYLOAD];
+    if (frame->length > PROTO_MAX_PAYLOAD)
+    {
+        fprintf(stderr, "proto_send: payload of %u bytes\n", frame->length);
+        return -1;
+    }
+
+    proto_put_u32(buf, PROTO_MAGIC);
+    buf[4] = PROTO_VERSION;
+    buf[5] = frame->type;
+    buf[6] = 0;
+    buf[7] = 0;
+    proto_put_u64(buf + 8, frame->job_id);
+    proto_put_u32(buf + 16, frame->length);
+    memcpy(buf + PROTO_HEADER_SIZE, frame->payload, frame->length);
+
+    return write_full(fd, buf, PROTO_HEADER_SIZE + frame->length);
+}
+
+int proto_recv(int fd, Frame *frame)
+{
+    unsigned char header[PROTO_HEADER_SIZE];
+    int result = read_full(fd, header, sizeof(header));
+    if (result != 0)
+    {
+        return result;
+    }
+
+    if (proto_get_u32(header) != PROTO_MAGIC)
+    {
+        fprintf(stderr, "proto_recv: not a frame\n");
+        return -1;
+    }
+    if (header[4] != PROTO_VERSION)
+    {
+        fprintf(stderr, "proto_recv: protocol version %u, expected %u\n",
+                header[4], PROTO_VERSION);
+        return -1;
+    }
+    frame->type = header[5];
+    frame->job_id = proto_get_u64(header + 8);
+    frame->length = proto_get_u32(header + 16);
+    if (frame->length > PROTO_MAX_PAYLOAD)
+    {
+        fprintf(stderr, "proto_recv: payload of %u bytes\n", frame->length);
+        return -1;
+    }
+
+    return (read_full(fd, frame->payload, frame->length) == 0) ? 0 : -1;
+}
+
+int proto_send_empty(int fd, MsgType type, uint64_t job_id)
+{
+    Frame frame;
+    frame.type = type;
+    frame.job_id = job_id;
+    frame.length = 0;
+    return proto_send(fd, &frame);
+}
+
+int proto_send_job(int fd, uint64_t job_id, const Job *job)
+{
+    Frame frame;
+    size_t len = strlen(job->expr);
+    if (len > PROTO_MAX_EXPR)
+    {
+        fprintf(stderr, "proto_send_job: expression of %zu bytes\n", len);
+        return -1;
+    }
+    frame.type = MSG_JOB;
+    frame.job_id = job_id;
+    frame.length = JOB_SIZE + len;
+    proto_put_u64(frame.payload, (uint64_t)job->first);
+    proto_put_u64(frame.payload + 8, (uint64_t)job->count);
+    proto_put_u32(frame.payload + 16, job->flags);
+    proto_put_u32(frame.payload + 20, len);
+    memcpy(frame.payload + JOB_SIZE, job->expr, len);
+    return proto_send(fd, &frame);
+}
+
+int proto_send_result(int fd, uint64_t job_id, double value, double error)
+{
+    Frame frame;
+    frame.type = MSG_RESULT;
+    frame.job_id = job_id;
+    frame.length = RESULT_SIZE;
+    proto_put_f64(frame.payload, value);
+    proto_put_f64(frame.payload + 8, error);
+    return proto_send(fd, &frame);
+}
+
+int proto_send_error(int fd, uint64_t job_id, uint32_t code, const char *text)
+{
+    Frame frame;
+    size_t len = strlen(text);
+    if (len > PROTO_MAX_PAYLOAD - 4)
+    {
+        len = PROTO_MAX_PAYLOAD - 4;
+    }
+    frame.type = MSG_ERROR;
+    frame.job_id = job_id;
+    frame.length = 4 + len;
+    proto_put_u32(frame.payload, code);
+    memcpy(frame.payload + 4, text, len);
+    return proto_send(fd, &frame);
+}
+
+int proto_parse_job(const Frame *frame, Job *job)
+{
+    if (frame->type != MSG_JOB || frame->length < JOB_SIZE)
+    {
+        return -1;
+    }
+    job->first = (int64_t)proto_get_u64(frame->payload);
+    job->count = (int64_t)proto_get_u64(frame->payload + 8);
+    job->flags = proto_get_u32(frame->payload + 16);
+    uint32_t len = proto_get_u32(frame->payload + 20);
+    if (len != frame->length - JOB_SIZE || memchr(frame->payload + JOB_SIZE, 0, len))
+    {
+        return -1;
+    }
+    memcpy(job->expr, frame->payload + JOB_SIZE, len);
+    job->expr[len] = 0;
+    return (job->first >= 0 && job->count >= 0) ? 0 : -1;
+}
+
+int proto_parse_result(const Frame *frame, double *value, double *error)
+{
+    if (frame->type != MSG_RESULT || frame->length < RESULT_SIZE)
+    {
+        return -1;
+    }
+    *value = proto_get_f64(frame->payload);
+    *error = proto_get_f64(frame->payload + 8);
+    return 0;
+}
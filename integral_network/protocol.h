@@ -0,0 +1,76 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+
+/* Frames on the client-server TCP connection, which stays open for many
+ * jobs. Every frame is a fixed header followed by length payload bytes.
+ * All integers are big-endian, and doubles travel as the big-endian bits
+ * of their IEEE 754 encoding.
+ *
+ * header: u32 magic | u8 version | u8 type | u16 reserved | u64 job id |
+ *         u32 payload length */
+#define PROTO_MAGIC 0x494E5447u     // "INTG"
+#define PROTO_VERSION 2
+#define PROTO_HEADER_SIZE 20
+#define PROTO_MAX_PAYLOAD 1024
+// what a job has left for its expression after the fixed fields
+#define PROTO_MAX_EXPR (PROTO_MAX_PAYLOAD - 24)
+
+typedef enum MsgType
+{
+    MSG_HELLO = 1,  // server -> client once connected, replaces "OH HI"
+    MSG_JOB,        // client -> server: i64 first subinterval, i64 count, u32 flags,
+                    // u32 expression length, expression (empty: built-in)
+    MSG_RESULT,     // server -> client: f64 value, f64 error estimate
+    MSG_ERROR,      // server -> client: u32 code, then text
+    MSG_BYE         // client -> server: no more jobs on this connection
+} MsgType;
+
+// flags of a job
+#define JOB_MIXED 1u        // float32 evaluation with an error estimate
+
+// codes of MSG_ERROR
+#define PROTO_ERR_VERSION 1
+#define PROTO_ERR_BAD_FRAME 2
+#define PROTO_ERR_BAD_JOB 3
+#define PROTO_ERR_BAD_EXPR 4
+
+typedef struct Frame
+{
+    uint8_t type;
+    uint64_t job_id;
+    uint32_t length;
+    unsigned char payload[PROTO_MAX_PAYLOAD];
+} Frame;
+
+typedef struct Job
+{
+    int64_t first;
+    int64_t count;
+    uint32_t flags;
+    char expr[PROTO_MAX_EXPR + 1];  // in x, for integral's expression compiler
+} Job;
+
+void proto_put_u32(unsigned char *p, uint32_t v);
+void proto_put_u64(unsigned char *p, uint64_t v);
+void proto_put_f64(unsigned char *p, double v);
+uint32_t proto_get_u32(const unsigned char *p);
+uint64_t proto_get_u64(const unsigned char *p);
+double proto_get_f64(const unsigned char *p);
+
+// Whole frames only: 0 on success, -1 on errors. proto_recv returns 1 on
+// an orderly close before a frame starts, and -1 for a bad magic, an
+// unknown version or an oversized payload.
+int proto_send(int fd, const Frame *frame);
+int proto_recv(int fd, Frame *frame);
+
+int proto_send_empty(int fd, MsgType type, uint64_t job_id);
+// fails for an expression longer than PROTO_MAX_EXPR
+int proto_send_job(int fd, uint64_t job_id, const Job *job);
+int proto_send_result(int fd, uint64_t job_id, double value, double error);
+int proto_send_error(int fd, uint64_t job_id, uint32_t code, const char *text);
+int proto_parse_job(const Frame *frame, Job *job);
+int proto_parse_result(const Frame *frame, double *value, double *error);
+
+#endif /* ifndef PROTOCOL_H */
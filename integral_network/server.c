@@ -7,56 +7,169 @@
 #include <sys/select.h>
 #include <netinet/in.h>
 #include <string.h>
+#include <errno.h>
+#include <signal.h>
 #include <pthread.h>
 #include <sched.h>
 #include <net/if.h>
 #include <netinet/tcp.h>
 #include "common.h"
+#include "protocol.h"
+#include <getopt.h>
+#include <limits.h>
+#include "autotune.h"
 #include "cpuinfo.h"
+#include "integral.h"
+#include "integrand.h"
+#include "kernel.h"
+#include "placement.h"
+#include "trace.h"
+
+/* long options have no short form */
+#define OPT_AUTOTUNE 256
+#define OPT_TRACE 257
+#define OPT_COUNTERS 258
 
 typedef struct ThreadArgs
 {
     int broadcastfd;
+    long worker;
+    Trace *trace;               // NULL unless instrumented
+    const char *trace_path;     // rewritten after every calculation
+    int trace_table;
+    int mixed;                  // float32 evaluation
 } ThreadArgs;
 
 static int bind_broadcastsock(int broadcastfd);
 static int spawn_threads(pthread_t *threads, ThreadArgs *threadargs,
-                          pthread_attr_t *attr, long n,
-                          size_t physical_cores, size_t cores_used);
-static void server_routine(int broadcastfd);
+                         pthread_attr_t *attr, long n, const Placement *placement);
+static void server_routine(const ThreadArgs *args);
 static void *thread_routine(void *data);
 static int handshake(int broadcastfd);
-static double f(double x);
-static double calculate(long start_subint, long subintervals);
-static void *fake_thread(void *data);
+static double calculate(const Job *job, const IntegralExpr *expr, int mixed, double *error);
+static int usage(void);
 
 int main(int argc, char *argv[])
 {
     int retval = EXIT_SUCCESS;
-    size_t physical_cores = 0;
-    size_t cores_used = 0;
     long n = 0;
+    static Placement placement = {PLACEMENT_SCATTER, 0, {0}, 0};
+    int placement_set = 0;
+    int autotune = 0;
+    KernelIsa isa = KERNEL_AUTO;
+    const char *trace_path = NULL;
+    int trace_table = 0;
+    int mixed = 0;
+    static const struct option long_options[] =
+    {
+        {"autotune", no_argument, NULL, OPT_AUTOTUNE},
+        {"trace", required_argument, NULL, OPT_TRACE},
+        {"counters", no_argument, NULL, OPT_COUNTERS},
+        {NULL, 0, NULL, 0}
+    };
+
+    int opt = 0;
+    while ((opt = getopt_long(argc, argv, "p:S:M", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case OPT_AUTOTUNE:
+            autotune = 1;
+            break;
+        case OPT_TRACE:
+            trace_path = optarg;
+            break;
+        case OPT_COUNTERS:
+            trace_table = 1;
+            break;
+        case 'p':
+            if (placement_parse(optarg, &placement) < 0)
+            {
+                return usage();
+            }
+            placement_set = 1;
+            break;
+        case 'M':
+            mixed = 1;
+            break;
+        case 'S':
+            if (strcmp(optarg, "on") != 0 && strcmp(optarg, "off") != 0)
+            {
+                return usage();
+            }
+            placement.spinners = (strcmp(optarg, "on") == 0);
+            break;
+        default:
+            return usage();
+        }
+    }
 
-    if (argc != 2)
+    if (optind < argc - 1)
     {
-        fprintf(stderr, "Usage: server [worker_count]\n");
-        return EXIT_FAILURE;
+        return usage();
     }
-    if (parse_arg(argv[1], &n) < 0)
+    if (optind == argc - 1 && parse_arg(argv[optind], &n) < 0)
     {
         return EXIT_FAILURE;
     }
 
+    // the chunk size is the client's; the rest comes from the host profile
+    TuneConfig tuned;
+    char profile[PATH_MAX];
+    int have_profile = autotune_profile_path(profile, sizeof(profile)) == 0;
+    int tuned_ok = 0;
+    if (autotune)
+    {
+        if (autotune_run(&tuned, 1) < 0)
+        {
+            fprintf(stderr, "autotune failed\n");
+            return EXIT_FAILURE;
+        }
+        if (have_profile && autotune_save(profile, &tuned) == 0)
+        {
+            printf("Saved tuned profile to %s\n", profile);
+        }
+        tuned_ok = 1;
+    }
+    else if (have_profile && autotune_load(profile, &tuned) == 0)
+    {
+        tuned_ok = kernel_supported(tuned.isa);
+    }
+    if (tuned_ok)
+    {
+        printf("Using tuned profile: %ld workers, %s placement, %s kernel\n",
+               tuned.threads, placement_name(tuned.policy), kernel_name(tuned.isa));
+        n = n ? n : tuned.threads;
+        placement.policy = placement_set ? placement.policy : tuned.policy;
+        isa = tuned.isa;
+    }
+    if (n == 0)
+    {
+        return usage();
+    }
+
+    // a client that goes away only ends its connection
+    signal(SIGPIPE, SIG_IGN);
+
     pthread_attr_t attr;
-    if (pthread_attr_init(&attr) != 0)
+    if ((errno = pthread_attr_init(&attr)) != 0)
     {
         perror("pthread_attr_init");
         return EXIT_FAILURE;
     }
 
-    cpuinfo_parse();
-    physical_cores = cpuinfo_getphysicalcores();
-    cores_used = MIN(physical_cores, n);
+    if (kernel_init(isa) < 0)
+    {
+        return EXIT_FAILURE;
+    }
+    printf("Using %s kernel\n", kernel_name(kernel_isa()));
+
+    if (placement.policy != PLACEMENT_NONE)
+    {
+        cpuinfo_parse();
+    }
+    printf("Placement: %s, turbo spinners %s\n", placement_name(placement.policy),
+           placement.spinners ? "on" : "off");
 
     pthread_t threads[n];
     ThreadArgs threadargs[n];
@@ -73,24 +186,44 @@ int main(int argc, char *argv[])
         goto CLOSE_BROADCASTFD;
     }
 
+    Trace *trace = NULL;
+    if (trace_path || trace_table)
+    {
+        trace = trace_new(n);
+        if (!trace)
+        {
+            perror("trace_new");
+            goto CLOSE_BROADCASTFD;
+        }
+    }
+
     for (long i = 0; i < n; i++)
     {
         threadargs[i].broadcastfd = broadcastfd;
+        threadargs[i].worker = i;
+        threadargs[i].trace = trace;
+        threadargs[i].trace_path = trace_path;
+        threadargs[i].trace_table = trace_table;
+        threadargs[i].mixed = mixed;
     }
 
-    if (spawn_threads(threads, threadargs, &attr, n, physical_cores, cores_used) < 0)
+    if (spawn_threads(threads, threadargs, &attr, n, &placement) < 0)
     {
         goto CLOSE_BROADCASTFD;
     }
 
     for (long i = 0; i < n; i++)
     {
-        if (pthread_join(threads[i], NULL) != 0)
+        if ((errno = pthread_join(threads[i], NULL)) != 0)
         {
             perror("pthread_join");
             goto CLOSE_BROADCASTFD;
         }
     }
+    if (trace)
+    {
+        trace_delete(trace);
+    }
 
 CLOSE_BROADCASTFD:
     close(broadcastfd);
@@ -116,84 +249,56 @@ int bind_broadcastsock(int broadcastfd)
     return 0;
 }
 
-// TODO: refactor
 int spawn_threads(pthread_t *threads, ThreadArgs *threadargs,
-                   pthread_attr_t *attr, long n,
-                   size_t physical_cores, size_t cores_used)
+                  pthread_attr_t *attr, long n, const Placement *placement)
 {
-    long free_workers = n;
-    long workers_per_core = n / cores_used;
-
-    for (int core = 0; core < cores_used; core++)
+    int retval = 0;
+    int *cpus = (int *)malloc(sizeof(int) * n);
+    if (!cpus)
     {
-        long workers_thiscore = workers_per_core;
-        if (core == cores_used - 1)
-        {
-            workers_thiscore = free_workers;
-        }
-        free_workers -= workers_thiscore;
-
-        size_t logical_cnt = MIN(cpuinfo_getlogicalcores(core),
-                                 workers_thiscore);
-        long workers_per_logical = workers_thiscore / logical_cnt;
-
-        for (long curlogical = 0; curlogical < logical_cnt; curlogical++)
-        {
-            long workers_log = workers_per_logical;
-            if (curlogical == logical_cnt - 1)
-            {
-                workers_log = workers_thiscore;
-            }
-            workers_thiscore -= workers_log;
-
-            for (long i = 0; i < workers_log; i++)
-            {
-                cpu_set_t cpuset;
-                CPU_ZERO(&cpuset);
-                CPU_SET(cpuinfo_getlogicalcoreid(core, curlogical), &cpuset);
-                if (pthread_attr_setaffinity_np(attr, sizeof(cpu_set_t), &cpuset))
-                {
-                    perror("pthread_attr_setaffinity_np");
-                    return -1;
-                }
-
-                if (pthread_create(&threads[i], attr, thread_routine, &threadargs[i]) != 0)
-                {
-                    perror("pthread_create");
-                    return -1;
-                }
-            }
-        }
+        perror("malloc");
+        return -1;
     }
+    placement_plan(placement, n, cpus, NULL);
 
-    // kill TurboBoost
-    for (long i = n; i < physical_cores; i++)
+    for (long i = 0; i < n; i++)
     {
-        int cpu = cpuinfo_getlogicalcoreid(i, 0);
         cpu_set_t cpuset;
         CPU_ZERO(&cpuset);
-        CPU_SET(cpu, &cpuset);
-        if (pthread_attr_setaffinity_np(attr, sizeof(cpu_set_t), &cpuset))
+        if (cpus[i] >= 0)
+        {
+            CPU_SET(cpus[i], &cpuset);
+        }
+        else
+        {
+            sched_getaffinity(0, sizeof(cpuset), &cpuset);
+        }
+        if ((errno = pthread_attr_setaffinity_np(attr, sizeof(cpu_set_t), &cpuset)) != 0)
         {
             perror("pthread_attr_setaffinity_np");
-            return -1;
+            retval = -1;
+            goto FREE_CPUS;
         }
 
-        pthread_t t;
-        if (pthread_create(&t, attr, fake_thread, NULL) != 0)
+        if ((errno = pthread_create(&threads[i], attr, thread_routine, &threadargs[i])) != 0)
         {
             perror("pthread_create");
-            return -1;
+            retval = -1;
+            goto FREE_CPUS;
         }
     }
 
-    return 0;
+    retval = placement_spin_idle(placement, cpus, n);
+
+FREE_CPUS:
+    free(cpus);
+    return retval;
 }
 
-void server_routine(int broadcastfd)
+void server_routine(const ThreadArgs *args)
 {
     puts("Initiating handshake...");
-    int fd = handshake(broadcastfd);
+    int fd = handshake(args->broadcastfd);
     if (fd < 0)
     {
         puts("Retrying to connect to client...");
@@ -201,37 +306,95 @@ void server_routine(int broadcastfd)
     }
     puts("Handshake established...");
 
-    long argsbuf[2];
-    ssize_t bytesread = read(fd, (char *)argsbuf, sizeof(argsbuf));
-    if (bytesread < 0)
-    {
-        perror("read");
-        goto CLOSE_FD;
-    }
-    else if (bytesread == 0)
+    // jobs until the client says goodbye or goes away; the last expression
+    // stays compiled, since a client sends the same one with every job
+    long jobs = 0;
+    int result = 0;
+    Frame frame;
+    char compiled[PROTO_MAX_EXPR + 1] = "";
+    IntegralExpr *expr = NULL;
+    while ((result = proto_recv(fd, &frame)) == 0 && frame.type != MSG_BYE)
     {
-        puts("Lost connection!");
-        goto CLOSE_FD;
-    }
+        Job job;
+        // first + count could overflow with a hostile peer's values
+        if (proto_parse_job(&frame, &job) < 0 || job.first > TOTAL_SUBINTERVALS ||
+            job.count > TOTAL_SUBINTERVALS - job.first)
+        {
+            if (proto_send_error(fd, frame.job_id, PROTO_ERR_BAD_JOB, "bad job") < 0)
+            {
+                goto CLOSE_FD;
+            }
+            continue;
+        }
+        if (job.expr[0] && (job.flags & JOB_MIXED))
+        {
+            if (proto_send_error(fd, frame.job_id, PROTO_ERR_BAD_JOB,
+                                 "mixed precision needs the built-in integrand") < 0)
+            {
+                goto CLOSE_FD;
+            }
+            continue;
+        }
+        if (strcmp(job.expr, compiled) != 0)
+        {
+            char err[128];
+            integral_expr_free(expr);
+            expr = NULL;
+            compiled[0] = 0;
+            if (job.expr[0] && !(expr = integral_expr_compile(job.expr, err, sizeof(err))))
+            {
+                char text[160];
+                snprintf(text, sizeof(text), "bad expression: %s", err);
+                if (proto_send_error(fd, frame.job_id, PROTO_ERR_BAD_EXPR, text) < 0)
+                {
+                    goto CLOSE_FD;
+                }
+                continue;
+            }
+            strcpy(compiled, job.expr);
+        }
 
-    puts("Calculating...");
-    double value = calculate(argsbuf[0], argsbuf[1]);
-    printf("Calculated value: %lg\n\n", value);
-    ssize_t bytessent = write(fd, &value, sizeof(value));
-    if (bytessent < 0)
-    {
-        perror("bytessent");
-        exit(EXIT_FAILURE);
-        goto CLOSE_FD;
+        double error = 0;
+        double value = 0;
+        // the float32 kernels only exist for the built-in integrand
+        int mixed = !expr && (args->mixed || (job.flags & JOB_MIXED));
+        if (!args->trace)
+        {
+            value = calculate(&job, expr, mixed, &error);
+        }
+        else
+        {
+            trace_begin(args->trace, args->worker);
+            value = calculate(&job, expr, mixed, &error);
+            trace_end(args->trace, args->worker, "calculate");
+            if (args->trace_path)
+            {
+                trace_write_chrome(args->trace, args->trace_path);
+            }
+            if (args->trace_table)
+            {
+                trace_print(args->trace, stdout);
+            }
+        }
+        printf("Job %llu: %lg\n", (unsigned long long)frame.job_id, value);
+
+        if (proto_send_result(fd, frame.job_id, value, error) < 0)
+        {
+            goto CLOSE_FD;
+        }
+        jobs++;
     }
-    else if (bytessent < sizeof(value))
+
+    if (result < 0)
     {
-        fprintf(stderr, "write failure");
-        exit(EXIT_FAILURE);
-        goto CLOSE_FD;
+        // best effort: a peer of another version cannot parse it anyway
+        proto_send_error(fd, 0, PROTO_ERR_BAD_FRAME, "bad frame or protocol version");
+        puts("Lost connection!");
     }
+    printf("Connection closed after %ld jobs\n\n", jobs);
 
 CLOSE_FD:
+    integral_expr_free(expr);
     close(fd);
 }
 
@@ -239,11 +402,10 @@ void *thread_routine(void *data)
 {
     puts("Thread spawned");
     ThreadArgs *args = (ThreadArgs *)data;
-    int broadcastfd = args->broadcastfd;
 
     while (1)
     {
-        server_routine(broadcastfd);
+        server_routine(args);
     }
 
     return NULL;
@@ -297,6 +459,9 @@ int handshake(int broadcastfd)
     setsockopt(sockfd, IPPROTO_TCP, TCP_KEEPCNT, &keepcnt, sizeof(int));
     setsockopt(sockfd, IPPROTO_TCP, TCP_KEEPIDLE, &keepidle, sizeof(int));
     setsockopt(sockfd, IPPROTO_TCP, TCP_KEEPINTVL, &keepintvl, sizeof(int));
+    // results are small frames that should not wait for more data
+    int nodelay = 1;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(int));
 
     puts("Connecting...");
     from.sin_port = htons(PORT);
@@ -307,15 +472,8 @@ int handshake(int broadcastfd)
     }
     puts("Connection established...");
 
-    ssize_t bytes_sent = send(sockfd, MSG_RESPONSE, sizeof(MSG_RESPONSE), 0);
-    if (bytes_sent < 0)
+    if (proto_send_empty(sockfd, MSG_HELLO, 0) < 0)
     {
-        perror("send");
-        goto CLOSE_SOCKFD;
-    }
-    if (bytes_sent != sizeof(MSG_RESPONSE))
-    {
-        fprintf(stderr, "send wrong amount of bytes sent");
         goto CLOSE_SOCKFD;
     }
 
@@ -328,30 +486,38 @@ RETURN:
     return -1;
 }
 
-double f(double x)
+double calculate(const Job *job, const IntegralExpr *expr, int mixed, double *error)
 {
-    return (2 - x * x) / (4 + x);
-}
-
-double calculate(long start_subint, long subintervals)
-{
-    double start = START + STEP * start_subint;
-    double end = START + STEP * (start_subint + subintervals);
+    double start = START + STEP * job->first;
+    double end = START + STEP * (job->first + job->count);
     printf("Start: %lg, end: %lg\n", start, end);
 
-    double value = (f(start) + f(end)) / 2;
-    for (long i = 1; i < subintervals; i++)
+    *error = 0;
+    if (mixed)
     {
-        value += f(start + STEP * i);
+        double value = kernel_trapezoid_mixed(START, STEP, job->first,
+                                              job->first + job->count, error);
+        printf("Mixed precision error estimate: %lg\n", *error);
+        return value;
     }
-    value *= STEP;
-
-    return value;
+    if (expr)
+    {
+        IntegralFunc f = {NULL, expr};
+        return integrand_trapezoid(&f, START, STEP, job->first, job->first + job->count);
+    }
+    return kernel_trapezoid(START, STEP, job->first, job->first + job->count);
 }
 
-void *fake_thread(void *data)
+int usage(void)
 {
-    for (;;) {}
-
-    return NULL;
+    fprintf(stderr, "Usage: server [--autotune] [-p scatter|compact|physical|smt|none|list:cpus] "
+                    "[-S on|off] [-M]\n"
+                    "              [--trace chrome trace file] [--counters] [worker_count]\n"
+                    "Without a worker count, it comes from the host's tuned profile.\n"
+                    "--trace rewrites a Chrome trace of the calculations after each one;\n"
+                    "--counters prints the per-worker hardware counter totals.\n"
+                    "-M evaluates the built-in integrand in float32 and prints each\n"
+                    "result's error estimate; jobs may carry an expression instead.\n"
+                    "-S on spins on the idle physical cores, within the usable CPUs.\n");
+    return EXIT_FAILURE;
 }